@@ -0,0 +1,34 @@
+#include <iostream>
+#include <ros/ros.h>
+
+#include <hdl_localization/globalmap_io.hpp>
+
+/**
+ * @brief offline tool to create a globalmap cache for globalmap_server_nodelet and hdl_localization_nodelet
+ * @note  usage: globalmap_cache_builder map.pcd map.cache [downsample_resolution=0.1] [convert_utm_to_local=1]
+ *        the arguments must match the globalmap_server_nodelet params, otherwise the cache is rejected at startup
+ */
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0] << " map.pcd map.cache [downsample_resolution=0.1] [convert_utm_to_local=1]" << std::endl;
+    return 1;
+  }
+
+  const std::string globalmap_pcd = argv[1];
+  const std::string globalmap_cache = argv[2];
+  const double downsample_resolution = argc > 3 ? std::stod(argv[3]) : 0.1;
+  const bool convert_utm_to_local = argc > 4 ? std::stoi(argv[4]) != 0 : true;
+
+  std::cout << "load " << globalmap_pcd << std::endl;
+  auto globalmap = hdl_localization::load_globalmap_pcd(globalmap_pcd, convert_utm_to_local, downsample_resolution);
+  if (!globalmap) {
+    return 1;
+  }
+
+  std::cout << "save " << globalmap->size() << " points to " << globalmap_cache << std::endl;
+  if (!hdl_localization::save_globalmap_cache(globalmap_cache, *globalmap, globalmap_pcd, convert_utm_to_local, downsample_resolution)) {
+    return 1;
+  }
+
+  return 0;
+}
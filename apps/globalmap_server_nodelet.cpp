@@ -1,6 +1,9 @@
 #include <mutex>
+#include <deque>
+#include <algorithm>
 #include <memory>
 #include <iostream>
+#include <unordered_set>
 
 #include <ros/ros.h>
 #include <pcl_ros/point_cloud.h>
@@ -14,6 +17,14 @@
 
 #include <pcl/filters/voxel_grid.h>
 
+#include <hdl_localization/globalmap_io.hpp>
+#include <hdl_localization/globalmap_patch.hpp>
+#include <hdl_localization/globalmap_tiles.hpp>
+#include <hdl_localization/globalmap_tile_codec.hpp>
+#include <hdl_localization/MapPatch.h>
+#include <hdl_localization/GlobalmapTile.h>
+#include <hdl_localization/GlobalmapTileRequest.h>
+
 namespace hdl_localization {
 
 class GlobalmapServerNodelet : public nodelet::Nodelet {
@@ -32,44 +43,69 @@ public:
 
     initialize_params();
 
+    // CLOUD: the whole map on /globalmap, TILES: tiles on /globalmap_tiles on request, BOTH: both of them
+    const std::string publish_mode = private_nh.param<std::string>("globalmap_publish_mode", "CLOUD");
+    publish_cloud = publish_mode != "TILES";
+    publish_tiles = publish_mode != "CLOUD";
+
     // publish globalmap with "latched" publisher
-    globalmap_pub = nh.advertise<sensor_msgs::PointCloud2>("/globalmap", 5, true);
+    // the typed cloud is published so that nodelets in the same manager receive it without serialization (never modify a published map)
+    if (publish_cloud) {
+      globalmap_pub = nh.advertise<pcl::PointCloud<PointT>>("/globalmap", 5, true);
+    }
     map_update_sub = nh.subscribe("/map_request/pcd", 10,              &GlobalmapServerNodelet::map_update_callback, this);
 
-    globalmap_pub_timer = nh.createWallTimer(ros::WallDuration(1.0), &GlobalmapServerNodelet::pub_once_cb, this, true, true);
+    // partial map updates: only the preprocessed patch is published, so that the subscribers apply the edit instead of receiving
+    // the whole map again. with republish_patched_globalmap, the patched map is also republished on /globalmap after the patch
+    // (for subscribers that start later, or that take the map object published in the same manager)
+    republish_patched_globalmap = private_nh.param<bool>("republish_patched_globalmap", false);
+    globalmap_patch_pub = nh.advertise<MapPatch>("/globalmap_patch", 5, false);
+    map_patch_sub = nh.subscribe("/map_request/patch", 10, &GlobalmapServerNodelet::map_patch_callback, this);
+
+    // tiled publication: each tile is a small message, so that the map is sent across machines without one huge serialization
+    if (publish_tiles) {
+      tile_size = private_nh.param<double>("globalmap_tile_size", 20.0);
+      tile_resolution = private_nh.param<double>("globalmap_tile_resolution", 0.0);
+      tiles_per_tick = std::max(1, static_cast<int>(private_nh.param<double>("globalmap_tile_rate", 50.0) / 10.0));
+      update_tiles();
+
+      globalmap_tile_pub = nh.advertise<GlobalmapTile>("/globalmap_tiles", 32, false);
+      tile_request_sub = nh.subscribe("/map_request/tiles", 10, &GlobalmapServerNodelet::tile_request_callback, this);
+      tile_pub_timer = nh.createWallTimer(ros::WallDuration(0.1), &GlobalmapServerNodelet::tile_pub_cb, this);
+    }
+
+    if (publish_cloud) {
+      globalmap_pub_timer = nh.createWallTimer(ros::WallDuration(1.0), &GlobalmapServerNodelet::pub_once_cb, this, true, true);
+    }
   }
 
 private:
   void initialize_params() {
-    // read globalmap from a pcd file
+    // read globalmap from a pcd file (or its preprocessed cache)
     std::string globalmap_pcd = private_nh.param<std::string>("globalmap_pcd", "");
-    globalmap.reset(new pcl::PointCloud<PointT>());
-    pcl::io::loadPCDFile(globalmap_pcd, *globalmap);
-    globalmap->header.frame_id = "map";
-
-    std::ifstream utm_file(globalmap_pcd + ".utm");
-    if (utm_file.is_open() && private_nh.param<bool>("convert_utm_to_local", true)) {
-      double utm_easting;
-      double utm_northing;
-      double altitude;
-      utm_file >> utm_easting >> utm_northing >> altitude;
-      for(auto& pt : globalmap->points) {
-        pt.getVector3fMap() -= Eigen::Vector3f(utm_easting, utm_northing, altitude);
+    std::string globalmap_cache = private_nh.param<std::string>("globalmap_cache", "");
+    bool convert_utm_to_local = private_nh.param<bool>("convert_utm_to_local", true);
+    double downsample_resolution = private_nh.param<double>("downsample_resolution", 0.1);
+
+    if (!globalmap_cache.empty()) {
+      globalmap = load_globalmap_cache(globalmap_cache, globalmap_pcd, convert_utm_to_local, downsample_resolution);
+      if (globalmap) {
+        ROS_INFO_STREAM("Global map loaded from cache " << globalmap_cache << " (" << globalmap->size() << " points)");
+        return;
       }
-      ROS_INFO_STREAM("Global map offset by UTM reference coordinates (x = "
-                      << utm_easting << ", y = " << utm_northing << ") and altitude (z = " << altitude << ")");
     }
 
-    // downsample globalmap
-    double downsample_resolution = private_nh.param<double>("downsample_resolution", 0.1);
-    boost::shared_ptr<pcl::VoxelGrid<PointT>> voxelgrid(new pcl::VoxelGrid<PointT>());
-    voxelgrid->setLeafSize(downsample_resolution, downsample_resolution, downsample_resolution);
-    voxelgrid->setInputCloud(globalmap);
-
-    pcl::PointCloud<PointT>::Ptr filtered(new pcl::PointCloud<PointT>());
-    voxelgrid->filter(*filtered);
+    globalmap = load_globalmap_pcd(globalmap_pcd, convert_utm_to_local, downsample_resolution);
+    if (!globalmap) {
+      globalmap.reset(new pcl::PointCloud<PointT>());
+      globalmap->header.frame_id = "map";
+      return;
+    }
 
-    globalmap = filtered;
+    if (!globalmap_cache.empty() && private_nh.param<bool>("write_globalmap_cache", true)) {
+      ROS_INFO_STREAM("Write globalmap cache " << globalmap_cache);
+      save_globalmap_cache(globalmap_cache, *globalmap, globalmap_pcd, convert_utm_to_local, downsample_resolution);
+    }
   }
 
   void pub_once_cb(const ros::WallTimerEvent& event) {
@@ -79,21 +115,140 @@ private:
   void map_update_callback(const std_msgs::String &msg){
     ROS_INFO_STREAM("Received map request, map path : "<< msg.data);
     std::string globalmap_pcd = msg.data;
-    globalmap.reset(new pcl::PointCloud<PointT>());
-    pcl::io::loadPCDFile(globalmap_pcd, *globalmap);
-    globalmap->header.frame_id = "map";
 
-    // downsample globalmap
     double downsample_resolution = private_nh.param<double>("downsample_resolution", 0.1);
-    boost::shared_ptr<pcl::VoxelGrid<PointT>> voxelgrid(new pcl::VoxelGrid<PointT>());
-    voxelgrid->setLeafSize(downsample_resolution, downsample_resolution, downsample_resolution);
-    voxelgrid->setInputCloud(globalmap);
+    pcl::PointCloud<PointT>::Ptr cloud = load_globalmap_pcd(globalmap_pcd, false, downsample_resolution);
+    if (!cloud) {
+      return;
+    }
 
-    pcl::PointCloud<PointT>::Ptr filtered(new pcl::PointCloud<PointT>());
-    voxelgrid->filter(*filtered);
+    globalmap = cloud;
+    if (publish_cloud) {
+      globalmap_pub.publish(globalmap);
+    }
 
-    globalmap = filtered;
-    globalmap_pub.publish(globalmap);
+    // the subscribers of the tiles see the new version and replace their tiles
+    if (publish_tiles) {
+      update_tiles();
+      for (const auto& key : tiles->keys()) {
+        enqueue_tile(key);
+      }
+    }
+  }
+
+  /**
+   * @brief split the globalmap into tiles as a new version of the map
+   */
+  void update_tiles() {
+    GlobalmapTiles::Ptr split(new GlobalmapTiles(tile_size));
+    split->insert(*globalmap);
+    tiles = split;
+
+    map_version = ros::Time::now();
+    pending_tiles.clear();
+    pending_tile_keys.clear();
+    ROS_INFO_STREAM("Global map split into " << tiles->num_tiles() << " tiles");
+  }
+
+  /**
+   * @brief queue the tiles requested by a subscriber of /globalmap_tiles
+   */
+  void tile_request_callback(const GlobalmapTileRequestConstPtr& request_msg) {
+    std::unordered_set<std::uint64_t> skip;
+    for (size_t i = 0; i < request_msg->skip_tile_x.size() && i < request_msg->skip_tile_y.size(); i++) {
+      skip.insert(GlobalmapTiles::key(request_msg->skip_tile_x[i], request_msg->skip_tile_y[i]));
+    }
+
+    const Eigen::Vector3f center(request_msg->center.x, request_msg->center.y, request_msg->center.z);
+    const auto keys = request_msg->radius < 0.0 ? tiles->keys() : tiles->keys_within(center, request_msg->radius);
+    for (const auto& key : keys) {
+      if (!skip.count(key)) {
+        enqueue_tile(key);
+      }
+    }
+  }
+
+  void enqueue_tile(std::uint64_t key) {
+    if (pending_tile_keys.insert(key).second) {
+      pending_tiles.push_back(key);
+    }
+  }
+
+  /**
+   * @brief publish the queued tiles at the configured rate to avoid flooding the connections
+   */
+  void tile_pub_cb(const ros::WallTimerEvent& event) {
+    for (int i = 0; i < tiles_per_tick && !pending_tiles.empty(); i++) {
+      const std::uint64_t key = pending_tiles.front();
+      pending_tiles.pop_front();
+      pending_tile_keys.erase(key);
+
+      // a tile may have disappeared with a map patch
+      auto tile = tiles->tile(key);
+      if (!tile) {
+        continue;
+      }
+
+      GlobalmapTilePtr tile_msg = encode_globalmap_tile(*tile, GlobalmapTiles::key_x(key), GlobalmapTiles::key_y(key), tiles->tile_size(), tile_resolution);
+      tile_msg->header.frame_id = globalmap->header.frame_id;
+      tile_msg->header.stamp = map_version;
+      tile_msg->num_tiles = tiles->num_tiles();
+      globalmap_tile_pub.publish(tile_msg);
+    }
+  }
+
+  /**
+   * @brief replace the globalmap points in a box with new points
+   * @note  the patched globalmap is stamped with the patch stamp, so that a subscriber which has applied the patch
+   *        from /globalmap_patch can tell that it already has the map
+   */
+  void map_patch_callback(const MapPatchConstPtr& patch_msg) {
+    Eigen::AlignedBox3f region(Eigen::Vector3f(patch_msg->min_pt.x, patch_msg->min_pt.y, patch_msg->min_pt.z), Eigen::Vector3f(patch_msg->max_pt.x, patch_msg->max_pt.y, patch_msg->max_pt.z));
+    if (region.isEmpty()) {
+      ROS_WARN_STREAM("Received an empty map patch region");
+      return;
+    }
+
+    pcl::PointCloud<PointT>::Ptr points(new pcl::PointCloud<PointT>());
+    pcl::fromROSMsg(patch_msg->points, *points);
+    points = crop_globalmap_patch(*points, region);
+
+    // only the new points are downsampled (the rest of the map has been downsampled on load)
+    double downsample_resolution = private_nh.param<double>("downsample_resolution", 0.1);
+    if (downsample_resolution > 0.0) {
+      pcl::VoxelGrid<PointT> voxelgrid;
+      voxelgrid.setLeafSize(downsample_resolution, downsample_resolution, downsample_resolution);
+      voxelgrid.setInputCloud(points);
+
+      pcl::PointCloud<PointT>::Ptr filtered(new pcl::PointCloud<PointT>());
+      voxelgrid.filter(*filtered);
+      points = filtered;
+    }
+
+    pcl::PointCloud<PointT>::Ptr patched = apply_globalmap_patch(*globalmap, region, *points);
+    const ros::Time stamp = patch_msg->header.stamp.isZero() ? ros::Time::now() : patch_msg->header.stamp;
+    patched->header.stamp = pcl_conversions::toPCL(stamp);
+    ROS_INFO_STREAM("Map patch applied (" << globalmap->size() << " -> " << patched->size() << " points)");
+
+    MapPatchPtr processed(new MapPatch());
+    processed->header.frame_id = globalmap->header.frame_id;
+    processed->header.stamp = stamp;
+    processed->min_pt = patch_msg->min_pt;
+    processed->max_pt = patch_msg->max_pt;
+    pcl::toROSMsg(*points, processed->points);
+    processed->points.header = processed->header;
+    processed->full_map_follows = publish_cloud && republish_patched_globalmap;
+
+    globalmap = patched;
+    globalmap_patch_pub.publish(processed);
+    if (processed->full_map_follows) {
+      globalmap_pub.publish(globalmap);
+    }
+
+    // the subscribers of the tiles apply the patch themselves. the tiles sent later are taken from the patched map
+    if (publish_tiles) {
+      tiles = tiles->patched(region, *points);
+    }
   }
 
 private:
@@ -104,9 +259,27 @@ private:
 
   ros::Publisher globalmap_pub;
   ros::Subscriber map_update_sub;
+  ros::Publisher globalmap_patch_pub;
+  ros::Subscriber map_patch_sub;
 
   ros::WallTimer globalmap_pub_timer;
   pcl::PointCloud<PointT>::Ptr globalmap;
+
+  // tiled publication
+  bool publish_cloud;
+  bool republish_patched_globalmap;
+  bool publish_tiles;
+  double tile_size;
+  double tile_resolution;
+  int tiles_per_tick;
+  ros::Publisher globalmap_tile_pub;
+  ros::Subscriber tile_request_sub;
+  ros::WallTimer tile_pub_timer;
+
+  GlobalmapTiles::ConstPtr tiles;
+  ros::Time map_version;                     // stamp of the tiles (changed when the whole map is reloaded)
+  std::deque<std::uint64_t> pending_tiles;   // tiles to be published
+  std::unordered_set<std::uint64_t> pending_tile_keys;
 };
 
 }
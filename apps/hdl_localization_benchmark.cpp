@@ -0,0 +1,342 @@
+#include <map>
+#include <deque>
+#include <limits>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+
+#include <ros/ros.h>
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <tf2/buffer_core.h>
+#include <tf2_eigen/tf2_eigen.h>
+#include <tf2_msgs/TFMessage.h>
+#include <sensor_msgs/Imu.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl/common/transforms.h>
+#include <pcl/filters/voxel_grid.h>
+
+#include <hdl_localization/pose_estimator.hpp>
+#include <hdl_localization/globalmap_io.hpp>
+#include <hdl_localization/stage_timer.hpp>
+#include <hdl_localization/registration_factory.hpp>
+#include <hdl_localization/fused_scan_preprocessor.hpp>
+
+using namespace hdl_localization;
+using PointT = pcl::PointXYZI;
+
+/**
+ * @brief offline benchmark which replays a rosbag through the preprocessing and PoseEstimator as fast as possible
+ * @note  the scans are processed in the order of the bag without waiting for the wall clock. a scan is processed once the bag
+ *        has been read 0.1 sec beyond its timestamp (the same tf waiting time as hdl_localization_nodelet).
+ */
+class LocalizationBenchmark {
+public:
+  LocalizationBenchmark(const std::map<std::string, std::string>& options) : options(options), stage_statistics(std::numeric_limits<size_t>::max()) {
+    odom_child_frame_id = option("odom_child_frame_id", "base_link");
+    use_imu = std::stoi(option("use_imu", "0")) != 0;
+    invert_acc = std::stoi(option("invert_acc", "0")) != 0;
+    invert_gyro = std::stoi(option("invert_gyro", "0")) != 0;
+    imu_preintegration = option("imu_prediction_mode", "PREINTEGRATION") != "PER_SAMPLE";
+    cool_time_duration = std::stod(option("cool_time_duration", "0.5"));
+    correction_chunk_iterations = std::stoi(option("correction_chunk_iterations", "0"));
+    correction_max_iterations = std::stoi(option("correction_max_iterations", "0"));
+    correction_max_time = std::stod(option("correction_max_time", "0.0"));
+    square_root_ukf = std::stoi(option("square_root_ukf", "0")) != 0;
+
+    std::stringstream sst(option("init_pose", "0,0,0,0,0,0,1"));
+    std::vector<double> values;
+    for (std::string value; std::getline(sst, value, ',');) {
+      values.push_back(std::stod(value));
+    }
+    values.resize(7, 0.0);
+    init_pos = Eigen::Vector3f(values[0], values[1], values[2]);
+    init_quat = Eigen::Quaternionf(values[6], values[3], values[4], values[5]).normalized();
+
+    double downsample_resolution = std::stod(option("downsample_resolution", "0.1"));
+    fused_preprocessor.reset(new FusedScanPreprocessor(downsample_resolution));
+    voxelgrid.setLeafSize(downsample_resolution, downsample_resolution, downsample_resolution);
+
+    RegistrationParams params;
+    params.reg_method = option("reg_method", params.reg_method);
+    params.ndt_neighbor_search_method = option("ndt_neighbor_search_method", params.ndt_neighbor_search_method);
+    params.ndt_neighbor_search_radius = std::stod(option("ndt_neighbor_search_radius", std::to_string(params.ndt_neighbor_search_radius)));
+    params.ndt_resolution = std::stod(option("ndt_resolution", std::to_string(params.ndt_resolution)));
+    std::stringstream pyramid_resolutions(option("ndt_pyramid_resolutions", ""));
+    for (std::string resolution; std::getline(pyramid_resolutions, resolution, ',');) {
+      params.ndt_pyramid_resolutions.push_back(std::stod(resolution));
+    }
+    registration = create_registration(params);
+
+    const std::string trajectory_path = option("trajectory", "");
+    if (!trajectory_path.empty()) {
+      trajectory_ofs.open(trajectory_path);
+    }
+  }
+
+  /**
+   * @brief load the globalmap and set it as the registration target
+   * @param globalmap_path  pcd file or globalmap cache
+   */
+  bool load_globalmap(const std::string& globalmap_path) {
+    pcl::PointCloud<PointT>::Ptr globalmap;
+    if (globalmap_path.size() > 4 && globalmap_path.substr(globalmap_path.size() - 4) == ".pcd") {
+      globalmap = load_globalmap_pcd(globalmap_path, std::stoi(option("convert_utm_to_local", "1")) != 0, std::stod(option("globalmap_downsample_resolution", "0.1")));
+    } else {
+      globalmap = load_globalmap_cache(globalmap_path, "", -1, -1.0);
+    }
+
+    if (!globalmap || !registration) {
+      return false;
+    }
+
+    auto t1 = std::chrono::steady_clock::now();
+    registration->setInputTarget(globalmap);
+    auto t2 = std::chrono::steady_clock::now();
+    std::cout << "globalmap: " << globalmap->size() << " points (target setup " << std::chrono::duration<double, std::milli>(t2 - t1).count() << " msec)" << std::endl;
+    return true;
+  }
+
+  /**
+   * @brief replay the bag
+   * @param bag_path  input bag
+   */
+  void run(const std::string& bag_path) {
+    const std::string points_topic = option("points_topic", "/velodyne_points");
+    const std::string imu_topic = option("imu_topic", "/gpsimu_driver/imu_data");
+    const ros::Duration tf_wait(0.1);
+
+    rosbag::Bag bag(bag_path, rosbag::bagmode::Read);
+    rosbag::View view(bag, rosbag::TopicQuery(std::vector<std::string>{points_topic, imu_topic, "/tf", "/tf_static"}));
+
+    const auto start_time = std::chrono::steady_clock::now();
+    for (const rosbag::MessageInstance& m : view) {
+      if (m.getTopic() == "/tf" || m.getTopic() == "/tf_static") {
+        tf2_msgs::TFMessage::ConstPtr tf_msg = m.instantiate<tf2_msgs::TFMessage>();
+        for (const auto& transform : tf_msg->transforms) {
+          tf_buffer.setTransform(transform, "bag", m.getTopic() == "/tf_static");
+        }
+      } else if (m.getTopic() == imu_topic) {
+        sensor_msgs::Imu::ConstPtr imu_msg = m.instantiate<sensor_msgs::Imu>();
+        if (use_imu && imu_msg) {
+          const auto& acc = imu_msg->linear_acceleration;
+          const auto& gyro = imu_msg->angular_velocity;
+          ImuSample sample;
+          sample.stamp = imu_msg->header.stamp;
+          sample.acc = (invert_acc ? -1.0f : 1.0f) * Eigen::Vector3f(acc.x, acc.y, acc.z);
+          sample.gyro = (invert_gyro ? -1.0f : 1.0f) * Eigen::Vector3f(gyro.x, gyro.y, gyro.z);
+          imu_queue.push_back(sample);
+        }
+      } else if (m.getTopic() == points_topic) {
+        sensor_msgs::PointCloud2::ConstPtr points_msg = m.instantiate<sensor_msgs::PointCloud2>();
+        if (points_msg) {
+          pending_scans.push_back(points_msg);
+        }
+      }
+
+      while (!pending_scans.empty() && pending_scans.front()->header.stamp + tf_wait <= m.getTime()) {
+        process_scan(pending_scans.front());
+        pending_scans.pop_front();
+      }
+    }
+
+    while (!pending_scans.empty()) {
+      process_scan(pending_scans.front());
+      pending_scans.pop_front();
+    }
+    const auto end_time = std::chrono::steady_clock::now();
+
+    report(std::chrono::duration<double>(end_time - start_time).count());
+  }
+
+private:
+  std::string option(const std::string& key, const std::string& default_value) const {
+    auto found = options.find(key);
+    return found == options.end() ? default_value : found->second;
+  }
+
+  void process_scan(const sensor_msgs::PointCloud2::ConstPtr& points_msg) {
+    const ros::Time& stamp = points_msg->header.stamp;
+    StageStopwatch stopwatch;
+
+    // preprocessing
+    if (!tf_buffer.canTransform(odom_child_frame_id, points_msg->header.frame_id, stamp)) {
+      num_skipped_scans++;
+      return;
+    }
+    Eigen::Matrix4f transform = tf2::transformToEigen(tf_buffer.lookupTransform(odom_child_frame_id, points_msg->header.frame_id, stamp)).cast<float>().matrix();
+    stopwatch.lap("tf_lookup");
+
+    pcl::PointCloud<PointT>::Ptr filtered = fused_preprocessor ? fused_preprocessor->process(*points_msg, transform) : nullptr;
+    if (!filtered) {
+      // unsupported point layout for the fused preprocessing
+      fused_preprocessor.reset();
+
+      pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+      pcl::fromROSMsg(*points_msg, *cloud);
+      pcl::transformPointCloud(*cloud, *cloud, transform);
+
+      filtered.reset(new pcl::PointCloud<PointT>());
+      voxelgrid.setInputCloud(cloud);
+      voxelgrid.filter(*filtered);
+    }
+    stopwatch.lap("preprocess");
+
+    if (filtered->empty()) {
+      num_skipped_scans++;
+      return;
+    }
+
+    if (!pose_estimator) {
+      pose_estimator.reset(new PoseEstimator(registration, init_pos, init_quat, cool_time_duration));
+      pose_estimator->set_correction_budget(correction_chunk_iterations, correction_max_iterations, correction_max_time, 0.005, 0.001);
+      pose_estimator->set_square_root_filter(square_root_ukf);
+    }
+
+    // prediction
+    imu_samples.clear();
+    while (!imu_queue.empty() && imu_queue.front().stamp <= stamp) {
+      imu_samples.push_back(imu_queue.front());
+      imu_queue.pop_front();
+    }
+
+    if (!use_imu) {
+      pose_estimator->predict(stamp);
+    } else if (imu_preintegration) {
+      if (!imu_samples.empty()) {
+        pose_estimator->predict(imu_samples);
+      }
+    } else {
+      for (const auto& sample : imu_samples) {
+        pose_estimator->predict(sample.stamp, sample.acc, sample.gyro);
+      }
+    }
+    stopwatch.lap("prediction");
+
+    // correction
+    pose_estimator->correct(stamp, filtered);
+    stopwatch.lap("align");
+
+    stage_statistics.add(stopwatch);
+    stage_statistics.add("total", stopwatch.elapsed_msec());
+    total_msec += stopwatch.elapsed_msec();
+    num_points += filtered->size();
+    num_iterations += pose_estimator->last_correction_iterations();
+    num_truncated_scans += pose_estimator->last_correction_truncated();
+    num_scans++;
+
+    if (trajectory_ofs.is_open()) {
+      const Eigen::Vector3f pos = pose_estimator->pos();
+      const Eigen::Quaternionf quat = pose_estimator->quat();
+      trajectory_ofs << std::fixed << std::setprecision(9) << stamp.toSec() << " " << std::setprecision(6) << pos.x() << " " << pos.y() << " " << pos.z() << " " << quat.x() << " " << quat.y() << " "
+                     << quat.z() << " " << quat.w() << std::endl;
+    }
+  }
+
+  void report(double elapsed_sec) const {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    std::cout << "--- benchmark ---" << std::endl;
+    std::cout << "reg_method                : " << option("reg_method", "NDT_OMP") << " / " << option("ndt_neighbor_search_method", "DIRECT7") << " / resolution=" << option("ndt_resolution", "1.0");
+    const std::string pyramid_resolutions = option("ndt_pyramid_resolutions", "");
+    std::cout << (pyramid_resolutions.empty() ? "" : " (pyramid " + pyramid_resolutions + ")") << std::endl;
+    std::cout << "processed scans           : " << num_scans << " (skipped " << num_skipped_scans << ")" << std::endl;
+    std::cout << "mean points per scan      : " << (num_scans ? num_points / num_scans : 0) << std::endl;
+    std::cout << "mean iterations per scan  : " << (num_scans ? static_cast<double>(num_iterations) / num_scans : 0.0) << " (" << num_truncated_scans << " scans stopped by the budget)" << std::endl;
+    std::cout << "achieved rate             : " << (total_msec > 0.0 ? num_scans / (total_msec / 1000.0) : 0.0) << " Hz (" << num_scans / std::max(elapsed_sec, 1e-9) << " Hz including bag reading)" << std::endl;
+    std::cout << "peak memory               : " << usage.ru_maxrss / 1024.0 << " MB" << std::endl;
+
+    std::cout << "latency [msec]            :        p50        p90        p99        max" << std::endl;
+    for (size_t i = 0; i < stage_statistics.size(); i++) {
+      std::cout << "  " << std::left << std::setw(24) << stage_statistics.label(i) << std::right << ":";
+      for (double p : {0.5, 0.9, 0.99, 1.0}) {
+        std::cout << std::fixed << std::setprecision(3) << std::setw(11) << stage_statistics.percentile(i, p);
+      }
+      std::cout << std::endl;
+    }
+  }
+
+private:
+  const std::map<std::string, std::string> options;
+
+  std::string odom_child_frame_id;
+  bool use_imu;
+  bool invert_acc;
+  bool invert_gyro;
+  bool imu_preintegration;
+  double cool_time_duration;
+  int correction_chunk_iterations;
+  int correction_max_iterations;
+  double correction_max_time;
+  bool square_root_ukf;
+  Eigen::Vector3f init_pos;
+  Eigen::Quaternionf init_quat;
+
+  tf2::BufferCore tf_buffer;
+  std::deque<ImuSample> imu_queue;
+  std::vector<ImuSample> imu_samples;
+  std::deque<sensor_msgs::PointCloud2::ConstPtr> pending_scans;
+
+  std::unique_ptr<FusedScanPreprocessor> fused_preprocessor;
+  pcl::VoxelGrid<PointT> voxelgrid;
+  pcl::Registration<PointT, PointT>::Ptr registration;
+  std::unique_ptr<PoseEstimator> pose_estimator;
+
+  StageStatistics stage_statistics;
+  double total_msec = 0.0;
+  size_t num_points = 0;
+  size_t num_iterations = 0;
+  size_t num_truncated_scans = 0;
+  size_t num_scans = 0;
+  size_t num_skipped_scans = 0;
+
+  std::ofstream trajectory_ofs;
+
+public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+};
+
+/**
+ * @brief replay a rosbag through the localization pipeline and report its throughput and latency
+ * @note  usage: hdl_localization_benchmark input.bag map.(pcd|cache) [--key value ...]
+ *        options (defaults): --points_topic (/velodyne_points) --imu_topic (/gpsimu_driver/imu_data) --odom_child_frame_id (base_link)
+ *                            --reg_method (NDT_OMP) --ndt_neighbor_search_method (DIRECT7) --ndt_neighbor_search_radius (2.0) --ndt_resolution (1.0)
+ *                            --ndt_pyramid_resolutions (coarse levels, e.g., 4.0,2.0)
+ *                            --downsample_resolution (0.1) --globalmap_downsample_resolution (0.1) --convert_utm_to_local (1)
+ *                            --use_imu (0) --invert_acc (0) --invert_gyro (0) --imu_prediction_mode (PREINTEGRATION) --cool_time_duration (0.5)
+ *                            --correction_chunk_iterations (0) --correction_max_iterations (0) --correction_max_time (0.0) --square_root_ukf (0)
+ *                            --init_pose (x,y,z,qx,qy,qz,qw = 0,0,0,0,0,0,1) --trajectory (output file in the TUM format)
+ */
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    std::cout << "usage: " << argv[0] << " input.bag map.(pcd|cache) [--key value ...]" << std::endl;
+    return 1;
+  }
+
+  std::map<std::string, std::string> options;
+  for (int i = 3; i + 1 < argc; i += 2) {
+    std::string key = argv[i];
+    if (key.size() < 3 || key.substr(0, 2) != "--") {
+      std::cerr << "invalid option: " << key << std::endl;
+      return 1;
+    }
+    options[key.substr(2)] = argv[i + 1];
+  }
+
+  ros::Time::init();
+
+  std::unique_ptr<LocalizationBenchmark> benchmark(new LocalizationBenchmark(options));
+  if (!benchmark->load_globalmap(argv[2])) {
+    std::cerr << "failed to set up the globalmap and the registration" << std::endl;
+    return 1;
+  }
+
+  benchmark->run(argv[1]);
+  return 0;
+}
@@ -0,0 +1,445 @@
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <iostream>
+
+#include <benchmark/benchmark.h>
+
+#include <ros/ros.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <pcl_conversions/pcl_conversions.h>
+#include <pcl/common/transforms.h>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/search/kdtree.h>
+
+#include <kkl/alg/unscented_kalman_filter.hpp>
+#include <hdl_localization/pose_system.hpp>
+#include <hdl_localization/odom_system.hpp>
+#include <hdl_localization/pose_estimator.hpp>
+#include <hdl_localization/globalmap_io.hpp>
+#include <hdl_localization/ndt_voxel_map.hpp>
+#include <hdl_localization/alignment_score.hpp>
+#include <hdl_localization/delta_estimater.hpp>
+#include <hdl_localization/registration_factory.hpp>
+#include <hdl_localization/fused_scan_preprocessor.hpp>
+
+using namespace hdl_localization;
+using PointT = pcl::PointXYZI;
+
+namespace {
+
+/**
+ * @brief fixed inputs of the benchmarks: the map, and a scan cut out of it around a sensor pose
+ * @note  the scan is the map points within 40m of a map point, expressed in a sensor frame displaced from the true pose, so that the
+ *        registration starts from the same small error in every run
+ */
+struct Fixture {
+  pcl::PointCloud<PointT>::Ptr map;
+  pcl::PointCloud<PointT>::Ptr scan;     // in the sensor frame
+  pcl::PointCloud<PointT>::Ptr aligned;  // in the map frame
+  sensor_msgs::PointCloud2 scan_msg;
+  Eigen::Isometry3f sensor_pose;         // true pose
+  Eigen::Isometry3f init_pose;           // initial guess of the registration
+};
+
+std::map<std::string, std::string> options;
+std::unique_ptr<Fixture> fixture;
+
+std::string option(const std::string& key, const std::string& default_value) {
+  auto found = options.find(key);
+  return found == options.end() ? default_value : found->second;
+}
+
+std::vector<std::string> split(const std::string& str) {
+  std::vector<std::string> tokens;
+  std::stringstream sst(str);
+  for (std::string token; std::getline(sst, token, ',');) {
+    tokens.push_back(token);
+  }
+  return tokens;
+}
+
+bool load_fixture(const std::string& map_path) {
+  fixture.reset(new Fixture());
+  if (map_path.size() > 4 && map_path.substr(map_path.size() - 4) == ".pcd") {
+    fixture->map = load_globalmap_pcd(map_path, std::stoi(option("convert_utm_to_local", "1")) != 0, std::stod(option("globalmap_downsample_resolution", "0.1")));
+  } else {
+    fixture->map = load_globalmap_cache(map_path, "", -1, -1.0);
+  }
+  if (!fixture->map || fixture->map->empty()) {
+    return false;
+  }
+
+  fixture->sensor_pose.setIdentity();
+  fixture->sensor_pose.translation() = fixture->map->at(fixture->map->size() / 2).getVector3fMap();
+
+  fixture->init_pose = fixture->sensor_pose;
+  fixture->init_pose.translation() += Eigen::Vector3f(0.3f, -0.2f, 0.05f);
+  fixture->init_pose.linear() = Eigen::AngleAxisf(0.03f, Eigen::Vector3f::UnitZ()).toRotationMatrix();
+
+  fixture->aligned.reset(new pcl::PointCloud<PointT>());
+  for (const auto& pt : fixture->map->points) {
+    if ((pt.getVector3fMap() - fixture->sensor_pose.translation()).squaredNorm() < 40.0f * 40.0f) {
+      fixture->aligned->push_back(pt);
+    }
+  }
+
+  fixture->scan.reset(new pcl::PointCloud<PointT>());
+  pcl::transformPointCloud(*fixture->aligned, *fixture->scan, fixture->sensor_pose.inverse().matrix());
+  pcl::toROSMsg(*fixture->scan, fixture->scan_msg);
+  fixture->scan_msg.header.stamp = ros::Time(1.0);
+  return true;
+}
+
+pcl::PointCloud<PointT>::Ptr downsampled_scan(double resolution) {
+  pcl::PointCloud<PointT>::Ptr filtered(new pcl::PointCloud<PointT>());
+  pcl::VoxelGrid<PointT> voxelgrid;
+  voxelgrid.setLeafSize(resolution, resolution, resolution);
+  voxelgrid.setInputCloud(fixture->scan);
+  voxelgrid.filter(*filtered);
+  return filtered;
+}
+
+RegistrationParams registration_params(const std::string& reg_method, const std::string& search_method, double resolution) {
+  RegistrationParams params;
+  params.reg_method = reg_method;
+  params.ndt_neighbor_search_method = search_method;
+  params.ndt_neighbor_search_radius = std::stod(option("ndt_neighbor_search_radius", std::to_string(params.ndt_neighbor_search_radius)));
+  params.ndt_resolution = resolution;
+  return params;
+}
+
+/* filters */
+template<typename Filter, typename System, int N, int M, int K>
+std::unique_ptr<Filter> create_fixed_filter(bool square_root) {
+  Eigen::Matrix<float, N, 1> mean = Eigen::Matrix<float, N, 1>::Zero();
+  mean[N == 16 ? 6 : 3] = 1.0f;  // identity quaternion
+  std::unique_ptr<Filter> filter(new Filter(System(), Eigen::Matrix<float, N, N>::Identity() * 0.01f, Eigen::Matrix<float, K, K>::Identity() * 0.01f, mean, Eigen::Matrix<float, N, N>::Identity() * 0.01f));
+  filter->setSquareRoot(square_root);
+  return filter;
+}
+
+template<typename System>
+std::unique_ptr<kkl::alg::UnscentedKalmanFilterX<float, System>> create_dynamic_filter(int n, int m, int k) {
+  Eigen::VectorXf mean = Eigen::VectorXf::Zero(n);
+  mean[n == 16 ? 6 : 3] = 1.0f;  // identity quaternion
+  return std::unique_ptr<kkl::alg::UnscentedKalmanFilterX<float, System>>(new kkl::alg::UnscentedKalmanFilterX<float, System>(
+    System(), n, m, k, Eigen::MatrixXf::Identity(n, n) * 0.01f, Eigen::MatrixXf::Identity(k, k) * 0.01f, mean, Eigen::MatrixXf::Identity(n, n) * 0.01f));
+}
+
+Eigen::VectorXf pose_control() {
+  Eigen::VectorXf control(6);
+  control << 0.1f, 0.0f, 9.80665f, 0.0f, 0.0f, 0.2f;
+  return control;
+}
+
+Eigen::VectorXf pose_measurement() {
+  Eigen::VectorXf measurement(7);
+  measurement << 0.01f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f;
+  return measurement;
+}
+
+Eigen::VectorXf odom_control() {
+  Eigen::VectorXf control(7);
+  control << 0.05f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.01f;
+  return control;
+}
+
+Eigen::VectorXf odom_measurement() {
+  Eigen::VectorXf measurement(7);
+  measurement << 0.05f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.01f;
+  return measurement;
+}
+
+}  // namespace
+
+/**
+ * @brief UKF of the pose estimator (fixed-size, arg: square-root form)
+ */
+using PoseUkf = kkl::alg::UnscentedKalmanFilter<float, PoseSystem, 16, 6, 7>;
+using OdomUkf = kkl::alg::UnscentedKalmanFilter<float, OdomSystem, 7, 7, 7>;
+
+static void BM_PoseUkfPredict(benchmark::State& state) {
+  auto ukf = create_fixed_filter<PoseUkf, PoseSystem, 16, 6, 7>(state.range(0));
+  const PoseSystem::VectorMt control = pose_control();
+  ukf->setProcessNoiseCov(Eigen::Matrix<float, 16, 16>::Identity() * 1e-3f);
+  for (auto _ : state) {
+    ukf->predict(control);
+    benchmark::DoNotOptimize(ukf->mean);
+  }
+}
+BENCHMARK(BM_PoseUkfPredict)->ArgName("square_root")->Arg(0)->Arg(1);
+
+static void BM_PoseUkfCorrect(benchmark::State& state) {
+  auto ukf = create_fixed_filter<PoseUkf, PoseSystem, 16, 6, 7>(state.range(0));
+  const PoseSystem::VectorMt control = pose_control();
+  const PoseSystem::VectorKt measurement = pose_measurement();
+  for (auto _ : state) {
+    // the prediction keeps the covariance from collapsing over the iterations
+    state.PauseTiming();
+    ukf->predict(control);
+    state.ResumeTiming();
+    ukf->correct(measurement);
+    benchmark::DoNotOptimize(ukf->mean);
+  }
+}
+BENCHMARK(BM_PoseUkfCorrect)->ArgName("square_root")->Arg(0)->Arg(1);
+
+static void BM_OdomUkfPredict(benchmark::State& state) {
+  auto ukf = create_fixed_filter<OdomUkf, OdomSystem, 7, 7, 7>(state.range(0));
+  const OdomSystem::VectorMt control = odom_control();
+  ukf->setProcessNoiseCov(Eigen::Matrix<float, 7, 7>::Identity() * 1e-3f);
+  for (auto _ : state) {
+    ukf->predict(control);
+    benchmark::DoNotOptimize(ukf->mean);
+  }
+}
+BENCHMARK(BM_OdomUkfPredict)->ArgName("square_root")->Arg(0)->Arg(1);
+
+static void BM_OdomUkfCorrect(benchmark::State& state) {
+  auto ukf = create_fixed_filter<OdomUkf, OdomSystem, 7, 7, 7>(state.range(0));
+  const OdomSystem::VectorMt control = odom_control();
+  const OdomSystem::VectorKt measurement = odom_measurement();
+  for (auto _ : state) {
+    state.PauseTiming();
+    ukf->predict(control);
+    state.ResumeTiming();
+    ukf->correct(measurement);
+    benchmark::DoNotOptimize(ukf->mean);
+  }
+}
+BENCHMARK(BM_OdomUkfCorrect)->ArgName("square_root")->Arg(0)->Arg(1);
+
+/**
+ * @brief dynamic-size UKF (UnscentedKalmanFilterX) as the reference for the fixed-size one
+ */
+static void BM_PoseUkfXPredict(benchmark::State& state) {
+  auto ukf = create_dynamic_filter<PoseSystem>(16, 6, 7);
+  const Eigen::VectorXf control = pose_control();
+  for (auto _ : state) {
+    ukf->predict(control);
+    benchmark::DoNotOptimize(ukf->mean);
+  }
+}
+BENCHMARK(BM_PoseUkfXPredict);
+
+static void BM_PoseUkfXCorrect(benchmark::State& state) {
+  auto ukf = create_dynamic_filter<PoseSystem>(16, 6, 7);
+  const Eigen::VectorXf control = pose_control();
+  const Eigen::VectorXf measurement = pose_measurement();
+  for (auto _ : state) {
+    state.PauseTiming();
+    ukf->predict(control);
+    state.ResumeTiming();
+    ukf->correct(measurement);
+    benchmark::DoNotOptimize(ukf->mean);
+  }
+}
+BENCHMARK(BM_PoseUkfXCorrect);
+
+static void BM_OdomUkfXPredict(benchmark::State& state) {
+  auto ukf = create_dynamic_filter<OdomSystem>(7, 7, 7);
+  const Eigen::VectorXf control = odom_control();
+  for (auto _ : state) {
+    ukf->predict(control);
+    benchmark::DoNotOptimize(ukf->mean);
+  }
+}
+BENCHMARK(BM_OdomUkfXPredict);
+
+static void BM_OdomUkfXCorrect(benchmark::State& state) {
+  auto ukf = create_dynamic_filter<OdomSystem>(7, 7, 7);
+  const Eigen::VectorXf control = odom_control();
+  const Eigen::VectorXf measurement = odom_measurement();
+  for (auto _ : state) {
+    state.PauseTiming();
+    ukf->predict(control);
+    state.ResumeTiming();
+    ukf->correct(measurement);
+    benchmark::DoNotOptimize(ukf->mean);
+  }
+}
+BENCHMARK(BM_OdomUkfXCorrect);
+
+/**
+ * @brief downsampling of the scan (VOXELGRID: pcl::VoxelGrid on a decoded cloud, FUSED: decode + transform + downsample from the message)
+ */
+static void BM_DownsampleVoxelGrid(benchmark::State& state, double resolution) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(downsampled_scan(resolution));
+  }
+  state.SetItemsProcessed(state.iterations() * fixture->scan->size());
+}
+
+static void BM_DownsampleFused(benchmark::State& state, double resolution) {
+  FusedScanPreprocessor preprocessor(resolution);
+  const Eigen::Matrix4f transform = Eigen::Matrix4f::Identity();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(preprocessor.process(fixture->scan_msg, transform));
+  }
+  state.SetItemsProcessed(state.iterations() * fixture->scan->size());
+}
+
+/**
+ * @brief PoseEstimator::correct with a downsampled scan (a new estimator at the initial guess for each iteration)
+ */
+static void BM_PoseEstimatorCorrect(benchmark::State& state, RegistrationParams params, double downsample_resolution) {
+  auto registration = create_registration(params);
+  if (!registration) {
+    state.SkipWithError("failed to create the registration");
+    return;
+  }
+  registration->setInputTarget(fixture->map);
+  const auto scan = downsampled_scan(downsample_resolution);
+
+  size_t iterations = 0;
+  const Eigen::Quaternionf init_quat(fixture->init_pose.linear());
+  for (auto _ : state) {
+    state.PauseTiming();
+    PoseEstimator estimator(registration, fixture->init_pose.translation(), init_quat, 0.0);
+    state.ResumeTiming();
+
+    estimator.correct(ros::Time(1.0), scan);
+    iterations += estimator.last_correction_iterations();
+  }
+
+  state.SetItemsProcessed(state.iterations() * scan->size());
+  state.counters["points"] = scan->size();
+  state.counters["registration_iterations"] = benchmark::Counter(iterations, benchmark::Counter::kAvgIterations);
+}
+
+/**
+ * @brief the evaluation of publish_scan_matching_status (NDT: status voxel map, KDTREE: nearest neighbor in the target)
+ * @note  the same functions as the nodelet are timed (see alignment_score.hpp)
+ */
+static void BM_ScanMatchingStatusNdt(benchmark::State& state, double resolution, double max_valid_point_dist) {
+  NdtVoxelMap voxel_map(resolution);
+  voxel_map.build(*fixture->map);
+
+  const auto& aligned = *fixture->aligned;
+  const Eigen::Vector3f sensor_pos = fixture->sensor_pose.translation();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(evaluate_alignment_ndt(aligned, sensor_pos, max_valid_point_dist, voxel_map));
+  }
+  state.SetItemsProcessed(state.iterations() * aligned.size());
+}
+
+static void BM_ScanMatchingStatusKdtree(benchmark::State& state, double max_correspondence_dist, double max_valid_point_dist) {
+  pcl::search::KdTree<PointT> search;
+  search.setInputCloud(fixture->map);
+
+  const auto& aligned = *fixture->aligned;
+  const Eigen::Vector3f sensor_pos = fixture->sensor_pose.translation();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(evaluate_alignment_kdtree(aligned, sensor_pos, max_valid_point_dist, search, max_correspondence_dist));
+  }
+  state.SetItemsProcessed(state.iterations() * aligned.size());
+}
+
+/**
+ * @brief DeltaEstimater: add_frame (on the scan thread) and update (on the relocalization thread)
+ */
+static void BM_DeltaEstimaterAddFrame(benchmark::State& state, RegistrationParams params) {
+  auto registration = create_registration(params);
+  if (!registration) {
+    state.SkipWithError("failed to create the registration");
+    return;
+  }
+  DeltaEstimater delta_estimater(registration, 0.5);
+  for (auto _ : state) {
+    delta_estimater.add_frame(fixture->scan);
+  }
+}
+
+static void BM_DeltaEstimaterUpdate(benchmark::State& state, RegistrationParams params) {
+  auto registration = create_registration(params);
+  if (!registration) {
+    state.SkipWithError("failed to create the registration");
+    return;
+  }
+  DeltaEstimater delta_estimater(registration, 0.5);
+  delta_estimater.add_frame(fixture->scan);
+  delta_estimater.update();
+  for (auto _ : state) {
+    delta_estimater.add_frame(fixture->scan);
+    delta_estimater.update();
+  }
+  state.SetItemsProcessed(state.iterations() * fixture->scan->size());
+}
+
+/**
+ * @brief micro-benchmarks of the filter, preprocessing, registration, and status kernels
+ * @note  usage: hdl_localization_microbenchmark map.(pcd|cache) [google benchmark flags] [--key value ...]
+ *        options (defaults): --convert_utm_to_local (1) --globalmap_downsample_resolution (0.1) --downsample_resolution (0.1)
+ *                            --reg_methods (NDT_OMP) --search_methods (DIRECT1,DIRECT7,KDTREE) --ndt_neighbor_search_radius (2.0)
+ *                            --ndt_resolution (1.0) --status_ndt_resolution (1.0) --status_max_correspondence_dist (0.5)
+ *                            --status_max_valid_point_dist (25.0)
+ *        the results can be written as json with --benchmark_out=results.json --benchmark_out_format=json. the settings and the map
+ *        are recorded in the context of the output, so that the results of different releases, machines, and settings can be compared.
+ *        search methods not supported by a registration method (e.g., KDTREE for NDT_CUDA) fall back to its default one.
+ */
+int main(int argc, char** argv) {
+  benchmark::Initialize(&argc, argv);
+  if (argc < 2) {
+    std::cout << "usage: " << argv[0] << " map.(pcd|cache) [google benchmark flags] [--key value ...]" << std::endl;
+    return 0;
+  }
+
+  for (int i = 2; i + 1 < argc; i += 2) {
+    std::string key = argv[i];
+    if (key.size() < 3 || key.substr(0, 2) != "--") {
+      std::cerr << "invalid option: " << key << std::endl;
+      return 1;
+    }
+    options[key.substr(2)] = argv[i + 1];
+  }
+
+  ros::Time::init();
+
+  const std::string map_path = argv[1];
+  if (!load_fixture(map_path)) {
+    std::cerr << "failed to load the map: " << map_path << std::endl;
+    return 1;
+  }
+
+  const double downsample_resolution = std::stod(option("downsample_resolution", "0.1"));
+  const double ndt_resolution = std::stod(option("ndt_resolution", "1.0"));
+
+  benchmark::AddCustomContext("map", map_path);
+  benchmark::AddCustomContext("map_points", std::to_string(fixture->map->size()));
+  benchmark::AddCustomContext("scan_points", std::to_string(fixture->scan->size()));
+  for (const auto& opt : options) {
+    benchmark::AddCustomContext(opt.first, opt.second);
+  }
+
+  benchmark::RegisterBenchmark("BM_DownsampleVoxelGrid", BM_DownsampleVoxelGrid, downsample_resolution)->Unit(benchmark::kMicrosecond);
+  benchmark::RegisterBenchmark("BM_DownsampleFused", BM_DownsampleFused, downsample_resolution)->Unit(benchmark::kMicrosecond);
+
+  for (const auto& reg_method : split(option("reg_methods", "NDT_OMP"))) {
+    for (const auto& search_method : split(option("search_methods", "DIRECT1,DIRECT7,KDTREE"))) {
+      const std::string name = "BM_PoseEstimatorCorrect/" + reg_method + "/" + search_method;
+      benchmark::RegisterBenchmark(name.c_str(), BM_PoseEstimatorCorrect, registration_params(reg_method, search_method, ndt_resolution), downsample_resolution)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+    }
+
+    // the relocalization fallback uses a coarse registration without the pyramid (see relocalization_delta_ndt_resolution)
+    const RegistrationParams delta_params = registration_params(reg_method, "DIRECT7", 2.0);
+    benchmark::RegisterBenchmark(("BM_DeltaEstimaterAddFrame/" + reg_method).c_str(), BM_DeltaEstimaterAddFrame, delta_params);
+    benchmark::RegisterBenchmark(("BM_DeltaEstimaterUpdate/" + reg_method).c_str(), BM_DeltaEstimaterUpdate, delta_params)->Unit(benchmark::kMillisecond)->UseRealTime();
+  }
+
+  const double status_max_valid_point_dist = std::stod(option("status_max_valid_point_dist", "25.0"));
+  benchmark::RegisterBenchmark("BM_ScanMatchingStatusNdt", BM_ScanMatchingStatusNdt, std::stod(option("status_ndt_resolution", "1.0")), status_max_valid_point_dist)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+  benchmark::RegisterBenchmark("BM_ScanMatchingStatusKdtree", BM_ScanMatchingStatusKdtree, std::stod(option("status_max_correspondence_dist", "0.5")), status_max_valid_point_dist)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -1,10 +1,17 @@
 #include <mutex>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <future>
+#include <condition_variable>
 #include <memory>
+#include <algorithm>
+#include <sstream>
 #include <iostream>
 
 #include <ros/ros.h>
 #include <pcl_ros/point_cloud.h>
-#include <pcl_ros/transforms.h>
 #include <nodelet/nodelet.h>
 #include <pluginlib/class_list_macros.h>
 
@@ -21,13 +28,32 @@
 #include <geometry_msgs/PoseWithCovarianceStamped.h>
 
 #include <pcl/filters/voxel_grid.h>
-
-#include <pclomp/ndt_omp.h>
-#include <fast_gicp/ndt/ndt_cuda.hpp>
+#include <pcl/common/transforms.h>
 
 #include <hdl_localization/pose_estimator.hpp>
+#include <hdl_localization/pose_propagator.hpp>
+#include <hdl_localization/bounded_queue.hpp>
+#include <hdl_localization/spsc_ring_buffer.hpp>
+#include <hdl_localization/adaptive_downsampling.hpp>
+#include <hdl_localization/stage_timer.hpp>
 #include <hdl_localization/delta_estimater.hpp>
-
+#include <hdl_localization/globalmap_io.hpp>
+#include <hdl_localization/globalmap_tiles.hpp>
+#include <hdl_localization/globalmap_patch.hpp>
+#include <hdl_localization/globalmap_tile_codec.hpp>
+#include <hdl_localization/ndt_voxel_map.hpp>
+#include <hdl_localization/alignment_score.hpp>
+#include <hdl_localization/registration_factory.hpp>
+#include <hdl_localization/registration_pyramid.hpp>
+#include <hdl_localization/fused_scan_preprocessor.hpp>
+#include <hdl_localization/scan_deskewer.hpp>
+#include <hdl_localization/background_target_builder.hpp>
+#include <hdl_localization/transform_cache.hpp>
+#include <hdl_localization/odom_buffer.hpp>
+
+#include <hdl_localization/MapPatch.h>
+#include <hdl_localization/GlobalmapTile.h>
+#include <hdl_localization/GlobalmapTileRequest.h>
 #include <hdl_localization/ScanMatchingStatus.h>
 #include <hdl_global_localization/SetGlobalMap.h>
 #include <hdl_global_localization/QueryGlobalLocalization.h>
@@ -38,9 +64,72 @@ class HdlLocalizationNodelet : public nodelet::Nodelet {
 public:
   using PointT = pcl::PointXYZI;
 
+  /**
+   * @brief input scan transformed into odom_child_frame_id and downsampled
+   */
+  struct PreprocessedScan {
+    using Ptr = std::shared_ptr<PreprocessedScan>;
+
+    std_msgs::Header header;  // header of the input message (stamp with the full precision)
+    pcl::PointCloud<PointT>::ConstPtr cloud;
+    StageStopwatch stopwatch;  // processing time of each stage since the start of preprocessing
+  };
+
+  /**
+   * @brief candidate pose of a relocalization tracked alongside the pose estimator
+   */
+  struct PoseHypothesis {
+    std::unique_ptr<hdl_localization::PoseEstimator> estimator;
+    pcl::Registration<PointT, PointT>::Ptr registration;  // own registration on the map around the candidate
+    pcl::PointCloud<PointT>::ConstPtr target;
+    NdtVoxelMap::ConstPtr voxel_map;                      // status voxel map of the target (status_method NDT)
+    double inlier_fraction_sum;                           // over the scans tracked so far
+  };
+
+  /**
+   * @brief corrected state passed to the high-rate pose output thread
+   */
+  struct CorrectedState {
+    ros::Time stamp;
+    Eigen::Vector3f pos;
+    Eigen::Vector3f vel;
+    Eigen::Quaternionf quat;
+    Eigen::Vector3f acc_bias;
+    Eigen::Vector3f gyro_bias;
+
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
   HdlLocalizationNodelet() : tf_buffer(), tf_listener(tf_buffer) {
   }
   virtual ~HdlLocalizationNodelet() {
+    if(highrate_thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(highrate_mutex);
+        highrate_stop = true;
+      }
+      highrate_cv.notify_all();
+      highrate_thread.join();
+    }
+
+    if(relocalization_thread.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(relocalization_mutex);
+        relocalization_stop = true;
+      }
+      relocalization_cv.notify_all();
+      relocalization_thread.join();
+    }
+
+    if(raw_scan_queue) {
+      raw_scan_queue->close();
+      preprocessed_scan_queue->close();
+      preprocessing_thread.join();
+      estimation_thread.join();
+    }
+
+    // stop the worker before the members its commit callbacks refer to are destroyed
+    target_builder.reset();
   }
 
   void onInit() override {
@@ -53,15 +142,125 @@ public:
     robot_odom_frame_id = private_nh.param<std::string>("robot_odom_frame_id", "robot_odom");
     odom_child_frame_id = private_nh.param<std::string>("odom_child_frame_id", "base_link");
 
+    // tf lookups: the sensor extrinsics can be resolved once (static_extrinsics), and no lookup waits longer than tf_wait_timeout.
+    // the odom frame is looked up without waiting, and odom_tf_fallback decides the map->odom tf when it is missing at the scan time:
+    // LATEST: use the latest odom->base_link, HOLD: republish the last map->odom, SKIP: do not broadcast
+    tf_wait_timeout = private_nh.param<double>("tf_wait_timeout", 0.1);
+    extrinsics_cache.reset(new TransformCache(tf_buffer, private_nh.param<bool>("static_extrinsics", false), tf_wait_timeout));
+    odom_tf_cache.reset(new TransformCache(tf_buffer, false, 0.0));
+    odom_tf_fallback = private_nh.param<std::string>("odom_tf_fallback", "LATEST");
+    if(odom_tf_fallback != "LATEST" && odom_tf_fallback != "HOLD" && odom_tf_fallback != "SKIP") {
+      NODELET_WARN_STREAM("unknown odom tf fallback:" << odom_tf_fallback << " (LATEST is used)");
+      odom_tf_fallback = "LATEST";
+    }
+    odom_tf_received = false;
+    last_odom_trans = geometry_msgs::TransformStamped();
+
     use_imu = private_nh.param<bool>("use_imu", true);
     invert_acc = private_nh.param<bool>("invert_acc", false);
     invert_gyro = private_nh.param<bool>("invert_gyro", false);
+    // PREINTEGRATION: the IMU samples between scans are integrated into a single UKF prediction, PER_SAMPLE: one UKF prediction for each sample
+    imu_preintegration = private_nh.param<std::string>("imu_prediction_mode", "PREINTEGRATION") != "PER_SAMPLE";
     if (use_imu) {
-      NODELET_INFO("enable imu-based prediction");
+      NODELET_INFO_STREAM("enable imu-based prediction (" << (imu_preintegration ? "preintegration" : "per sample") << ")");
+      imu_buffer.reset(new SpscRingBuffer<ImuSample>(private_nh.param<int>("imu_buffer_size", 1024)));
+
+      // high-rate pose output: the last corrected state is propagated with imu samples on its own thread
+      if (private_nh.param<bool>("enable_highrate_odom", false)) {
+        NODELET_INFO("enable high-rate pose output");
+        highrate_stop = false;
+        highrate_max_extrapolation = private_nh.param<double>("highrate_max_extrapolation", 1.0);
+        highrate_imu_buffer.reset(new SpscRingBuffer<ImuSample>(private_nh.param<int>("imu_buffer_size", 1024)));
+        highrate_pose_pub = nh.advertise<nav_msgs::Odometry>("/odom_highrate", 32, false);
+        highrate_thread = std::thread(&HdlLocalizationNodelet::highrate_loop, this);
+      }
       imu_sub = mt_nh.subscribe("/gpsimu_driver/imu_data", 256, &HdlLocalizationNodelet::imu_callback, this);
     }
-    points_sub = mt_nh.subscribe("/velodyne_points", 5, &HdlLocalizationNodelet::points_callback, this);
-    globalmap_sub = nh.subscribe("/globalmap", 1, &HdlLocalizationNodelet::globalmap_callback, this);
+
+    // robot odometry source for the odometry-based prediction and the relocalization delta
+    // TF: tf lookups via robot_odom_frame_id, TOPIC: nav_msgs/Odometry on robot_odom_topic buffered and interpolated at the scan times
+    enable_robot_odometry_prediction = private_nh.param<bool>("enable_robot_odometry_prediction", false);
+    std::string robot_odom_source = private_nh.param<std::string>("robot_odom_source", "TF");
+    if(robot_odom_source == "TOPIC") {
+      std::string robot_odom_topic = private_nh.param<std::string>("robot_odom_topic", "/robot_odom");
+      // the outputs of this nodelet must not be fed back as robot odometry
+      const std::string resolved_topic = mt_nh.resolveName(robot_odom_topic);
+      if(resolved_topic == nh.resolveName("/odom") || resolved_topic == nh.resolveName("/odom_highrate")) {
+        NODELET_ERROR_STREAM("robot_odom_topic " << robot_odom_topic << " is an output of hdl_localization (TF is used)");
+      } else {
+        NODELET_INFO_STREAM("robot odometry is taken from " << robot_odom_topic);
+        // the extrinsics of the odometry child frame are resolved once without waiting, so that the callback never blocks
+        odom_child_cache.reset(new TransformCache(tf_buffer, true, 0.0));
+        odom_buffer.reset(new OdomBuffer(private_nh.param<int>("robot_odom_buffer_size", 512)));
+        robot_odom_sub = mt_nh.subscribe(robot_odom_topic, 256, &HdlLocalizationNodelet::robot_odom_callback, this);
+      }
+    } else if(robot_odom_source != "TF") {
+      NODELET_WARN_STREAM("unknown robot odometry source:" << robot_odom_source << " (TF is used)");
+    }
+
+    // pipelining: preprocessing and scan matching run on their own threads connected with a queue
+    if (private_nh.param<bool>("enable_pipelining", false)) {
+      int queue_size = private_nh.param<int>("pipeline_queue_size", 2);
+      NODELET_INFO_STREAM("enable pipelined scan processing (queue_size=" << queue_size << ")");
+      raw_scan_queue.reset(new BoundedQueue<sensor_msgs::PointCloud2ConstPtr>(queue_size));
+      preprocessed_scan_queue.reset(new BoundedQueue<PreprocessedScan::Ptr>(queue_size));
+      preprocessing_thread = std::thread(&HdlLocalizationNodelet::preprocessing_loop, this);
+      estimation_thread = std::thread(&HdlLocalizationNodelet::estimation_loop, this);
+    }
+    // multiple lidars: the scans of all the topics are matched against the same registration target, either
+    // MERGE: merged into one scan per time window, or SEQUENTIAL: used as separate corrections in the order of arrival
+    std::vector<std::string> points_topics;
+    std::stringstream points_topics_sst(private_nh.param<std::string>("points_topics", ""));
+    for(std::string topic; std::getline(points_topics_sst, topic, ',');) {
+      topic.erase(std::remove(topic.begin(), topic.end(), ' '), topic.end());
+      if(!topic.empty()) {
+        points_topics.push_back(topic);
+      }
+    }
+    if(points_topics.empty()) {
+      points_topics.push_back("/velodyne_points");
+    }
+
+    num_points_topics = points_topics.size();
+    merge_scans = private_nh.param<std::string>("points_topics_mode", "MERGE") != "SEQUENTIAL";
+    merge_window = private_nh.param<double>("points_merge_window", 0.05);
+    if(num_points_topics > 1) {
+      NODELET_INFO_STREAM("enable multi-lidar localization (" << num_points_topics << " topics, " << (merge_scans ? "merge" : "sequential") << ")");
+    }
+    for(const auto& topic : points_topics) {
+      points_subs.push_back(mt_nh.subscribe(topic, 5, &HdlLocalizationNodelet::points_callback, this));
+    }
+    applied_patch_stamp = 0;
+    globalmap_received = false;
+
+    // load the globalmap from a preprocessed cache instead of waiting for /globalmap
+    // the cache is validated against the pcd file and the preprocessing params of globalmap_server_nodelet
+    pcl::PointCloud<PointT>::Ptr cached_globalmap;
+    std::string globalmap_cache = private_nh.param<std::string>("globalmap_cache", "");
+    if(!globalmap_cache.empty()) {
+      std::string globalmap_pcd = private_nh.param<std::string>("globalmap_pcd", "");
+      bool convert_utm_to_local = private_nh.param<bool>("globalmap_convert_utm_to_local", true);
+      double downsample_resolution = private_nh.param<double>("globalmap_downsample_resolution", 0.1);
+      cached_globalmap = load_globalmap_cache(globalmap_cache, globalmap_pcd, convert_utm_to_local, downsample_resolution);
+      if(cached_globalmap) {
+        NODELET_INFO_STREAM("globalmap loaded from cache " << globalmap_cache);
+      } else {
+        NODELET_WARN_STREAM("failed to load globalmap cache " << globalmap_cache << " (wait for the globalmap topic)");
+      }
+    }
+
+    if(cached_globalmap) {
+      // the cached map is used as it is, and only the patches are received from globalmap_server_nodelet
+    } else if(use_globalmap_tiles) {
+      globalmap_tiles_version = 0;
+      globalmap_tiles_complete = false;
+      globalmap_tile_sub = nh.subscribe("/globalmap_tiles", 64, &HdlLocalizationNodelet::globalmap_tile_callback, this);
+      globalmap_tile_request_pub = nh.advertise<GlobalmapTileRequest>("/map_request/tiles", 5, false);
+      globalmap_tile_request_timer = nh.createWallTimer(ros::WallDuration(1.0), &HdlLocalizationNodelet::globalmap_tile_request_cb, this);
+    } else {
+      globalmap_sub = nh.subscribe("/globalmap", 1, &HdlLocalizationNodelet::globalmap_callback, this);
+    }
+    globalmap_patch_sub = nh.subscribe("/globalmap_patch", 5, &HdlLocalizationNodelet::globalmap_patch_callback, this);
     initialpose_sub = nh.subscribe("/initialpose", 8, &HdlLocalizationNodelet::initialpose_callback, this);
 
     pose_pub = nh.advertise<nav_msgs::Odometry>("/odom", 5, false);
@@ -78,82 +277,175 @@ public:
       set_global_map_service = nh.serviceClient<hdl_global_localization::SetGlobalMap>("/hdl_global_localization/set_global_map");
       query_global_localization_service = nh.serviceClient<hdl_global_localization::QueryGlobalLocalization>("/hdl_global_localization/query");
 
+      relocalization_stop = false;
+      relocalization_requested = false;
+      relocalization_thread = std::thread(&HdlLocalizationNodelet::relocalization_loop, this);
       relocalize_server = nh.advertiseService("/relocalize", &HdlLocalizationNodelet::relocalize, this);
     }
+
+    if(cached_globalmap) {
+      set_globalmap(cached_globalmap);
+    }
   }
 
 private:
-  pcl::Registration<PointT, PointT>::Ptr create_registration() const {
-    std::string reg_method = private_nh.param<std::string>("reg_method", "NDT_OMP");
-    std::string ndt_neighbor_search_method = private_nh.param<std::string>("ndt_neighbor_search_method", "DIRECT7");
-    double ndt_neighbor_search_radius = private_nh.param<double>("ndt_neighbor_search_radius", 2.0);
-    double ndt_resolution = private_nh.param<double>("ndt_resolution", 1.0);
-
-    if(reg_method == "NDT_OMP") {
-      NODELET_INFO("NDT_OMP is selected");
-      pclomp::NormalDistributionsTransform<PointT, PointT>::Ptr ndt(new pclomp::NormalDistributionsTransform<PointT, PointT>());
-      ndt->setTransformationEpsilon(0.01);
-      ndt->setResolution(ndt_resolution);
-      if (ndt_neighbor_search_method == "DIRECT1") {
-        NODELET_INFO("search_method DIRECT1 is selected");
-        ndt->setNeighborhoodSearchMethod(pclomp::DIRECT1);
-      } else if (ndt_neighbor_search_method == "DIRECT7") {
-        NODELET_INFO("search_method DIRECT7 is selected");
-        ndt->setNeighborhoodSearchMethod(pclomp::DIRECT7);
-      } else {
-        if (ndt_neighbor_search_method == "KDTREE") {
-          NODELET_INFO("search_method KDTREE is selected");
-        } else {
-          NODELET_WARN("invalid search method was given");
-          NODELET_WARN("default method is selected (KDTREE)");
-        }
-        ndt->setNeighborhoodSearchMethod(pclomp::KDTREE);
-      }
-      return ndt;
-    } else if(reg_method.find("NDT_CUDA") != std::string::npos) {
-      NODELET_INFO("NDT_CUDA is selected");
-      boost::shared_ptr<fast_gicp::NDTCuda<PointT, PointT>> ndt(new fast_gicp::NDTCuda<PointT, PointT>);
-      ndt->setResolution(ndt_resolution);
-
-      if(reg_method.find("D2D") != std::string::npos) {
-        ndt->setDistanceMode(fast_gicp::NDTDistanceMode::D2D);
-      } else if (reg_method.find("P2D") != std::string::npos) {
-        ndt->setDistanceMode(fast_gicp::NDTDistanceMode::P2D);
-      }
-
-      if (ndt_neighbor_search_method == "DIRECT1") {
-        NODELET_INFO("search_method DIRECT1 is selected");
-        ndt->setNeighborSearchMethod(fast_gicp::NeighborSearchMethod::DIRECT1);
-      } else if (ndt_neighbor_search_method == "DIRECT7") {
-        NODELET_INFO("search_method DIRECT7 is selected");
-        ndt->setNeighborSearchMethod(fast_gicp::NeighborSearchMethod::DIRECT7);
-      } else if (ndt_neighbor_search_method == "DIRECT_RADIUS") {
-        NODELET_INFO_STREAM("search_method DIRECT_RADIUS is selected : " << ndt_neighbor_search_radius);
-        ndt->setNeighborSearchMethod(fast_gicp::NeighborSearchMethod::DIRECT_RADIUS, ndt_neighbor_search_radius);
-      } else {
-        NODELET_WARN("invalid search method was given");
+  RegistrationParams registration_params() const {
+    RegistrationParams params;
+    params.logger_name = getName();
+    params.reg_method = private_nh.param<std::string>("reg_method", "NDT_OMP");
+    params.ndt_neighbor_search_method = private_nh.param<std::string>("ndt_neighbor_search_method", "DIRECT7");
+    params.ndt_neighbor_search_radius = private_nh.param<double>("ndt_neighbor_search_radius", 2.0);
+    params.ndt_resolution = private_nh.param<double>("ndt_resolution", 1.0);
+
+    // coarse-to-fine pyramid: comma-separated resolutions of the coarse levels (e.g., "4.0,2.0")
+    std::stringstream pyramid_resolutions(private_nh.param<std::string>("ndt_pyramid_resolutions", ""));
+    std::string resolution;
+    while(std::getline(pyramid_resolutions, resolution, ',')) {
+      if(resolution.find_first_not_of(" ") != std::string::npos) {
+        params.ndt_pyramid_resolutions.push_back(std::stod(resolution));
       }
-      return ndt;
     }
+    params.ndt_pyramid_tracking_translation = private_nh.param<double>("ndt_pyramid_tracking_translation", 0.5);
+    params.ndt_pyramid_tracking_rotation = private_nh.param<double>("ndt_pyramid_tracking_rotation", 0.1);
+
+    // the registration target is shared with the other nodelets in the same process using the same map and settings
+    params.share_target = share_registration_target;
+    params.shared_target_id = shared_target_id;
+
+    return params;
+  }
 
-    NODELET_ERROR_STREAM("unknown registration method:" << reg_method);
-    return nullptr;
+  pcl::Registration<PointT, PointT>::Ptr create_registration() const {
+    return hdl_localization::create_registration(registration_params());
   }
 
   void initialize_params() {
     // intialize scan matching method
+    // the target sharing params are read before any registration is created, as they are copied into the registration params
+    // each nodelet builds its own submaps, so the submaps are never the same map as the ones of the other nodelets
+    share_registration_target = private_nh.param<bool>("share_registration_target", false);
+    shared_target_id = private_nh.param<std::string>("shared_target_id", "");
+    use_submap = private_nh.param<bool>("use_submap", false);
+    if (use_submap && !shared_target_id.empty()) {
+      NODELET_ERROR("shared_target_id cannot be used with use_submap (ignored)");
+      shared_target_id.clear();
+    }
     double downsample_resolution = private_nh.param<double>("downsample_resolution", 0.1);
     boost::shared_ptr<pcl::VoxelGrid<PointT>> voxelgrid(new pcl::VoxelGrid<PointT>());
     voxelgrid->setLeafSize(downsample_resolution, downsample_resolution, downsample_resolution);
     downsample_filter = voxelgrid;
 
+    // adaptive downsampling: the leaf size is adjusted to keep the number of points (POINTS) or the registration time (LATENCY) around a target
+    downsample_leaf = downsample_resolution;
+    std::string adaptive_downsampling_mode = private_nh.param<std::string>("adaptive_downsampling", "NONE");
+    if(adaptive_downsampling_mode == "POINTS" || adaptive_downsampling_mode == "LATENCY") {
+      bool points = adaptive_downsampling_mode == "POINTS";
+      double target = points ? private_nh.param<double>("adaptive_downsampling_target_points", 5000) : private_nh.param<double>("adaptive_downsampling_target_align_time", 30.0);
+      NODELET_INFO_STREAM("enable adaptive downsampling (" << adaptive_downsampling_mode << " target=" << target << ")");
+      adaptive_downsampling.reset(new AdaptiveDownsampling(
+        points ? AdaptiveDownsampling::Mode::POINTS : AdaptiveDownsampling::Mode::LATENCY,
+        target,
+        downsample_resolution,
+        private_nh.param<double>("adaptive_downsampling_min_resolution", 0.05),
+        private_nh.param<double>("adaptive_downsampling_max_resolution", 1.0)));
+    } else if(adaptive_downsampling_mode != "NONE") {
+      NODELET_WARN_STREAM("unknown adaptive downsampling mode:" << adaptive_downsampling_mode << " (disabled)");
+    }
+
+    std::string preprocess_method = private_nh.param<std::string>("preprocess_method", "FUSED");
+    if(preprocess_method == "FUSED") {
+      NODELET_INFO("fused scan preprocessing is selected");
+      fused_preprocessor.reset(new FusedScanPreprocessor(downsample_resolution));
+    } else if(preprocess_method != "VOXELGRID") {
+      NODELET_WARN_STREAM("unknown preprocess method:" << preprocess_method << " (VOXELGRID is used)");
+    }
+
+    // deskew: the points are undistorted with their timestamps and the imu / estimated motion in the fused preprocessing
+    deskew_time_field = private_nh.param<std::string>("deskew_time_field", "");
+    deskew_linear_velocity.setZero();
+    deskew_angular_velocity.setZero();
+    deskew_gyro_bias.setZero();
+    if(private_nh.param<bool>("enable_deskew", false)) {
+      if(fused_preprocessor) {
+        NODELET_INFO("enable deskewing");
+        deskewer.reset(new ScanDeskewer(private_nh.param<int>("deskew_num_bins", 128)));
+      } else {
+        NODELET_WARN("deskewing requires preprocess_method FUSED (disabled)");
+      }
+    }
+
     NODELET_INFO("create registration method for localization");
     registration = create_registration();
+    // NDT_CUDA: the targets are built into recycled instances to keep their device memory, and the first alignment on each target
+    // (which allocates the source buffers on the device) is done on the builder thread
+    const bool cuda = registration_params().reg_method.find("NDT_CUDA") != std::string::npos;
+    if(cuda && private_nh.param<bool>("cuda_keep_target_resident", true)) {
+      NODELET_INFO("keep the registration targets resident on the device");
+      target_builder.reset(new BackgroundTargetBuilder([this] { return create_registration(); }, &HdlLocalizationNodelet::warm_up_registration, true));
+    } else {
+      target_builder.reset(new BackgroundTargetBuilder([this] { return create_registration(); }));
+    }
 
     // global localization
-    NODELET_INFO("create registration method for fallback during relocalization");
+    // the motion during the global localization query is estimated with
+    // SCAN_MATCHING: a coarse scan-to-scan NDT on the relocalization thread, ODOMETRY: robot odometry (tf), NONE: not estimated
     relocalizing = false;
-    delta_estimater.reset(new DeltaEstimater(create_registration()));
+    relocalization_delta_method = private_nh.param<std::string>("relocalization_delta_method", "SCAN_MATCHING");
+    if(relocalization_delta_method == "SCAN_MATCHING") {
+      NODELET_INFO("create registration method for fallback during relocalization");
+      RegistrationParams params = registration_params();
+      params.ndt_resolution = private_nh.param<double>("relocalization_delta_ndt_resolution", 2.0);
+      params.ndt_pyramid_resolutions.clear();
+      params.share_target = false;
+      delta_estimater.reset(new DeltaEstimater(hdl_localization::create_registration(params), private_nh.param<double>("relocalization_delta_downsample_resolution", 0.5)));
+    } else if(relocalization_delta_method != "ODOMETRY" && relocalization_delta_method != "NONE") {
+      NODELET_WARN_STREAM("unknown relocalization delta method:" << relocalization_delta_method << " (NONE is used)");
+      relocalization_delta_method = "NONE";
+    }
+
+    // multi-hypothesis relocalization: the candidates are tracked for hypothesis_scans, and those with an inlier fraction
+    // below prune_ratio * the best one are dropped on the way
+    relocalization_num_candidates = std::max(1, private_nh.param<int>("relocalization_num_candidates", 1));
+    hypothesis_scans = private_nh.param<int>("relocalization_hypothesis_scans", 5);
+    hypothesis_prune_ratio = private_nh.param<double>("relocalization_hypothesis_prune_ratio", 0.8);
+    // each candidate is aligned against its own target (submap mode: the submap around it, otherwise: the map within this radius)
+    hypothesis_target_radius = private_nh.param<double>("relocalization_hypothesis_radius", 50.0);
+
+    // scan matching status
+    // NDT: evaluated with the NDT voxel distributions of the target (a hash lookup per point), KDTREE: nearest neighbor search on the target
+    status_max_correspondence_dist = private_nh.param<double>("status_max_correspondence_dist", 0.5);
+    status_max_valid_point_dist = private_nh.param<double>("status_max_valid_point_dist", 25.0);
+    status_ndt_resolution = -1.0;
+    std::string status_method = private_nh.param<std::string>("status_method", "KDTREE");
+    if(status_method == "NDT") {
+      status_ndt_resolution = private_nh.param<double>("ndt_resolution", 1.0);
+    } else if(status_method != "KDTREE") {
+      NODELET_WARN_STREAM("unknown status method:" << status_method << " (KDTREE is used)");
+    }
+
+    // submap mode (use_submap has been read with the target sharing params)
+    submap_tile_size = private_nh.param<double>("submap_tile_size", 20.0);
+    submap_radius = private_nh.param<double>("submap_radius", 50.0);
+    submap_update_distance = private_nh.param<double>("submap_update_distance", 10.0);
+    if (use_submap) {
+      NODELET_INFO_STREAM("enable submap mode (radius=" << submap_radius << " tile_size=" << submap_tile_size << ")");
+    }
+
+    // CLOUD: the whole map on /globalmap, TILES: tiles on /globalmap_tiles (the tile size of globalmap_server_nodelet is used)
+    use_globalmap_tiles = private_nh.param<std::string>("globalmap_source", "CLOUD") == "TILES";
+    globalmap_tiles_radius = private_nh.param<double>("globalmap_tiles_radius", -1.0);
+    if (globalmap_tiles_radius > 0.0 && !use_submap) {
+      NODELET_WARN_STREAM("globalmap_tiles_radius requires use_submap (the whole map is requested)");
+      globalmap_tiles_radius = -1.0;
+    }
+
+    correction_chunk_iterations = private_nh.param<int>("correction_chunk_iterations", 0);
+    correction_max_iterations = private_nh.param<int>("correction_max_iterations", 0);
+    correction_max_time = private_nh.param<double>("correction_max_time", 0.0);
+    correction_early_exit_translation = private_nh.param<double>("correction_early_exit_translation", 0.005);
+    correction_early_exit_rotation = private_nh.param<double>("correction_early_exit_rotation", 0.001);
+    // square-root UKF: the covariance is kept as a Cholesky factor, and the corrections use 2N+1 sigma points with additive noise
+    square_root_ukf = private_nh.param<bool>("square_root_ukf", false);
 
     // initialize pose estimator
     if(private_nh.param<bool>("specify_init_pose", true)) {
@@ -163,6 +455,27 @@ private:
         Eigen::Quaternionf(private_nh.param<double>("init_ori_w", 1.0), private_nh.param<double>("init_ori_x", 0.0), private_nh.param<double>("init_ori_y", 0.0), private_nh.param<double>("init_ori_z", 0.0)),
         private_nh.param<double>("cool_time_duration", 0.5)
       ));
+      configure_pose_estimator();
+    }
+  }
+
+  /**
+   * @brief configure a newly created pose estimator
+   * @note  the correction budget is applied, and the coarse levels of the registration pyramid are enabled for the first corrections
+   */
+  void configure_pose_estimator() {
+    pose_estimator->set_correction_budget(correction_chunk_iterations, correction_max_iterations, correction_max_time, correction_early_exit_translation, correction_early_exit_rotation);
+    pose_estimator->set_square_root_filter(square_root_ukf);
+    reset_registration_tracking();
+  }
+
+  /**
+   * @brief enable the coarse levels of the registration pyramid for the next correction
+   */
+  void reset_registration_tracking() {
+    auto pyramid = dynamic_cast<RegistrationPyramid*>(registration.get());
+    if(pyramid) {
+      pyramid->set_tracking(false);
     }
   }
 
@@ -172,8 +485,80 @@ private:
    * @param imu_msg
    */
   void imu_callback(const sensor_msgs::ImuConstPtr& imu_msg) {
-    std::lock_guard<std::mutex> lock(imu_data_mutex);
-    imu_data.push_back(imu_msg);
+    const auto& acc = imu_msg->linear_acceleration;
+    const auto& gyro = imu_msg->angular_velocity;
+    double acc_sign = invert_acc ? -1.0 : 1.0;
+    double gyro_sign = invert_gyro ? -1.0 : 1.0;
+
+    ImuSample sample;
+    sample.stamp = imu_msg->header.stamp;
+    sample.acc = acc_sign * Eigen::Vector3f(acc.x, acc.y, acc.z);
+    sample.gyro = gyro_sign * Eigen::Vector3f(gyro.x, gyro.y, gyro.z);
+
+    // never blocks: when the buffer is full (e.g., no scan is processed before the globalmap and the initial pose arrive), the oldest
+    // sample is discarded to keep the latest ones. the consumer side is serialized by pose_estimator_mutex, so the oldest sample can
+    // be popped here only while holding it. if the scan thread holds it, the new sample is dropped instead
+    if(!imu_buffer->push(sample)) {
+      std::unique_lock<std::mutex> lock(pose_estimator_mutex, std::try_to_lock);
+      if(lock.owns_lock() && imu_buffer->front()) {
+        imu_buffer->pop();
+        imu_buffer->push(sample);
+      } else {
+        NODELET_WARN_STREAM_THROTTLE(5.0, "imu buffer is full (" << imu_buffer->num_dropped() << " samples dropped so far)");
+      }
+    }
+
+    // the lock is taken between the push and the notification so that highrate_loop cannot miss the wakeup
+    if(highrate_imu_buffer) {
+      if(!highrate_imu_buffer->push(sample)) {
+        NODELET_WARN_STREAM_THROTTLE(5.0, "highrate imu buffer is full (" << highrate_imu_buffer->num_dropped() << " samples dropped so far)");
+      }
+      {
+        std::lock_guard<std::mutex> lock(highrate_mutex);
+      }
+      highrate_cv.notify_one();
+    }
+
+    // the preprocessing looks up the samples around each scan without consuming them (the lock is held only for the push)
+    if(deskewer) {
+      std::lock_guard<std::mutex> lock(deskew_mutex);
+      deskew_imu_history.push_back(sample);
+      while(deskew_imu_history.size() > 1 && (sample.stamp - deskew_imu_history.front().stamp).toSec() > 1.0) {
+        deskew_imu_history.pop_front();
+      }
+    }
+  }
+
+  /**
+   * @brief high-rate pose output thread: propagates the last corrected state with each imu sample and publishes it
+   */
+  void highrate_loop() {
+    PosePropagator propagator(highrate_max_extrapolation);
+
+    while(true) {
+      std::unique_ptr<CorrectedState> correction;
+      {
+        std::unique_lock<std::mutex> lock(highrate_mutex);
+        highrate_cv.wait(lock, [this] { return highrate_stop || highrate_correction || highrate_imu_buffer->front(); });
+        if(highrate_stop) {
+          return;
+        }
+        correction = std::move(highrate_correction);
+      }
+
+      if(correction) {
+        propagator.reset(correction->stamp, correction->pos, correction->vel, correction->quat, correction->acc_bias, correction->gyro_bias);
+      }
+
+      for(const ImuSample* sample = highrate_imu_buffer->front(); sample; sample = highrate_imu_buffer->front()) {
+        bool propagated = propagator.add(*sample);
+        highrate_imu_buffer->pop();
+
+        if(propagated && highrate_pose_pub.getNumSubscribers()) {
+          publish_highrate_odometry(propagator);
+        }
+      }
+    }
   }
 
   /**
@@ -181,118 +566,773 @@ private:
    * @param points_msg
    */
   void points_callback(const sensor_msgs::PointCloud2ConstPtr& points_msg) {
-    if(!globalmap) {
+    if(!globalmap_received) {
       NODELET_ERROR("globalmap has not been received!!");
       return;
     }
 
+    if(raw_scan_queue) {
+      if(!raw_scan_queue->push(points_msg)) {
+        NODELET_WARN_THROTTLE(5.0, "preprocessing is behind the input rate, the oldest scan was dropped");
+      }
+      return;
+    }
+
+    auto scan = preprocess(points_msg);
+    if(scan) {
+      estimate(scan);
+    }
+  }
+
+  /**
+   * @brief pipelining stage 1: decode, transform, and downsample input scans
+   */
+  void preprocessing_loop() {
+    sensor_msgs::PointCloud2ConstPtr points_msg;
+    while(raw_scan_queue->pop(points_msg)) {
+      auto scan = preprocess(points_msg);
+      if(scan && !preprocessed_scan_queue->push(scan)) {
+        NODELET_WARN_THROTTLE(5.0, "scan matching is behind the input rate, the oldest scan was dropped");
+      }
+    }
+  }
+
+  /**
+   * @brief pipelining stage 2: prediction, correction, and publication
+   */
+  void estimation_loop() {
+    PreprocessedScan::Ptr scan;
+    while(preprocessed_scan_queue->pop(scan)) {
+      estimate(scan);
+    }
+  }
+
+  /**
+   * @brief pass a preprocessed scan to the estimation (in the MERGE mode, the scans of the sensors are merged first)
+   */
+  void estimate(const PreprocessedScan::Ptr& scan) {
+    if(num_points_topics < 2 || !merge_scans) {
+      process_scan(scan);
+      return;
+    }
+
+    for(const auto& merged : merge_scan(scan)) {
+      process_scan(merged);
+    }
+  }
+
+  /**
+   * @brief collect the scans of the sensors within a time window
+   * @note  a batch is closed when all the sensors (distinguished by frame_id) are in it, or when a scan from a sensor already in it
+   *        or out of the window arrives. the motion within the window is not compensated.
+   * @return merged scans ready for the estimation
+   */
+  std::vector<PreprocessedScan::Ptr> merge_scan(const PreprocessedScan::Ptr& scan) {
+    std::lock_guard<std::mutex> lock(merge_mutex);
+    std::vector<PreprocessedScan::Ptr> merged;
+
+    if(!pending_scans.empty()) {
+      const double dt = (scan->header.stamp - pending_scans.front()->header.stamp).toSec();
+      if(dt < -merge_window) {
+        NODELET_WARN_STREAM_THROTTLE(5.0, "a scan older than the merge window was dropped (" << scan->header.frame_id << ")");
+        return merged;
+      }
+
+      const bool duplicated = std::any_of(pending_scans.begin(), pending_scans.end(), [&](const PreprocessedScan::Ptr& pending) { return pending->header.frame_id == scan->header.frame_id; });
+      if(dt > merge_window || duplicated) {
+        merged.push_back(concatenate_scans(pending_scans));
+        pending_scans.clear();
+      }
+    }
+
+    pending_scans.push_back(scan);
+    if(pending_scans.size() >= num_points_topics) {
+      merged.push_back(concatenate_scans(pending_scans));
+      pending_scans.clear();
+    }
+    return merged;
+  }
+
+  /**
+   * @brief merge preprocessed scans into one with the header and the stage times of the latest one
+   */
+  PreprocessedScan::Ptr concatenate_scans(const std::vector<PreprocessedScan::Ptr>& scans) const {
+    auto latest = std::max_element(scans.begin(), scans.end(), [](const PreprocessedScan::Ptr& lhs, const PreprocessedScan::Ptr& rhs) { return lhs->header.stamp < rhs->header.stamp; });
+    if(scans.size() == 1) {
+      return *latest;
+    }
+
+    size_t num_points = 0;
+    for(const auto& scan : scans) {
+      num_points += scan->cloud->size();
+    }
+
+    pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+    cloud->reserve(num_points);
+    for(const auto& scan : scans) {
+      cloud->insert(cloud->end(), scan->cloud->begin(), scan->cloud->end());
+    }
+    cloud->header = (*latest)->cloud->header;
+    cloud->width = cloud->size();
+    cloud->height = 1;
+    cloud->is_dense = true;
+
+    PreprocessedScan::Ptr merged(new PreprocessedScan(**latest));
+    merged->cloud = cloud;
+    merged->stopwatch.lap("merge");
+    return merged;
+  }
+
+  /**
+   * @brief decode an input scan, transform it into odom_child_frame_id, and downsample it
+   * @param points_msg  input scan
+   * @return preprocessed scan (nullptr if failed)
+   */
+  PreprocessedScan::Ptr preprocess(const sensor_msgs::PointCloud2ConstPtr& points_msg) {
+    // the subscribers of several topics may call this concurrently
+    std::unique_lock<std::mutex> preprocess_lock(preprocess_mutex, std::defer_lock);
+    if(num_points_topics > 1) {
+      preprocess_lock.lock();
+    }
+
+    if(adaptive_downsampling && adaptive_downsampling->leaf_size() != downsample_leaf) {
+      set_downsample_leaf(adaptive_downsampling->leaf_size());
+    }
+
+    PreprocessedScan::Ptr scan(new PreprocessedScan());
+    pcl::PointCloud<PointT>::ConstPtr filtered = fused_preprocessor ? preprocess_fused(points_msg, scan->stopwatch) : preprocess_voxelgrid(points_msg, scan->stopwatch);
+    if(!filtered) {
+      return nullptr;
+    }
+
+    if(filtered->empty()) {
+      NODELET_ERROR("cloud is empty!!");
+      return nullptr;
+    }
+
+    scan->header = points_msg->header;
+    scan->cloud = filtered;
+    return scan;
+  }
+
+  /**
+   * @brief preprocessing with pcl: fromROSMsg, pcl::transformPointCloud, and downsample_filter
+   * @param points_msg  input scan
+   * @param stopwatch   stage timer
+   * @return preprocessed cloud (nullptr if failed)
+   */
+  pcl::PointCloud<PointT>::ConstPtr preprocess_voxelgrid(const sensor_msgs::PointCloud2ConstPtr& points_msg, StageStopwatch& stopwatch) {
     const auto& stamp = points_msg->header.stamp;
     pcl::PointCloud<PointT>::Ptr pcl_cloud(new pcl::PointCloud<PointT>());
     pcl::fromROSMsg(*points_msg, *pcl_cloud);
+    stopwatch.lap("decode");
 
     if(pcl_cloud->empty()) {
       NODELET_ERROR("cloud is empty!!");
-      return;
+      return nullptr;
     }
 
     // transform pointcloud into odom_child_frame_id
     std::string tfError;
+    Eigen::Isometry3d sensor2base;
+    if(!extrinsics_cache->lookup(odom_child_frame_id, pcl_cloud->header.frame_id, stamp, sensor2base, &tfError)) {
+      NODELET_ERROR(tfError.c_str());
+      return nullptr;
+    }
+    stopwatch.lap("tf_wait");
+
     pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
-    if(this->tf_buffer.canTransform(odom_child_frame_id, pcl_cloud->header.frame_id, stamp, ros::Duration(0.1), &tfError))
-    {
-        if(!pcl_ros::transformPointCloud(odom_child_frame_id, *pcl_cloud, *cloud, this->tf_buffer)) {
-            NODELET_ERROR("point cloud cannot be transformed into target frame!!");
-            return;
+    pcl::transformPointCloud(*pcl_cloud, *cloud, sensor2base.cast<float>().matrix());
+    cloud->header.frame_id = odom_child_frame_id;
+    stopwatch.lap("transform");
+
+    auto filtered = downsample(cloud);
+    stopwatch.lap("downsample");
+    return filtered;
+  }
+
+  /**
+   * @brief single-pass preprocessing which reads points from the message buffer and directly accumulates them into a voxel grid
+   * @param points_msg  input scan
+   * @param stopwatch   stage timer
+   * @return preprocessed cloud (nullptr if the transform is not available)
+   */
+  pcl::PointCloud<PointT>::ConstPtr preprocess_fused(const sensor_msgs::PointCloud2ConstPtr& points_msg, StageStopwatch& stopwatch) {
+    const auto& stamp = points_msg->header.stamp;
+
+    std::string tfError;
+    Eigen::Isometry3d sensor2base;
+    if(!extrinsics_cache->lookup(odom_child_frame_id, points_msg->header.frame_id, stamp, sensor2base, &tfError)) {
+      NODELET_ERROR(tfError.c_str());
+      return nullptr;
+    }
+    Eigen::Matrix4f transform = sensor2base.cast<float>().matrix();
+    stopwatch.lap("tf_wait");
+
+    ScanDeskewer* scan_deskewer = nullptr;
+    if(deskewer) {
+      std::lock_guard<std::mutex> lock(deskew_mutex);
+      deskew_imu_samples.clear();
+      for(const auto& sample : deskew_imu_history) {
+        if(std::abs((sample.stamp - stamp).toSec()) < 0.5) {
+          deskew_imu_samples.push_back(sample);
         }
-    }else
-    {
-        NODELET_ERROR(tfError.c_str());
+      }
+      deskewer->set_motion(deskew_imu_samples, deskew_gyro_bias, deskew_angular_velocity, deskew_linear_velocity, stamp);
+      scan_deskewer = deskewer.get();
+    }
+
+    pcl::PointCloud<PointT>::Ptr filtered = fused_preprocessor->process(*points_msg, transform, scan_deskewer, deskew_time_field);
+    if(deskewer && filtered && !fused_preprocessor->last_scan_deskewed()) {
+      NODELET_WARN_STREAM_THROTTLE(5.0, "the points have no time field, the scan is not deskewed (" << points_msg->header.frame_id << ")");
+    }
+    if(!filtered) {
+      NODELET_WARN("the point layout is not supported by the fused preprocessing, fall back to VOXELGRID");
+      fused_preprocessor.reset();
+      return preprocess_voxelgrid(points_msg, stopwatch);
+    }
+    stopwatch.lap("fused_preprocess");
+
+    pcl_conversions::toPCL(points_msg->header, filtered->header);
+    filtered->header.frame_id = odom_child_frame_id;
+    return filtered;
+  }
+
+  /**
+   * @brief estimate the sensor pose with a preprocessed scan and publish the result
+   * @param scan  preprocessed scan (in odom_child_frame_id)
+   */
+  void process_scan(const PreprocessedScan::Ptr& scan) {
+    const auto& stamp = scan->header.stamp;
+    const auto& filtered = scan->cloud;
+    auto& stopwatch = scan->stopwatch;
+
+    std::lock_guard<std::mutex> estimator_lock(pose_estimator_mutex);
+    stopwatch.lap("wait");  // queue (in the pipelined mode) and lock waiting
+
+    // with several lidars, a scan older than the last processed one arrived late and cannot be used for the prediction
+    if(num_points_topics > 1) {
+      if(stamp <= last_processed_stamp) {
+        NODELET_WARN_STREAM_THROTTLE(5.0, "a scan older than the last processed one was dropped (" << scan->header.frame_id << ")");
         return;
+      }
+      last_processed_stamp = stamp;
     }
 
-    auto filtered = downsample(cloud);
-    last_scan = filtered;
+    // the scan (merged in the MERGE mode) for relocalization. a dropped late scan is not used, so that the relocalization
+    // query and the delta estimation do not go back in time (relocalization_mutex is never held while waiting for pose_estimator_mutex)
+    {
+      std::lock_guard<std::mutex> lock(relocalization_mutex);
+      last_scan = filtered;
+      last_scan_stamp = stamp;
+    }
 
-    if(relocalizing) {
+    if(relocalizing && delta_estimater) {
       delta_estimater->add_frame(filtered);
     }
 
-    std::lock_guard<std::mutex> estimator_lock(pose_estimator_mutex);
+    // take the imu samples up to the scan (the lock serializes the consumer side of the ring buffer)
+    imu_samples.clear();
+    if(use_imu) {
+      for(const ImuSample* sample = imu_buffer->front(); sample && sample->stamp <= stamp; sample = imu_buffer->front()) {
+        imu_samples.push_back(*sample);
+        imu_buffer->pop();
+      }
+    }
+
     if(!pose_estimator) {
       NODELET_ERROR("waiting for initial pose input!!");
       return;
     }
+
+    if(!registration_target) {
+      NODELET_WARN_THROTTLE(1.0, "waiting for the registration target to be built!!");
+      return;
+    }
     Eigen::Matrix4f before = pose_estimator->matrix();
 
-    // predict
+    // candidate poses of the last relocalization are tracked with the same scan until the best one is selected
+    if(!hypotheses.empty()) {
+      correct_hypotheses(stamp, filtered);
+      stopwatch.lap("hypotheses");
+    }
+
+    predict(*pose_estimator, stamp, &stopwatch);
+
+    // correct (the aligned cloud is computed only if the hypotheses, /aligned_points, or the status need it)
+    pose_estimator->correct(stamp, filtered);
+    stopwatch.lap("align");
+
+    if(!hypotheses.empty()) {
+      select_hypothesis(*pose_estimator->aligned_cloud());
+    }
+
+    if(adaptive_downsampling) {
+      adaptive_downsampling->update(filtered->size(), stopwatch.get_stages().back().msec);
+    }
+
+    if(highrate_imu_buffer) {
+      std::unique_ptr<CorrectedState> corrected(new CorrectedState());
+      corrected->stamp = stamp;
+      corrected->pos = pose_estimator->pos();
+      corrected->vel = pose_estimator->vel();
+      corrected->quat = pose_estimator->quat();
+      corrected->acc_bias = pose_estimator->acc_bias();
+      corrected->gyro_bias = pose_estimator->gyro_bias();
+      {
+        std::lock_guard<std::mutex> lock(highrate_mutex);
+        highrate_correction = std::move(corrected);
+      }
+      highrate_cv.notify_one();
+    }
+
+    if(aligned_pub.getNumSubscribers()) {
+      auto aligned = pose_estimator->aligned_cloud();
+      aligned->header.frame_id = "map";
+      aligned->header.stamp = filtered->header.stamp;
+      aligned_pub.publish(aligned);
+    }
+
+    publish_odometry(stamp, pose_estimator->matrix());
+
+    if(use_submap) {
+      request_submap_update(pose_estimator->pos(), false);
+    }
+    if(deskewer) {
+      update_deskew_motion(stamp, *pose_estimator);
+    }
+    stopwatch.lap("publish");
+
+    // the status reports the stages of this scan up to here (the status stage itself is from the previous scan)
+    stage_statistics.add(stopwatch);
+    stage_statistics.add("total", stopwatch.elapsed_msec());
+
+    if(status_pub.getNumSubscribers()) {
+      publish_scan_matching_status(scan->header, pose_estimator->aligned_cloud());
+      stopwatch.lap("status");
+      stage_statistics.add("status", stopwatch.get_stages().back().msec);
+    }
+  }
+
+  /**
+   * @brief predict the state of a pose estimator up to a scan with the imu samples taken for the scan and the robot odometry
+   * @param estimator  pose estimator
+   * @param stamp      timestamp of the scan
+   * @param stopwatch  stage timer (optional)
+   */
+  void predict(hdl_localization::PoseEstimator& estimator, const ros::Time& stamp, StageStopwatch* stopwatch) {
     if(!use_imu) {
-      pose_estimator->predict(stamp);
+      estimator.predict(stamp);
     } else {
-      std::lock_guard<std::mutex> lock(imu_data_mutex);
-      auto imu_iter = imu_data.begin();
-      for(imu_iter; imu_iter != imu_data.end(); imu_iter++) {
-        if(stamp < (*imu_iter)->header.stamp) {
-          break;
+      if(imu_preintegration) {
+        if(!imu_samples.empty()) {
+          estimator.predict(imu_samples);
+        }
+      } else {
+        for(const auto& sample : imu_samples) {
+          estimator.predict(sample.stamp, sample.acc, sample.gyro);
         }
-        const auto& acc = (*imu_iter)->linear_acceleration;
-        const auto& gyro = (*imu_iter)->angular_velocity;
-        double acc_sign = invert_acc ? -1.0 : 1.0;
-        double gyro_sign = invert_gyro ? -1.0 : 1.0;
-        pose_estimator->predict((*imu_iter)->header.stamp, acc_sign * Eigen::Vector3f(acc.x, acc.y, acc.z), gyro_sign * Eigen::Vector3f(gyro.x, gyro.y, gyro.z));
       }
-      imu_data.erase(imu_data.begin(), imu_iter);
+    }
+    if(stopwatch) {
+      stopwatch->lap("prediction");
     }
 
     // odometry-based prediction
-    ros::Time last_correction_time = pose_estimator->last_correction_time();
-    if(private_nh.param<bool>("enable_robot_odometry_prediction", false) && !last_correction_time.isZero()) {
+    ros::Time last_correction_time = estimator.last_correction_time();
+    if(enable_robot_odometry_prediction && !last_correction_time.isZero() && odom_buffer) {
+      Eigen::Isometry3d delta;
+      if(odom_buffer->delta(last_correction_time, stamp, delta)) {
+        estimator.predict_odom(delta.cast<float>().matrix());
+      } else {
+        NODELET_WARN_STREAM_THROTTLE(1.0, "no robot odometry at the last correction time (latest odometry: " << odom_buffer->latest_stamp() << ")");
+      }
+      if(stopwatch) {
+        stopwatch->lap("odom_prediction");
+      }
+    } else if(enable_robot_odometry_prediction && !last_correction_time.isZero()) {
       geometry_msgs::TransformStamped odom_delta;
-      if(tf_buffer.canTransform(odom_child_frame_id, last_correction_time, odom_child_frame_id, stamp, robot_odom_frame_id, ros::Duration(0.1))) {
+      if(tf_buffer.canTransform(odom_child_frame_id, last_correction_time, odom_child_frame_id, stamp, robot_odom_frame_id, ros::Duration(tf_wait_timeout))) {
         odom_delta = tf_buffer.lookupTransform(odom_child_frame_id, last_correction_time, odom_child_frame_id, stamp, robot_odom_frame_id, ros::Duration(0));
       } else if(tf_buffer.canTransform(odom_child_frame_id, last_correction_time, odom_child_frame_id, ros::Time(0), robot_odom_frame_id, ros::Duration(0))) {
         odom_delta = tf_buffer.lookupTransform(odom_child_frame_id, last_correction_time, odom_child_frame_id, ros::Time(0), robot_odom_frame_id, ros::Duration(0));
       }
 
       if(odom_delta.header.stamp.isZero()) {
-        NODELET_WARN_STREAM("failed to look up transform between " << cloud->header.frame_id << " and " << robot_odom_frame_id);
+        NODELET_WARN_STREAM("failed to look up transform between " << odom_child_frame_id << " and " << robot_odom_frame_id);
       } else {
         Eigen::Isometry3d delta = tf2::transformToEigen(odom_delta);
-        pose_estimator->predict_odom(delta.cast<float>().matrix());
+        estimator.predict_odom(delta.cast<float>().matrix());
+      }
+      if(stopwatch) {
+        stopwatch->lap("odom_prediction");
       }
     }
+  }
 
-    // correct
-    auto aligned = pose_estimator->correct(stamp, filtered);
+  /**
+   * @brief update the motion used to deskew the next scans with the corrected state
+   * @note  without imu, the angular velocity is taken from the rotation between the last two corrected poses
+   * @param stamp      stamp of the corrected scan
+   * @param estimator  corrected pose estimator
+   */
+  void update_deskew_motion(const ros::Time& stamp, const hdl_localization::PoseEstimator& estimator) {
+    const Eigen::Matrix3f rot = estimator.quat().toRotationMatrix();
+
+    Eigen::Vector3f angular_velocity = Eigen::Vector3f::Zero();
+    const double dt = (stamp - deskew_last_stamp).toSec();
+    if(!deskew_last_stamp.isZero() && dt > 1e-3 && dt < 1.0) {
+      const Eigen::AngleAxisf delta(Eigen::Matrix3f(deskew_last_rot.transpose() * rot));
+      angular_velocity = delta.axis() * delta.angle() / dt;
+    }
+    deskew_last_stamp = stamp;
+    deskew_last_rot = rot;
 
-    if(aligned_pub.getNumSubscribers()) {
-      aligned->header.frame_id = "map";
-      aligned->header.stamp = cloud->header.stamp;
-      aligned_pub.publish(aligned);
+    std::lock_guard<std::mutex> lock(deskew_mutex);
+    deskew_linear_velocity = rot.transpose() * estimator.vel();
+    deskew_angular_velocity = angular_velocity;
+    deskew_gyro_bias = use_imu ? estimator.gyro_bias() : Eigen::Vector3f::Zero();
+  }
+
+  /**
+   * @brief predict and correct the candidate poses with a scan
+   * @note  each candidate has its own registration, and the candidates are aligned in parallel, one candidate per thread (the
+   *        parallel regions of NDT_OMP and of the evaluation are nested and run on the thread of their candidate)
+   */
+  void correct_hypotheses(const ros::Time& stamp, const pcl::PointCloud<PointT>::ConstPtr& filtered) {
+    for(auto& hypothesis : hypotheses) {
+      predict(*hypothesis.estimator, stamp, nullptr);
     }
 
-    if(status_pub.getNumSubscribers()) {
-      publish_scan_matching_status(points_msg->header, aligned);
+    const int num_hypotheses = hypotheses.size();
+#pragma omp parallel for schedule(dynamic, 1)
+    for(int i = 0; i < num_hypotheses; i++) {
+      auto& hypothesis = hypotheses[i];
+      hypothesis.estimator->correct(stamp, filtered);
+      hypothesis.inlier_fraction_sum += evaluate_alignment(*hypothesis.estimator->aligned_cloud(), hypothesis.estimator->pos(), *hypothesis.registration, hypothesis.voxel_map.get()).inlier_fraction();
+    }
+  }
+
+  /**
+   * @brief create the estimator of a relocalization candidate with its own registration on the map around the candidate pose
+   * @note  the target covers the candidate pose even if it is far from the current submap (submap mode: the submap around the
+   *        candidate, otherwise: the map within relocalization_hypothesis_radius). may be called from several threads
+   * @param pose    candidate pose
+   * @param params  registration settings
+   * @param tiles   globalmap tiles (submap mode)
+   * @param map     registration target of the pose estimator (cropped if tiles are not available)
+   */
+  PoseHypothesis create_hypothesis(const Eigen::Isometry3f& pose, const RegistrationParams& params, const GlobalmapTiles::ConstPtr& tiles, const pcl::PointCloud<PointT>::ConstPtr& map) const {
+    PoseHypothesis hypothesis;
+    hypothesis.inlier_fraction_sum = 0.0;
+
+    if(use_submap && tiles) {
+      hypothesis.target = tiles->submap(pose.translation(), submap_radius);
+    } else {
+      const float radius_sq = hypothesis_target_radius * hypothesis_target_radius;
+      pcl::PointCloud<PointT>::Ptr cropped(new pcl::PointCloud<PointT>());
+      cropped->header = map->header;
+      for(const auto& pt : map->points) {
+        if((pt.getVector3fMap() - pose.translation()).head<2>().squaredNorm() < radius_sq) {
+          cropped->push_back(pt);
+        }
+      }
+      hypothesis.target = cropped;
+    }
+
+    hypothesis.registration = hdl_localization::create_registration(params);
+    hypothesis.registration->setInputTarget(hypothesis.target);
+    if(status_ndt_resolution > 0.0) {
+      NdtVoxelMap::Ptr voxel_map(new NdtVoxelMap(status_ndt_resolution));
+      voxel_map->build(*hypothesis.target);
+      hypothesis.voxel_map = voxel_map;
     }
 
-    publish_odometry(points_msg->header.stamp, pose_estimator->matrix());
+    hypothesis.estimator.reset(new hdl_localization::PoseEstimator(hypothesis.registration, pose.translation(), Eigen::Quaternionf(pose.linear()), 0.0));
+    hypothesis.estimator->set_correction_budget(correction_chunk_iterations, correction_max_iterations, correction_max_time, correction_early_exit_translation, correction_early_exit_rotation);
+    hypothesis.estimator->set_square_root_filter(square_root_ukf);
+    return hypothesis;
+  }
+
+  /**
+   * @brief prune the candidate poses that fit the map clearly worse than the best one, and switch to the best one after hypothesis_scans
+   * @param aligned  scan aligned by the pose estimator
+   */
+  void select_hypothesis(const pcl::PointCloud<PointT>& aligned) {
+    estimator_inlier_fraction_sum += evaluate_alignment(aligned, pose_estimator->pos(), *registration, status_voxel_map.get()).inlier_fraction();
+    num_hypothesis_scans++;
+
+    double best = estimator_inlier_fraction_sum;
+    for(const auto& hypothesis : hypotheses) {
+      best = std::max(best, hypothesis.inlier_fraction_sum);
+    }
+
+    hypotheses.erase(std::remove_if(hypotheses.begin(), hypotheses.end(), [&](const PoseHypothesis& h) { return h.inlier_fraction_sum < best * hypothesis_prune_ratio; }), hypotheses.end());
+
+    if(num_hypothesis_scans < hypothesis_scans && !hypotheses.empty()) {
+      return;
+    }
+
+    auto found = std::max_element(hypotheses.begin(), hypotheses.end(), [](const PoseHypothesis& lhs, const PoseHypothesis& rhs) { return lhs.inlier_fraction_sum < rhs.inlier_fraction_sum; });
+    if(found != hypotheses.end() && found->inlier_fraction_sum > estimator_inlier_fraction_sum) {
+      NODELET_INFO_STREAM("switch to relocalization candidate (inlier fraction " << found->inlier_fraction_sum / num_hypothesis_scans << " vs " << estimator_inlier_fraction_sum / num_hypothesis_scans << ")");
+      pose_estimator = std::move(found->estimator);
+      if(use_submap) {
+        // the target of the candidate is the submap around it, which is used until the submap update below is built
+        registration = found->registration;
+        registration_target = found->target;
+        status_voxel_map = found->voxel_map;
+      } else {
+        pose_estimator->set_registration(registration);
+      }
+      reset_registration_tracking();
+      if(use_submap) {
+        request_submap_update(pose_estimator->pos(), true);
+      }
+    }
+    hypotheses.clear();
   }
 
   /**
    * @brief callback for globalmap input
-   * @param points_msg
+   * @note  the typed cloud is subscribed so that the map published by globalmap_server_nodelet in the same nodelet manager
+   *        is passed as a shared pointer without serialization. the cloud is shared with the publisher and must not be modified.
+   * @param cloud
    */
-  void globalmap_callback(const sensor_msgs::PointCloud2ConstPtr& points_msg) {
+  void globalmap_callback(const pcl::PointCloud<PointT>::ConstPtr& cloud) {
+    // globalmap_server_nodelet may republish the patched map after /globalmap_patch, which has already been applied
+    {
+      std::lock_guard<std::mutex> lock(globalmap_mutex);
+      if(cloud->header.stamp != 0 && cloud->header.stamp == applied_patch_stamp) {
+        NODELET_INFO("patched globalmap received (already applied)");
+        return;
+      }
+    }
+
     NODELET_INFO("globalmap received!");
-    pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
-    pcl::fromROSMsg(*points_msg, *cloud);
-    globalmap = cloud;
+    set_globalmap(cloud);
+  }
 
-    registration->setInputTarget(globalmap);
+  /**
+   * @brief callback for partial globalmap updates
+   * @note  in submap mode, only the tiles overlapping the patch are rebuilt, and the registration target is rebuilt only if
+   *        the patch overlaps the current submap. the voxel map for the status is updated only in the patched region.
+   * @param patch_msg  patch preprocessed by globalmap_server_nodelet
+   */
+  void globalmap_patch_callback(const MapPatchConstPtr& patch_msg) {
+    // with share_registration_target, the patched map object republished by globalmap_server_nodelet (if it follows) is used
+    // so that the nodelets keep sharing the target (unless /globalmap is not subscribed because the map was loaded from the cache)
+    if(!globalmap_received || (share_registration_target && patch_msg->full_map_follows && globalmap_sub)) {
+      return;
+    }
 
+    const Eigen::AlignedBox3f region(Eigen::Vector3f(patch_msg->min_pt.x, patch_msg->min_pt.y, patch_msg->min_pt.z), Eigen::Vector3f(patch_msg->max_pt.x, patch_msg->max_pt.y, patch_msg->max_pt.z));
+    pcl::PointCloud<PointT>::Ptr points(new pcl::PointCloud<PointT>());
+    pcl::fromROSMsg(patch_msg->points, *points);
+
+    // with globalmap_source TILES, the whole map may not have been assembled (or be assembled at all)
+    // the lock is held while patching so that a map set by the other callbacks in the meantime is not overwritten
+    pcl::PointCloud<PointT>::ConstPtr patched;
+    {
+      std::lock_guard<std::mutex> lock(globalmap_mutex);
+      if(globalmap) {
+        globalmap = apply_globalmap_patch(*globalmap, region, *points);
+      }
+      patched = globalmap;
+      applied_patch_stamp = pcl_conversions::toPCL(patch_msg->header.stamp);
+    }
+    NODELET_INFO_STREAM("globalmap patch received (" << points->size() << " points)");
+
+    {
+      std::lock_guard<std::mutex> lock(pose_estimator_mutex);
+      if(globalmap_tiles) {
+        globalmap_tiles = globalmap_tiles->patched(region, *points);
+        if(use_submap && submap_requested_center && globalmap_tiles->submap_overlaps(region, *submap_requested_center, submap_radius)) {
+          request_submap_update(*submap_requested_center, true, region);
+        }
+      }
+    }
+
+    if(!use_submap && patched) {
+      // the target of NDT_OMP / NDT_CUDA / GICP cannot be edited in place. the whole target is rebuilt in the background
+      NdtVoxelMap::ConstPtr base_voxel_map;
+      {
+        std::lock_guard<std::mutex> lock(pose_estimator_mutex);
+        base_voxel_map = target_builder->busy() ? nullptr : status_voxel_map;
+      }
+
+      pcl::PointCloud<PointT>::ConstPtr target = patched;
+      target_builder->request([target] { return target; }, [=](const pcl::Registration<PointT, PointT>::Ptr& reg, const pcl::PointCloud<PointT>::ConstPtr& target) {
+        swap_registration(reg, target, base_voxel_map, region);
+        NODELET_INFO("registration target updated");
+      });
+    }
+
+    if(patched) {
+      set_global_localization_map(patched);
+    }
+  }
+
+  /**
+   * @brief callback for globalmap tiles (globalmap_source TILES)
+   * @note  in submap mode, the submap is rebuilt as soon as the tiles around the sensor arrive. once all the tiles have been
+   *        received, the whole map is assembled for global localization (and as the registration target without submap mode).
+   * @param tile_msg  tile published by globalmap_server_nodelet
+   */
+  void globalmap_tile_callback(const GlobalmapTileConstPtr& tile_msg) {
+    pcl::PointCloud<PointT>::Ptr tile = decode_globalmap_tile(*tile_msg);
+    if(!tile) {
+      NODELET_WARN_STREAM("broken globalmap tile (" << tile_msg->tile_x << ", " << tile_msg->tile_y << ")");
+      return;
+    }
+
+    const std::uint64_t version = pcl_conversions::toPCL(tile_msg->header.stamp);
+    const std::uint64_t key = GlobalmapTiles::key(tile_msg->tile_x, tile_msg->tile_y);
+    const Eigen::Vector3f tile_center((tile_msg->tile_x + 0.5) * tile_msg->tile_size, (tile_msg->tile_y + 0.5) * tile_msg->tile_size, 0.0f);
+    const Eigen::AlignedBox3f tile_box(tile_center, tile_center);
+
+    pcl::PointCloud<PointT>::Ptr merged;
+    {
+      std::lock_guard<std::mutex> lock(pose_estimator_mutex);
+      last_tile_received = ros::WallTime::now();
+      if(version != globalmap_tiles_version) {
+        NODELET_INFO("receiving a new version of the globalmap tiles");
+        globalmap_tiles.reset(new GlobalmapTiles(tile_msg->tile_size));
+        globalmap_tiles_version = version;
+        globalmap_tiles_complete = false;
+        tile_request_center = boost::none;
+      }
+
+      // the tiles are published to all the subscribers, so the tiles requested by other nodelets are received as well
+      if(!globalmap_tiles || globalmap_tiles->tile(key)) {
+        return;
+      }
+      if(globalmap_tiles_radius > 0.0 && pose_estimator && !globalmap_tiles->submap_overlaps(tile_box, pose_estimator->pos(), globalmap_tiles_radius)) {
+        return;
+      }
+
+      globalmap_tiles = globalmap_tiles->with_tile(key, tile);
+      globalmap_received = true;
+
+      if(use_submap && pose_estimator && (!registration_target || globalmap_tiles->submap_overlaps(tile_box, pose_estimator->pos(), submap_radius))) {
+        request_submap_update(pose_estimator->pos(), true);
+      }
+
+      if(globalmap_tiles_radius < 0.0 && !globalmap_tiles_complete && globalmap_tiles->num_tiles() >= tile_msg->num_tiles) {
+        globalmap_tiles_complete = true;
+        merged = globalmap_tiles->merged();
+        if(!use_submap) {
+          // the tiles were only needed to assemble the map
+          globalmap_tiles.reset();
+        }
+      }
+    }
+
+    if(merged) {
+      NODELET_INFO_STREAM("all the globalmap tiles received (" << merged->size() << " points)");
+      if(use_submap) {
+        {
+          std::lock_guard<std::mutex> lock(globalmap_mutex);
+          globalmap = merged;
+        }
+        set_global_localization_map(merged);
+      } else {
+        set_globalmap(merged);
+      }
+    }
+  }
+
+  /**
+   * @brief request the tiles which have not been received (the whole map, or the tiles around the sensor)
+   */
+  void globalmap_tile_request_cb(const ros::WallTimerEvent& event) {
+    GlobalmapTileRequestPtr request(new GlobalmapTileRequest());
+    {
+      std::lock_guard<std::mutex> lock(pose_estimator_mutex);
+      if(globalmap_tiles_radius < 0.0) {
+        // wait while the tiles are being received
+        if(globalmap_tiles_complete || (ros::WallTime::now() - last_tile_received).toSec() < 1.0) {
+          return;
+        }
+        request->radius = -1.0;
+      } else {
+        if(!pose_estimator) {
+          return;
+        }
+
+        const Eigen::Vector3f pos = pose_estimator->pos();
+        const bool received = globalmap_tiles && globalmap_tiles->num_tiles();
+        if(received && tile_request_center && (*tile_request_center - pos).head<2>().norm() < submap_update_distance) {
+          return;
+        }
+        tile_request_center = pos;
+
+        request->center.x = pos.x();
+        request->center.y = pos.y();
+        request->center.z = pos.z();
+        request->radius = globalmap_tiles_radius;
+
+        // release the tiles far from the sensor
+        if(globalmap_tiles) {
+          globalmap_tiles = globalmap_tiles->subset(globalmap_tiles->keys_within(pos, 2.0 * globalmap_tiles_radius));
+        }
+      }
+
+      if(globalmap_tiles) {
+        for(const auto& key : globalmap_tiles->keys()) {
+          request->skip_tile_x.push_back(GlobalmapTiles::key_x(key));
+          request->skip_tile_y.push_back(GlobalmapTiles::key_y(key));
+        }
+      }
+    }
+
+    request->header.stamp = ros::Time::now();
+    globalmap_tile_request_pub.publish(request);
+  }
+
+  /**
+   * @brief set a new globalmap and start building the registration target
+   * @param cloud  globalmap
+   */
+  void set_globalmap(const pcl::PointCloud<PointT>::ConstPtr& cloud) {
+    {
+      std::lock_guard<std::mutex> lock(globalmap_mutex);
+      globalmap = cloud;
+    }
+    globalmap_received = true;
+
+    if(use_submap) {
+      NODELET_INFO("split globalmap into tiles");
+      GlobalmapTiles::Ptr tiles(new GlobalmapTiles(submap_tile_size));
+      tiles->insert(*cloud);
+      NODELET_INFO_STREAM(tiles->num_tiles() << " tiles created");
+
+      std::lock_guard<std::mutex> lock(pose_estimator_mutex);
+      globalmap_tiles = tiles;
+      if(pose_estimator) {
+        request_submap_update(pose_estimator->pos(), true);
+      }
+    } else {
+      pcl::PointCloud<PointT>::ConstPtr target = cloud;
+      target_builder->request([target] { return target; }, [this](const pcl::Registration<PointT, PointT>::Ptr& reg, const pcl::PointCloud<PointT>::ConstPtr& target) {
+        swap_registration(reg, target);
+        NODELET_INFO("registration target updated");
+      });
+    }
+
+    set_global_localization_map(cloud);
+  }
+
+  /**
+   * @brief send the globalmap to the global localization server
+   * @param map  globalmap (a copy of the shared pointer taken by the caller, which stays valid while the map is replaced)
+   */
+  void set_global_localization_map(const pcl::PointCloud<PointT>::ConstPtr& map) {
     if(use_global_localization) {
+      // the service request is always serialized, so this is the only copy of the map made on the localization side
       NODELET_INFO("set globalmap for global localization!");
       hdl_global_localization::SetGlobalMap srv;
-      pcl::toROSMsg(*globalmap, srv.request.global_map);
+      pcl::toROSMsg(*map, srv.request.global_map);
 
       if(!set_global_map_service.call(srv)) {
         NODELET_INFO("failed to set global map");
@@ -303,26 +1343,83 @@ private:
   }
 
   /**
-   * @brief perform global localization to relocalize the sensor position
-   * @param
+   * @brief start global localization to relocalize the sensor position
+   * @note  the query runs on the relocalization thread, and the service returns once it is started
+   * @return false if no scan has been received or a relocalization is in progress
    */
   bool relocalize(std_srvs::EmptyRequest& req, std_srvs::EmptyResponse& res) {
-    if(last_scan == nullptr) {
-      NODELET_INFO_STREAM("no scan has been received");
-      return false;
+    {
+      std::lock_guard<std::mutex> lock(relocalization_mutex);
+      if(last_scan == nullptr) {
+        NODELET_INFO_STREAM("no scan has been received");
+        return false;
+      }
+
+      if(relocalizing) {
+        NODELET_WARN_STREAM("relocalization is already in progress");
+        return false;
+      }
+
+      relocalizing = true;
+      relocalization_requested = true;
     }
+    relocalization_cv.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief relocalization thread
+   */
+  void relocalization_loop() {
+    while(true) {
+      {
+        std::unique_lock<std::mutex> lock(relocalization_mutex);
+        relocalization_cv.wait(lock, [this] { return relocalization_requested || relocalization_stop; });
+        if(relocalization_stop) {
+          return;
+        }
+        relocalization_requested = false;
+      }
 
-    relocalizing = true;
-    delta_estimater->reset();
-    pcl::PointCloud<PointT>::ConstPtr scan = last_scan;
+      if(!run_relocalization()) {
+        NODELET_INFO_STREAM("global localization failed");
+      }
+      relocalizing = false;
+    }
+  }
+
+  /**
+   * @brief query global localization with the last scan and re-seed the pose estimator with the result
+   * @note  the motion during the query is added to the result so that it corresponds to the latest scan.
+   *        with SCAN_MATCHING, a scan received after the delta estimation is drained is not accounted for (it is corrected by the next scan matching).
+   * @return true if the pose estimator was re-seeded
+   */
+  bool run_relocalization() {
+    pcl::PointCloud<PointT>::ConstPtr scan;
+    ros::Time scan_stamp;
+    {
+      std::lock_guard<std::mutex> lock(relocalization_mutex);
+      scan = last_scan;
+      scan_stamp = last_scan_stamp;
+      if(delta_estimater) {
+        delta_estimater->reset();
+        delta_estimater->add_frame(scan);
+      }
+    }
 
     hdl_global_localization::QueryGlobalLocalization srv;
     pcl::toROSMsg(*scan, srv.request.cloud);
-    srv.request.max_num_candidates = 1;
+    srv.request.max_num_candidates = relocalization_num_candidates;
 
-    if(!query_global_localization_service.call(srv) || srv.response.poses.empty()) {
-      relocalizing = false;
-      NODELET_INFO_STREAM("global localization failed");
+    // the query blocks for a while; the delta estimation runs here in the meantime
+    auto query = std::async(std::launch::async, [&] { return query_global_localization_service.call(srv); });
+    while(query.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready) {
+      if(delta_estimater) {
+        while(delta_estimater->update()) {}
+      }
+    }
+
+    if(!query.get() || srv.response.poses.empty()) {
       return false;
     }
 
@@ -334,23 +1431,128 @@ private:
     NODELET_INFO_STREAM("Error :" << srv.response.errors[0]);
     NODELET_INFO_STREAM("Inlier:" << srv.response.inlier_fractions[0]);
 
-    Eigen::Isometry3f pose = Eigen::Isometry3f::Identity();
-    pose.linear() = Eigen::Quaternionf(result.orientation.w, result.orientation.x, result.orientation.y, result.orientation.z).toRotationMatrix();
-    pose.translation() = Eigen::Vector3f(result.position.x, result.position.y, result.position.z);
-    pose = pose * delta_estimater->estimated_delta();
+    const Eigen::Isometry3f delta = relocalization_delta(scan_stamp);
+    std::vector<Eigen::Isometry3f, Eigen::aligned_allocator<Eigen::Isometry3f>> poses(srv.response.poses.size());
+    for(int i = 0; i < srv.response.poses.size(); i++) {
+      const auto& candidate = srv.response.poses[i];
+      poses[i].setIdentity();
+      poses[i].linear() = Eigen::Quaternionf(candidate.orientation.w, candidate.orientation.x, candidate.orientation.y, candidate.orientation.z).toRotationMatrix();
+      poses[i].translation() = Eigen::Vector3f(candidate.position.x, candidate.position.y, candidate.position.z);
+      poses[i] = poses[i] * delta;
+    }
+    const Eigen::Isometry3f& pose = poses[0];
+
+    // the other candidates are tracked with lightweight estimators (no cool time) until the best one is selected.
+    // their registrations are built in parallel before taking the lock
+    std::vector<PoseHypothesis> candidates(poses.size() > 1 ? poses.size() - 1 : 0);
+    if(!candidates.empty()) {
+      GlobalmapTiles::ConstPtr tiles;
+      pcl::PointCloud<PointT>::ConstPtr map;
+      {
+        std::lock_guard<std::mutex> lock(pose_estimator_mutex);
+        tiles = globalmap_tiles;
+        map = registration_target;
+      }
+
+      RegistrationParams params = registration_params();
+      params.share_target = false;
+      if(map || (use_submap && tiles)) {
+        const int num_candidates = candidates.size();
+#pragma omp parallel for schedule(dynamic, 1)
+        for(int i = 0; i < num_candidates; i++) {
+          candidates[i] = create_hypothesis(poses[i + 1], params, tiles, map);
+        }
+      } else {
+        candidates.clear();
+      }
+    }
 
     std::lock_guard<std::mutex> lock(pose_estimator_mutex);
-    pose_estimator.reset(new hdl_localization::PoseEstimator(
-      registration,
-      pose.translation(),
-      Eigen::Quaternionf(pose.linear()),
-      private_nh.param<double>("cool_time_duration", 0.5)));
+    hypotheses = std::move(candidates);
+    estimator_inlier_fraction_sum = 0.0;
+    num_hypothesis_scans = 0;
+    if(!hypotheses.empty()) {
+      NODELET_INFO_STREAM("track " << poses.size() << " relocalization candidates");
+    }
 
-    relocalizing = false;
+    if(pose_estimator) {
+      // keep the velocity, the biases, and the timing of the filter
+      pose_estimator->reset_pose(pose.translation(), Eigen::Quaternionf(pose.linear()));
+      reset_registration_tracking();
+    } else {
+      pose_estimator.reset(new hdl_localization::PoseEstimator(
+        registration,
+        pose.translation(),
+        Eigen::Quaternionf(pose.linear()),
+        private_nh.param<double>("cool_time_duration", 0.5)));
+      configure_pose_estimator();
+    }
+    if(use_submap) {
+      request_submap_update(pose.translation(), true);
+    }
 
     return true;
   }
 
+  /**
+   * @brief sensor motion from the scan given to global localization to the latest scan
+   * @param scan_stamp  timestamp of the scan given to global localization
+   */
+  Eigen::Isometry3f relocalization_delta(const ros::Time& scan_stamp) {
+    if(delta_estimater) {
+      while(delta_estimater->update()) {}
+      return delta_estimater->estimated_delta();
+    }
+
+    if(relocalization_delta_method == "ODOMETRY") {
+      ros::Time latest_stamp;
+      {
+        std::lock_guard<std::mutex> lock(relocalization_mutex);
+        latest_stamp = last_scan_stamp;
+      }
+
+      if(odom_buffer) {
+        Eigen::Isometry3d delta;
+        if(odom_buffer->delta(scan_stamp, latest_stamp, delta)) {
+          return delta.cast<float>();
+        }
+        NODELET_WARN("the robot odometry buffer does not cover the relocalization query (increase robot_odom_buffer_size)");
+        return Eigen::Isometry3f::Identity();
+      }
+
+      try {
+        geometry_msgs::TransformStamped delta = tf_buffer.lookupTransform(odom_child_frame_id, scan_stamp, odom_child_frame_id, latest_stamp, robot_odom_frame_id, ros::Duration(0.1));
+        return tf2::transformToEigen(delta).cast<float>();
+      } catch(const tf2::TransformException& e) {
+        NODELET_WARN_STREAM("failed to look up the robot odometry during relocalization: " << e.what());
+      }
+    }
+
+    return Eigen::Isometry3f::Identity();
+  }
+
+  /**
+   * @brief callback for robot odometry (robot_odom_source TOPIC)
+   * @param odom_msg  odometry of the robot
+   */
+  void robot_odom_callback(const nav_msgs::OdometryConstPtr& odom_msg) {
+    Eigen::Isometry3d pose;
+    tf::poseMsgToEigen(odom_msg->pose.pose, pose);
+
+    // the odometry of another frame (e.g., base_link while odom_child_frame_id is the lidar) is moved with the extrinsics
+    if(!odom_msg->child_frame_id.empty() && odom_msg->child_frame_id != odom_child_frame_id) {
+      Eigen::Isometry3d child2odom_child;
+      std::string tfError;
+      if(!odom_child_cache->lookup(odom_msg->child_frame_id, odom_child_frame_id, odom_msg->header.stamp, child2odom_child, &tfError)) {
+        NODELET_WARN_STREAM_THROTTLE(5.0, "robot odometry is dropped: " << tfError);
+        return;
+      }
+      pose = pose * child2odom_child;
+    }
+
+    odom_buffer->add(odom_msg->header.stamp, pose);
+  }
+
   /**
    * @brief callback for initial pose input ("2D Pose Estimate" on rviz)
    * @param pose_msg
@@ -358,6 +1560,7 @@ private:
   void initialpose_callback(const geometry_msgs::PoseWithCovarianceStampedConstPtr& pose_msg) {
     NODELET_INFO("initial pose received!!");
     std::lock_guard<std::mutex> lock(pose_estimator_mutex);
+    hypotheses.clear();
     const auto& p = pose_msg->pose.pose.position;
     const auto& q = pose_msg->pose.pose.orientation;
     pose_estimator.reset(
@@ -367,6 +1570,125 @@ private:
             Eigen::Quaternionf(q.w, q.x, q.y, q.z),
             private_nh.param<double>("cool_time_duration", 0.5))
     );
+    configure_pose_estimator();
+    if(use_submap) {
+      request_submap_update(pose_estimator->pos(), true);
+    }
+  }
+
+  /**
+   * @brief request to rebuild the registration target around the given position
+   * @note  must be called under pose_estimator_mutex
+   * @param center          submap center
+   * @param force           if false, the request is ignored while the sensor stays near the last requested center
+   * @param patched_region  if given, the submap around the same center has been patched only in this region
+   */
+  void request_submap_update(const Eigen::Vector3f& center, bool force, const boost::optional<Eigen::AlignedBox3f>& patched_region = boost::none) {
+    if(!globalmap_tiles) {
+      return;
+    }
+
+    if(!force && submap_requested_center && (*submap_requested_center - center).head<2>().norm() < submap_update_distance) {
+      return;
+    }
+    submap_requested_center = center;
+
+    // the voxel map in use can be updated only in the patched region if it is the one of the submap around the same center
+    NdtVoxelMap::ConstPtr base_voxel_map;
+    if(patched_region && !target_builder->busy()) {
+      base_voxel_map = status_voxel_map;
+    }
+
+    GlobalmapTiles::ConstPtr tiles = globalmap_tiles;
+    const double radius = submap_radius;
+    const Eigen::AlignedBox3f region = patched_region ? *patched_region : Eigen::AlignedBox3f();
+    target_builder->request([=] { return tiles->submap(center, radius); }, [=](const pcl::Registration<PointT, PointT>::Ptr& reg, const pcl::PointCloud<PointT>::ConstPtr& target) {
+      swap_registration(reg, target, base_voxel_map, region);
+      NODELET_INFO_STREAM("submap updated (center=" << center.x() << ", " << center.y() << " points=" << target->size() << ")");
+    });
+  }
+
+  /**
+   * @brief swap in a registration instance whose target has been built in the background
+   * @param reg             registration with a ready input target
+   * @param target          target cloud of the registration
+   * @param base_voxel_map  if given, the voxel map of the current target which differs from the new target only in patched_region
+   * @param patched_region  region where the new target has been patched
+   */
+  void swap_registration(const pcl::Registration<PointT, PointT>::Ptr& reg, const pcl::PointCloud<PointT>::ConstPtr& target, const NdtVoxelMap::ConstPtr& base_voxel_map = nullptr, const Eigen::AlignedBox3f& patched_region = Eigen::AlignedBox3f()) {
+    bool base_in_use = false;
+    if(base_voxel_map) {
+      std::lock_guard<std::mutex> lock(pose_estimator_mutex);
+      base_in_use = base_voxel_map == status_voxel_map;
+    }
+
+    // the voxel map for the status is built here on the worker thread as well
+    NdtVoxelMap::ConstPtr voxel_map;
+    if(status_ndt_resolution > 0.0) {
+      if(share_registration_target) {
+        voxel_map = NdtVoxelMap::build_shared(target, status_ndt_resolution);
+      } else if(base_in_use) {
+        NdtVoxelMap::Ptr updated(new NdtVoxelMap(*base_voxel_map));
+        updated->update_region(*target, patched_region);
+        voxel_map = updated;
+      } else {
+        NdtVoxelMap::Ptr built(new NdtVoxelMap(status_ndt_resolution));
+        built->build(*target);
+        voxel_map = built;
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(pose_estimator_mutex);
+    // keep skipping the coarse pyramid levels if the previous target was being tracked
+    auto new_pyramid = dynamic_cast<RegistrationPyramid*>(reg.get());
+    auto old_pyramid = dynamic_cast<RegistrationPyramid*>(registration.get());
+    if(new_pyramid && old_pyramid) {
+      new_pyramid->set_tracking(old_pyramid->is_tracking());
+    }
+
+    registration = reg;
+    registration_target = target;
+    status_voxel_map = voxel_map;
+    if(pose_estimator) {
+      pose_estimator->set_registration(registration);
+    }
+  }
+
+  /**
+   * @brief align a subsample of the target with itself, so that the first scan on a new target does not pay the lazy allocations
+   * @param reg     registration with a ready input target
+   * @param target  target cloud of the registration
+   */
+  static void warm_up_registration(const pcl::Registration<PointT, PointT>::Ptr& reg, const pcl::PointCloud<PointT>::ConstPtr& target) {
+    const size_t step = std::max<size_t>(1, target->size() / 2048);
+    pcl::PointCloud<PointT>::Ptr source(new pcl::PointCloud<PointT>());
+    source->reserve(target->size() / step + 1);
+    for(size_t i = 0; i < target->size(); i += step) {
+      source->push_back(target->at(i));
+    }
+
+    const int max_iterations = reg->getMaximumIterations();
+    reg->setMaximumIterations(1);
+    reg->setInputSource(source);
+    pcl::PointCloud<PointT> aligned;
+    reg->align(aligned);
+    reg->setMaximumIterations(max_iterations);
+  }
+
+  /**
+   * @brief change the leaf size of the preprocessing
+   * @param leaf  leaf size
+   */
+  void set_downsample_leaf(double leaf) {
+    downsample_leaf = leaf;
+    if(fused_preprocessor) {
+      fused_preprocessor->set_downsample_resolution(leaf);
+    }
+
+    auto voxelgrid = dynamic_cast<pcl::VoxelGrid<PointT>*>(downsample_filter.get());
+    if(voxelgrid) {
+      voxelgrid->setLeafSize(leaf, leaf, leaf);
+    }
   }
 
   /**
@@ -393,30 +1715,31 @@ private:
    * @param pose   odometry pose to be published
    */
   void publish_odometry(const ros::Time& stamp, const Eigen::Matrix4f& pose) {
-    // broadcast the transform over tf
-    if(tf_buffer.canTransform(robot_odom_frame_id, odom_child_frame_id, ros::Time(0))) {
-      geometry_msgs::TransformStamped map_wrt_frame = tf2::eigenToTransform(Eigen::Isometry3d(pose.inverse().cast<double>()));
-      map_wrt_frame.header.stamp = stamp;
-      map_wrt_frame.header.frame_id = odom_child_frame_id;
-      map_wrt_frame.child_frame_id = "map";
-
-      geometry_msgs::TransformStamped frame_wrt_odom = tf_buffer.lookupTransform(robot_odom_frame_id, odom_child_frame_id, ros::Time(0), ros::Duration(0.1));
-      Eigen::Matrix4f frame2odom = tf2::transformToEigen(frame_wrt_odom).cast<float>().matrix();
-
-      geometry_msgs::TransformStamped map_wrt_odom;
-      tf2::doTransform(map_wrt_frame, map_wrt_odom, frame_wrt_odom);
+    // broadcast the transform over tf (the odom frame is never waited for)
+    Eigen::Isometry3d frame2odom;
+    bool odom_available = odom_tf_cache->lookup(robot_odom_frame_id, odom_child_frame_id, stamp, frame2odom);
+    if(!odom_available && odom_tf_fallback == "LATEST") {
+      odom_available = odom_tf_cache->lookup(robot_odom_frame_id, odom_child_frame_id, ros::Time(0), frame2odom);
+    }
 
-      tf2::Transform odom_wrt_map;
-      tf2::fromMsg(map_wrt_odom.transform, odom_wrt_map);
-      odom_wrt_map = odom_wrt_map.inverse();
+    if(odom_available) {
+      const Eigen::Isometry3d odom2map = Eigen::Isometry3d(pose.cast<double>()) * frame2odom.inverse();
 
-      geometry_msgs::TransformStamped odom_trans;
-      odom_trans.transform = tf2::toMsg(odom_wrt_map);
+      geometry_msgs::TransformStamped odom_trans = tf2::eigenToTransform(odom2map);
       odom_trans.header.stamp = stamp;
       odom_trans.header.frame_id = "map";
       odom_trans.child_frame_id = robot_odom_frame_id;
 
       tf_broadcaster.sendTransform(odom_trans);
+      odom_tf_received = true;
+      last_odom_trans = odom_trans;
+    } else if(odom_tf_received) {
+      // the odom frame exists but is late: map->base_link is not broadcast, since base_link already has odom as its parent
+      NODELET_WARN_STREAM_THROTTLE(5.0, "odom tf is not available at the scan time (" << odom_tf_fallback << ")");
+      if(odom_tf_fallback == "HOLD") {
+        last_odom_trans.header.stamp = stamp;
+        tf_broadcaster.sendTransform(last_odom_trans);
+      }
     } else {
       geometry_msgs::TransformStamped odom_trans = tf2::eigenToTransform(Eigen::Isometry3d(pose.cast<double>()));
       odom_trans.header.stamp = stamp;
@@ -439,6 +1762,51 @@ private:
     pose_pub.publish(odom);
   }
 
+  /**
+   * @brief publish the propagated pose and twist (the tf is not broadcast at this rate)
+   * @param propagator
+   */
+  void publish_highrate_odometry(const PosePropagator& propagator) {
+    const Eigen::Quaternionf quat = propagator.quat();
+
+    Eigen::Isometry3d pose = Eigen::Isometry3d::Identity();
+    pose.linear() = quat.toRotationMatrix().cast<double>();
+    pose.translation() = propagator.pos().cast<double>();
+
+    nav_msgs::Odometry odom;
+    odom.header.stamp = propagator.stamp();
+    odom.header.frame_id = "map";
+    odom.child_frame_id = odom_child_frame_id;
+    tf::poseEigenToMsg(pose, odom.pose.pose);
+
+    // twist is expressed in the child frame
+    const Eigen::Vector3f linear = quat.conjugate() * propagator.vel();
+    const Eigen::Vector3f& angular = propagator.angular_velocity();
+    odom.twist.twist.linear.x = linear.x();
+    odom.twist.twist.linear.y = linear.y();
+    odom.twist.twist.linear.z = linear.z();
+    odom.twist.twist.angular.x = angular.x();
+    odom.twist.twist.angular.y = angular.y();
+    odom.twist.twist.angular.z = angular.z();
+
+    highrate_pose_pub.publish(odom);
+  }
+
+  /**
+   * @brief evaluate an aligned scan with the voxel distributions (status_method NDT) or the nearest neighbors (KDTREE) of the target
+   * @note  must be called under pose_estimator_mutex
+   * @param aligned     scan aligned to the target
+   * @param sensor_pos  sensor position
+   * @param target_registration  registration whose target search tree is used (KDTREE)
+   * @param voxel_map            voxel map of the target (NDT, nullptr for KDTREE)
+   */
+  AlignmentScore evaluate_alignment(const pcl::PointCloud<PointT>& aligned, const Eigen::Vector3f& sensor_pos, const pcl::Registration<PointT, PointT>& target_registration, const NdtVoxelMap* voxel_map) const {
+    if(voxel_map) {
+      return evaluate_alignment_ndt(aligned, sensor_pos, status_max_valid_point_dist, *voxel_map);
+    }
+    return evaluate_alignment_kdtree(aligned, sensor_pos, status_max_valid_point_dist, *target_registration.getSearchMethodTarget(), status_max_correspondence_dist);
+  }
+
   /**
    * @brief publish scan matching status information
    */
@@ -447,32 +1815,17 @@ private:
     status.header = header;
 
     status.has_converged = registration->hasConverged();
-    status.matching_error = 0.0;
 
-    const double max_correspondence_dist = private_nh.param<double>("status_max_correspondence_dist", 0.5);
-    const double max_valid_point_dist = private_nh.param<double>("status_max_valid_point_dist", 25.0);
-
-    int num_inliers = 0;
-    int num_valid_points = 0;
-    std::vector<int> k_indices;
-    std::vector<float> k_sq_dists;
-    for(int i = 0; i < aligned->size(); i++) {
-      const auto& pt = aligned->at(i);
-      if (pt.getVector3fMap().norm() > max_valid_point_dist) {
-        continue;
-      }
-      num_valid_points++;
+    const Eigen::Vector3f sensor_pos = registration->getFinalTransformation().block<3, 1>(0, 3);
+    const AlignmentScore score = evaluate_alignment(*aligned, sensor_pos, *registration, status_voxel_map.get());
 
-      registration->getSearchMethodTarget()->nearestKSearch(pt, 1, k_indices, k_sq_dists);
-      if(k_sq_dists[0] < max_correspondence_dist * max_correspondence_dist) {
-        status.matching_error += k_sq_dists[0];
-        num_inliers++;
-      }
-    }
-
-    status.matching_error /= num_inliers;
-    status.inlier_fraction = static_cast<float>(num_inliers) / std::max(1, num_valid_points);
+    status.matching_error = score.matching_error / std::max(1, score.num_inliers);
+    status.inlier_fraction = score.inlier_fraction();
+    status.transformation_probability = score.transformation_probability / std::max(1, score.num_valid_points);
     status.relative_pose = tf2::eigenToTransform(Eigen::Isometry3d(registration->getFinalTransformation().cast<double>())).transform;
+    status.num_iterations = pose_estimator->last_correction_iterations();
+    status.budget_exceeded = pose_estimator->last_correction_truncated();
+    status.num_points = registration->getInputSource() ? registration->getInputSource()->size() : 0;
 
     status.prediction_labels.reserve(2);
     status.prediction_errors.reserve(2);
@@ -497,6 +1850,18 @@ private:
       status.prediction_errors.push_back(tf2::eigenToTransform(Eigen::Isometry3d(pose_estimator->odom_prediction_error().get().cast<double>())).transform);
     }
 
+    // processing time of each stage [msec]
+    status.stage_labels.resize(stage_statistics.size());
+    status.stage_times.resize(stage_statistics.size());
+    status.stage_times_p50.resize(stage_statistics.size());
+    status.stage_times_p95.resize(stage_statistics.size());
+    for(size_t i = 0; i < stage_statistics.size(); i++) {
+      status.stage_labels[i].data = stage_statistics.label(i);
+      status.stage_times[i] = stage_statistics.latest(i);
+      status.stage_times_p50[i] = stage_statistics.percentile(i, 0.5);
+      status.stage_times_p95[i] = stage_statistics.percentile(i, 0.95);
+    }
+
     status_pub.publish(status);
   }
 
@@ -509,12 +1874,28 @@ private:
   std::string robot_odom_frame_id;
   std::string odom_child_frame_id;
 
+  double tf_wait_timeout;
+  std::unique_ptr<TransformCache> extrinsics_cache;  // sensor frame -> odom_child_frame_id
+  std::unique_ptr<TransformCache> odom_tf_cache;     // odom_child_frame_id -> robot_odom_frame_id (never waits)
+  std::unique_ptr<TransformCache> odom_child_cache;  // child frame of robot_odom_topic -> odom_child_frame_id (resolved once, never waits)
+  std::string odom_tf_fallback;
+  bool odom_tf_received;                          // accessed only on the scan thread
+  bool enable_robot_odometry_prediction;
+  std::unique_ptr<OdomBuffer> odom_buffer;          // robot_odom_callback -> predict / relocalization_delta
+  geometry_msgs::TransformStamped last_odom_trans;  // last map->odom tf (for HOLD)
+
   bool use_imu;
   bool invert_acc;
   bool invert_gyro;
+  bool imu_preintegration;
   ros::Subscriber imu_sub;
-  ros::Subscriber points_sub;
+  ros::Subscriber robot_odom_sub;
+  std::vector<ros::Subscriber> points_subs;
   ros::Subscriber globalmap_sub;
+  ros::Subscriber globalmap_patch_sub;
+  ros::Subscriber globalmap_tile_sub;
+  ros::Publisher globalmap_tile_request_pub;
+  ros::WallTimer globalmap_tile_request_timer;
   ros::Subscriber initialpose_sub;
 
   ros::Publisher pose_pub;
@@ -525,14 +1906,95 @@ private:
   tf2_ros::TransformListener tf_listener;
   tf2_ros::TransformBroadcaster tf_broadcaster;
 
-  // imu input buffer
-  std::mutex imu_data_mutex;
-  std::vector<sensor_msgs::ImuConstPtr> imu_data;
+  // imu input buffer (imu_callback -> process_scan, the consumer side is guarded by pose_estimator_mutex)
+  std::unique_ptr<SpscRingBuffer<ImuSample>> imu_buffer;
+  std::vector<ImuSample> imu_samples;  // samples taken for the current scan (reused buffer)
 
   // globalmap and registration method
-  pcl::PointCloud<PointT>::Ptr globalmap;
+  std::mutex globalmap_mutex;                   // guards globalmap and applied_patch_stamp (written by the map callbacks)
+  pcl::PointCloud<PointT>::ConstPtr globalmap;  // take a copy under globalmap_mutex before using it
+  std::uint64_t applied_patch_stamp;            // stamp of the last applied /globalmap_patch
+  std::atomic_bool globalmap_received;
   pcl::Filter<PointT>::Ptr downsample_filter;
+  double downsample_leaf;  // leaf size in use (changed only on the preprocessing side)
+  std::unique_ptr<AdaptiveDownsampling> adaptive_downsampling;
+  std::unique_ptr<FusedScanPreprocessor> fused_preprocessor;
+
+  // deskew (the motion is written by the estimation side and read by the preprocessing side under deskew_mutex)
+  std::unique_ptr<ScanDeskewer> deskewer;
+  std::string deskew_time_field;
+  std::mutex deskew_mutex;
+  std::deque<ImuSample> deskew_imu_history;  // samples of the last second (written by imu_callback)
+  std::vector<ImuSample> deskew_imu_samples;  // samples around the current scan (reused buffer of the preprocessing)
+  Eigen::Vector3f deskew_linear_velocity;     // in the base frame
+  Eigen::Vector3f deskew_angular_velocity;    // in the base frame (used without imu)
+  Eigen::Vector3f deskew_gyro_bias;
+  ros::Time deskew_last_stamp;                // accessed only on the estimation side
+  Eigen::Matrix3f deskew_last_rot;
   pcl::Registration<PointT, PointT>::Ptr registration;
+  pcl::PointCloud<PointT>::ConstPtr registration_target;  // target of the registration in use (guarded by pose_estimator_mutex)
+  NdtVoxelMap::ConstPtr status_voxel_map;                 // voxel map of registration_target for the status (guarded by pose_estimator_mutex)
+  std::unique_ptr<BackgroundTargetBuilder> target_builder;
+
+  // submap mode (guarded by pose_estimator_mutex)
+  bool use_submap;
+  double submap_tile_size;
+  double submap_radius;
+  double submap_update_distance;
+  GlobalmapTiles::ConstPtr globalmap_tiles;
+  boost::optional<Eigen::Vector3f> submap_requested_center;
+
+  // tiled globalmap input (guarded by pose_estimator_mutex)
+  bool use_globalmap_tiles;
+  double globalmap_tiles_radius;    // tiles are requested only around the sensor (the whole map if < 0)
+  std::uint64_t globalmap_tiles_version;
+  bool globalmap_tiles_complete;    // all the tiles of the current version have been received
+  ros::WallTime last_tile_received;
+  boost::optional<Eigen::Vector3f> tile_request_center;
+
+  // pipelining
+  std::thread preprocessing_thread;
+  std::thread estimation_thread;
+  std::unique_ptr<BoundedQueue<sensor_msgs::PointCloud2ConstPtr>> raw_scan_queue;
+  std::unique_ptr<BoundedQueue<PreprocessedScan::Ptr>> preprocessed_scan_queue;
+
+  // multiple lidars
+  size_t num_points_topics;
+  bool merge_scans;
+  double merge_window;
+  std::mutex preprocess_mutex;                        // the preprocessors are shared by the topics
+  std::mutex merge_mutex;
+  std::vector<PreprocessedScan::Ptr> pending_scans;  // guarded by merge_mutex
+  ros::Time last_processed_stamp;                     // guarded by pose_estimator_mutex
+
+  // scan matching status
+  double status_max_correspondence_dist;
+  double status_max_valid_point_dist;
+  double status_ndt_resolution;  // resolution of status_voxel_map (disabled if <= 0)
+  bool share_registration_target;  // the registration target and status_voxel_map are shared with the other nodelets in the process
+  std::string shared_target_id;    // identifier of the shared target map (empty: the globalmap cloud object)
+
+  // correction budget (see PoseEstimator::set_correction_budget)
+  int correction_chunk_iterations;
+  int correction_max_iterations;
+  double correction_max_time;
+  double correction_early_exit_translation;
+  double correction_early_exit_rotation;
+  bool square_root_ukf;
+
+  // processing time statistics (guarded by pose_estimator_mutex)
+  StageStatistics stage_statistics;
+
+  // high-rate pose output
+  double highrate_max_extrapolation;
+  std::thread highrate_thread;
+  std::unique_ptr<SpscRingBuffer<ImuSample>> highrate_imu_buffer;  // imu_callback -> highrate_loop
+  ros::Publisher highrate_pose_pub;
+
+  std::mutex highrate_mutex;
+  std::condition_variable highrate_cv;
+  bool highrate_stop;
+  std::unique_ptr<CorrectedState> highrate_correction;
 
   // pose estimator
   std::mutex pose_estimator_mutex;
@@ -541,9 +2003,26 @@ private:
   // global localization
   bool use_global_localization;
   std::atomic_bool relocalizing;
-  std::unique_ptr<DeltaEstimater> delta_estimater;
-
-  pcl::PointCloud<PointT>::ConstPtr last_scan;
+  std::string relocalization_delta_method;
+  std::unique_ptr<DeltaEstimater> delta_estimater;  // SCAN_MATCHING only
+
+  std::thread relocalization_thread;
+  std::mutex relocalization_mutex;
+  std::condition_variable relocalization_cv;
+  bool relocalization_requested;
+  bool relocalization_stop;
+
+  // relocalization candidates (guarded by pose_estimator_mutex)
+  int relocalization_num_candidates;
+  int hypothesis_scans;
+  double hypothesis_prune_ratio;
+  double hypothesis_target_radius;
+  std::vector<PoseHypothesis> hypotheses;
+  double estimator_inlier_fraction_sum;
+  int num_hypothesis_scans;
+
+  pcl::PointCloud<PointT>::ConstPtr last_scan;  // guarded by relocalization_mutex
+  ros::Time last_scan_stamp;
   ros::ServiceServer relocalize_server;
   ros::ServiceClient set_global_map_service;
   ros::ServiceClient query_global_localization_service;
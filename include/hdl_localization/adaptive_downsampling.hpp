@@ -0,0 +1,79 @@
+#ifndef HDL_LOCALIZATION_ADAPTIVE_DOWNSAMPLING_HPP
+#define HDL_LOCALIZATION_ADAPTIVE_DOWNSAMPLING_HPP
+
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <numeric>
+#include <algorithm>
+
+namespace hdl_localization {
+
+/**
+ * @brief controls the downsampling leaf size so that the number of points or the registration time per scan stays around a target
+ * @note  the number of points on surfaces scales with 1/leaf^2, so the leaf is multiplied by sqrt(measured / target) for each update.
+ *        the step is limited to stabilize the control, and errors within a deadband are ignored.
+ *        update() and leaf_size() may be called from different threads.
+ */
+class AdaptiveDownsampling {
+public:
+  enum class Mode { POINTS, LATENCY };
+
+  /**
+   * @brief constructor
+   * @param mode            POINTS: target number of points, LATENCY: target registration time
+   * @param target          target number of points or registration time [msec]
+   * @param initial_leaf    initial leaf size
+   * @param min_leaf        min leaf size
+   * @param max_leaf        max leaf size
+   * @param window_size     number of scans the measurements are averaged over
+   */
+  AdaptiveDownsampling(Mode mode, double target, double initial_leaf, double min_leaf, double max_leaf, int window_size = 5)
+      : mode(mode), target(target), min_leaf(min_leaf), max_leaf(max_leaf), window_size(std::max(1, window_size)), leaf(std::max(min_leaf, std::min(max_leaf, initial_leaf))) {}
+
+  /**
+   * @brief update the leaf size with the result of a scan
+   * @param num_points  number of points of the downsampled scan
+   * @param align_msec  registration time of the scan
+   */
+  void update(size_t num_points, double align_msec) {
+    std::lock_guard<std::mutex> lock(mutex);
+    measurements.push_back(mode == Mode::POINTS ? static_cast<double>(num_points) : align_msec);
+    if (measurements.size() > window_size) {
+      measurements.pop_front();
+    }
+
+    const double mean = std::accumulate(measurements.begin(), measurements.end(), 0.0) / measurements.size();
+    const double ratio = mean / target;
+    if (std::abs(ratio - 1.0) < 0.1) {
+      return;
+    }
+
+    const double scale = std::max(0.8, std::min(1.25, std::sqrt(ratio)));
+    leaf = std::max(min_leaf, std::min(max_leaf, leaf.load() * scale));
+
+    // the measurements with the previous leaf size do not represent the new one
+    measurements.clear();
+  }
+
+  /**
+   * @brief leaf size to be used for the next scan
+   */
+  double leaf_size() const { return leaf; }
+
+private:
+  const Mode mode;
+  const double target;
+  const double min_leaf;
+  const double max_leaf;
+  const size_t window_size;
+
+  std::mutex mutex;
+  std::deque<double> measurements;
+  std::atomic<double> leaf;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_ADAPTIVE_DOWNSAMPLING_HPP
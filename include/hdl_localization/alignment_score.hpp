@@ -0,0 +1,49 @@
+#ifndef HDL_LOCALIZATION_ALIGNMENT_SCORE_HPP
+#define HDL_LOCALIZATION_ALIGNMENT_SCORE_HPP
+
+#include <algorithm>
+#include <Eigen/Core>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/search/kdtree.h>
+
+#include <hdl_localization/ndt_voxel_map.hpp>
+
+namespace hdl_localization {
+
+/**
+ * @brief evaluation of an aligned scan against the registration target (the scan matching status)
+ */
+struct AlignmentScore {
+  int num_inliers;
+  int num_valid_points;
+  double matching_error;              // sum over the inliers
+  double transformation_probability;  // sum over the valid points (NDT only)
+
+  float inlier_fraction() const { return static_cast<float>(num_inliers) / std::max(1, num_valid_points); }
+};
+
+/**
+ * @brief evaluate an aligned scan with the voxel distributions of the target (status_method NDT)
+ * @note  inlier: the point is in a target voxel and within the 99% confidence region of its distribution
+ * @param aligned               scan aligned to the target
+ * @param sensor_pos            sensor position
+ * @param max_valid_point_dist  points farther than this from the sensor are not evaluated
+ * @param voxel_map             voxel map of the target
+ */
+AlignmentScore evaluate_alignment_ndt(const pcl::PointCloud<pcl::PointXYZI>& aligned, const Eigen::Vector3f& sensor_pos, double max_valid_point_dist, const NdtVoxelMap& voxel_map);
+
+/**
+ * @brief evaluate an aligned scan with the nearest neighbors in the target (status_method KDTREE)
+ * @note  inlier: the nearest target point is within max_correspondence_dist
+ * @param aligned                  scan aligned to the target
+ * @param sensor_pos               sensor position
+ * @param max_valid_point_dist     points farther than this from the sensor are not evaluated
+ * @param search                   search tree of the target
+ * @param max_correspondence_dist  max distance to the nearest target point of an inlier
+ */
+AlignmentScore evaluate_alignment_kdtree(const pcl::PointCloud<pcl::PointXYZI>& aligned, const Eigen::Vector3f& sensor_pos, double max_valid_point_dist, const pcl::search::KdTree<pcl::PointXYZI>& search, double max_correspondence_dist);
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_ALIGNMENT_SCORE_HPP
@@ -0,0 +1,135 @@
+#ifndef HDL_LOCALIZATION_BACKGROUND_TARGET_BUILDER_HPP
+#define HDL_LOCALIZATION_BACKGROUND_TARGET_BUILDER_HPP
+
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <pcl/registration/registration.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief builds registration targets on a worker thread
+ * @note  each request creates a new registration instance and hands it to the commit callback once its target is ready.
+ *        the registration in use is never touched, so the scan matching loop only waits for the pointer swap in the commit callback.
+ *        if several requests are made while a target is being built, only the latest one is processed.
+ *        with recycling, the instance retired by the last commit is reused for the next target once nobody else refers to it,
+ *        so that the buffers of the registration (e.g., the device memory of NDT_CUDA) are kept across the map updates.
+ */
+class BackgroundTargetBuilder {
+public:
+  using PointT = pcl::PointXYZI;
+  using RegistrationPtr = pcl::Registration<PointT, PointT>::Ptr;
+  using TargetSource = std::function<pcl::PointCloud<PointT>::ConstPtr()>;
+  using Commit = std::function<void(const RegistrationPtr&, const pcl::PointCloud<PointT>::ConstPtr&)>;
+  using WarmUp = std::function<void(const RegistrationPtr&, const pcl::PointCloud<PointT>::ConstPtr&)>;
+
+  /**
+   * @brief constructor
+   * @param create_registration  function to create a new registration instance
+   * @param warm_up              function called with the registration after its target is set and before the commit (optional)
+   * @param recycle              reuse the retired registration instances instead of creating new ones
+   */
+  BackgroundTargetBuilder(const std::function<RegistrationPtr()>& create_registration, const WarmUp& warm_up = WarmUp(), bool recycle = false)
+      : create_registration(create_registration), warm_up(warm_up), recycle(recycle), running(true), busy_(false) {
+    thread = std::thread(&BackgroundTargetBuilder::loop, this);
+  }
+
+  ~BackgroundTargetBuilder() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running = false;
+    }
+    cv.notify_all();
+    thread.join();
+  }
+
+  /**
+   * @brief request to build a new target
+   * @param source  function to get the target cloud (called on the worker thread)
+   * @param commit  function to swap in the registration with the built target (called on the worker thread)
+   */
+  void request(const TargetSource& source, const Commit& commit) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      pending_source = source;
+      pending_commit = commit;
+    }
+    cv.notify_one();
+  }
+
+  /**
+   * @brief true if a target is being built or waiting to be built
+   */
+  bool busy() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return busy_ || pending_source;
+  }
+
+private:
+  void loop() {
+    while (true) {
+      TargetSource source;
+      Commit commit;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return static_cast<bool>(pending_source) || !running; });
+        if (!running) {
+          return;
+        }
+        source.swap(pending_source);
+        commit.swap(pending_commit);
+        busy_ = true;
+      }
+
+      pcl::PointCloud<PointT>::ConstPtr target = source();
+      if (target && !target->empty()) {
+        // the retired instance can be reused only when the commit callback has released all the other references to it
+        RegistrationPtr registration;
+        if (retired && retired.use_count() == 1) {
+          registration.swap(retired);
+        } else {
+          registration = create_registration();
+        }
+
+        registration->setInputTarget(target);
+        if (warm_up) {
+          warm_up(registration, target);
+        }
+        commit(registration, target);
+
+        if (recycle) {
+          retired.swap(committed);
+          committed = registration;
+        }
+      }
+
+      std::lock_guard<std::mutex> lock(mutex);
+      busy_ = false;
+    }
+  }
+
+private:
+  std::function<RegistrationPtr()> create_registration;
+  WarmUp warm_up;
+  const bool recycle;
+  RegistrationPtr committed;  // instance handed to the last commit (accessed only on the worker thread)
+  RegistrationPtr retired;    // instance replaced by the last commit
+
+  mutable std::mutex mutex;
+  std::condition_variable cv;
+  std::thread thread;
+
+  bool running;
+  bool busy_;
+  TargetSource pending_source;
+  Commit pending_commit;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_BACKGROUND_TARGET_BUILDER_HPP
@@ -0,0 +1,88 @@
+#ifndef HDL_LOCALIZATION_BOUNDED_QUEUE_HPP
+#define HDL_LOCALIZATION_BOUNDED_QUEUE_HPP
+
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+
+namespace hdl_localization {
+
+/**
+ * @brief thread-safe FIFO queue with a fixed capacity
+ * @note  when the queue is full, the oldest element is dropped so that the consumer always works on recent data
+ */
+template<typename T>
+class BoundedQueue {
+public:
+  /**
+   * @brief constructor
+   * @param capacity  max number of elements
+   */
+  BoundedQueue(size_t capacity) : capacity(std::max<size_t>(1, capacity)), closed(false), num_dropped_(0) {}
+
+  /**
+   * @brief push an element
+   * @return false if the oldest element was dropped to make room
+   */
+  bool push(const T& item) {
+    bool dropped = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (queue.size() >= capacity) {
+        queue.pop_front();
+        num_dropped_++;
+        dropped = true;
+      }
+      queue.push_back(item);
+    }
+    cv.notify_one();
+    return !dropped;
+  }
+
+  /**
+   * @brief wait for and pop the oldest element
+   * @return false if the queue was closed
+   */
+  bool pop(T& item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this] { return closed || !queue.empty(); });
+    if (closed) {
+      return false;
+    }
+
+    item = queue.front();
+    queue.pop_front();
+    return true;
+  }
+
+  /**
+   * @brief wake up and stop all consumers
+   */
+  void close() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+    }
+    cv.notify_all();
+  }
+
+  size_t num_dropped() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return num_dropped_;
+  }
+
+private:
+  const size_t capacity;
+
+  mutable std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<T> queue;
+
+  bool closed;
+  size_t num_dropped_;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_BOUNDED_QUEUE_HPP
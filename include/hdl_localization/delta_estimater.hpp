@@ -4,40 +4,78 @@
 #include <mutex>
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
+#include <pcl/filters/voxel_grid.h>
 #include <pcl/registration/registration.h>
 
 namespace hdl_localization {
 
+/**
+ * @brief estimates the sensor motion during relocalization with scan-to-scan registration
+ * @note  add_frame() only stores the frame, so that the scan thread is not slowed down. update() aligns the latest stored frame
+ *        with the previous one on the caller's thread (frames stored in between are skipped).
+ */
 class DeltaEstimater {
 public:
   using PointT = pcl::PointXYZI;
 
-  DeltaEstimater(pcl::Registration<PointT, PointT>::Ptr reg): delta(Eigen::Isometry3f::Identity()), reg(reg) {}
+  /**
+   * @brief constructor
+   * @param reg                    registration method
+   * @param downsample_resolution  frames are downsampled with this voxel size before the registration (disabled if <= 0)
+   */
+  DeltaEstimater(pcl::Registration<PointT, PointT>::Ptr reg, double downsample_resolution = 0.0): delta(Eigen::Isometry3f::Identity()), reg(reg), downsample_resolution(downsample_resolution) {}
   ~DeltaEstimater() {}
 
   void reset() {
     std::lock_guard<std::mutex> lock(mutex);
     delta.setIdentity();
     last_frame.reset();
+    pending_frame.reset();
   }
 
   void add_frame(pcl::PointCloud<PointT>::ConstPtr frame) {
-    std::unique_lock<std::mutex> lock(mutex);
+    std::lock_guard<std::mutex> lock(mutex);
+    pending_frame = frame;
+  }
+
+  /**
+   * @brief align the latest frame given by add_frame() with the previous one
+   * @return false if there is no new frame
+   */
+  bool update() {
+    pcl::PointCloud<PointT>::ConstPtr frame;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      frame.swap(pending_frame);
+    }
+    if (frame == nullptr) {
+      return false;
+    }
+
+    if (downsample_resolution > 0.0) {
+      pcl::PointCloud<PointT>::Ptr filtered(new pcl::PointCloud<PointT>());
+      pcl::VoxelGrid<PointT> voxelgrid;
+      voxelgrid.setLeafSize(downsample_resolution, downsample_resolution, downsample_resolution);
+      voxelgrid.setInputCloud(frame);
+      voxelgrid.filter(*filtered);
+      frame = filtered;
+    }
+
     if (last_frame == nullptr) {
       last_frame = frame;
-      return;
+      return true;
     }
 
     reg->setInputTarget(last_frame);
     reg->setInputSource(frame);
-    lock.unlock();
 
     pcl::PointCloud<PointT> aligned;
     reg->align(aligned);
 
-    lock.lock();
+    std::lock_guard<std::mutex> lock(mutex);
     last_frame = frame;
     delta = delta * Eigen::Isometry3f(reg->getFinalTransformation());
+    return true;
   }
 
   Eigen::Isometry3f estimated_delta() const {
@@ -49,11 +87,13 @@ private:
   mutable std::mutex mutex;
   Eigen::Isometry3f delta;
   pcl::Registration<PointT, PointT>::Ptr reg;
+  const double downsample_resolution;
 
-  pcl::PointCloud<PointT>::ConstPtr last_frame;
+  pcl::PointCloud<PointT>::ConstPtr last_frame;     // accessed by update() and reset() on the same thread
+  pcl::PointCloud<PointT>::ConstPtr pending_frame;
 };
 
 } // namespace hdl_localization
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,250 @@
+#ifndef HDL_LOCALIZATION_FUSED_SCAN_PREPROCESSOR_HPP
+#define HDL_LOCALIZATION_FUSED_SCAN_PREPROCESSOR_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#include <Eigen/Core>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <sensor_msgs/PointCloud2.h>
+
+#include <hdl_localization/voxel_accumulator.hpp>
+#include <hdl_localization/scan_deskewer.hpp>
+
+namespace hdl_localization {
+
+/**
+ * @brief single-pass scan preprocessing: PointCloud2 decoding, transformation, and voxel grid downsampling
+ * @note  points are read directly from the message buffer, transformed with a 4x4 matrix-vector product (SSE-vectorized by Eigen),
+ *        and accumulated into a hashed voxel grid, so that no intermediate full-size cloud is created.
+ *        if a deskewer is given and the points have timestamps, each point is transformed with the matrix of its time instead.
+ */
+class FusedScanPreprocessor {
+public:
+  using PointT = pcl::PointXYZI;
+
+  /**
+   * @brief constructor
+   * @param downsample_resolution  voxel size (downsampling is disabled if <= 0)
+   */
+  FusedScanPreprocessor(double downsample_resolution) : downsample_resolution(downsample_resolution), accumulator(downsample_resolution > 0.0 ? downsample_resolution : 1.0), deskewed(false) {}
+
+  /**
+   * @brief change the voxel size (downsampling is disabled if <= 0)
+   */
+  void set_downsample_resolution(double downsample_resolution) {
+    this->downsample_resolution = downsample_resolution;
+    if (downsample_resolution > 0.0) {
+      accumulator.set_resolution(downsample_resolution);
+    }
+  }
+
+  double get_downsample_resolution() const { return downsample_resolution; }
+
+  /**
+   * @brief true if the points of the last scan were deskewed
+   */
+  bool last_scan_deskewed() const { return deskewed; }
+
+  /**
+   * @brief decode, transform, and downsample a scan
+   * @param msg         input scan
+   * @param transform   transformation from the message frame to the output frame
+   * @param deskewer    if given, the points are deskewed with their timestamps (the motion must have been set)
+   * @param time_field  name of the per-point time field (if empty, "time", "t", "timestamp", and "offset_time" are tried)
+   * @return preprocessed cloud (nullptr if the message doesn't have float32 x, y, z fields or its layout doesn't fit in the data)
+   */
+  pcl::PointCloud<PointT>::Ptr process(const sensor_msgs::PointCloud2& msg, const Eigen::Matrix4f& transform, ScanDeskewer* deskewer = nullptr, const std::string& time_field = "") {
+    int offset_x = -1, offset_y = -1, offset_z = -1;
+    const sensor_msgs::PointField* intensity_field = nullptr;
+    const sensor_msgs::PointField* time = nullptr;
+    for (const auto& field : msg.fields) {
+      const bool is_time_field = time_field.empty() ? (field.name == "time" || field.name == "t" || field.name == "timestamp" || field.name == "offset_time") : field.name == time_field;
+      if (is_time_field && !time) {
+        time = &field;
+      }
+
+      if (field.name == "x" && field.datatype == sensor_msgs::PointField::FLOAT32) {
+        offset_x = field.offset;
+      } else if (field.name == "y" && field.datatype == sensor_msgs::PointField::FLOAT32) {
+        offset_y = field.offset;
+      } else if (field.name == "z" && field.datatype == sensor_msgs::PointField::FLOAT32) {
+        offset_z = field.offset;
+      } else if (field.name == "intensity") {
+        intensity_field = &field;
+      }
+    }
+
+    if (offset_x < 0 || offset_y < 0 || offset_z < 0 || msg.is_bigendian) {
+      return nullptr;
+    }
+
+    // reject truncated or inconsistent messages so that the loops below never read out of the buffer
+    const size_t point_step = msg.point_step;
+    const bool layout_valid = static_cast<size_t>(msg.row_step) * msg.height <= msg.data.size() && point_step * msg.width <= msg.row_step;
+    const bool fields_valid = offset_x + sizeof(float) <= point_step && offset_y + sizeof(float) <= point_step && offset_z + sizeof(float) <= point_step;
+    if (!layout_valid || !fields_valid || (intensity_field && !field_fits(*intensity_field, point_step)) || (time && !field_fits(*time, point_step))) {
+      return nullptr;
+    }
+
+    // the time range of the scan is needed to lay out the time bins of the deskewer
+    const double stamp = msg.header.stamp.toSec();
+    deskewed = deskewer && time;
+    if (deskewed) {
+      double t_begin = std::numeric_limits<double>::max();
+      double t_end = std::numeric_limits<double>::lowest();
+      for (size_t row = 0; row < msg.height; row++) {
+        const std::uint8_t* row_data = msg.data.data() + row * msg.row_step;
+        for (size_t col = 0; col < msg.width; col++) {
+          const double t = read_time(*time, row_data + col * msg.point_step, stamp);
+          t_begin = std::min(t_begin, t);
+          t_end = std::max(t_end, t);
+        }
+      }
+      deskewer->prepare(t_begin, t_end, transform);
+    }
+
+    const size_t num_points = static_cast<size_t>(msg.width) * msg.height;
+    pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+
+    if (downsample_resolution > 0.0) {
+      accumulator.clear();
+    } else {
+      cloud->reserve(num_points);
+    }
+
+    for (size_t row = 0; row < msg.height; row++) {
+      const std::uint8_t* row_data = msg.data.data() + row * msg.row_step;
+      for (size_t col = 0; col < msg.width; col++) {
+        const std::uint8_t* point_data = row_data + col * msg.point_step;
+
+        Eigen::Vector4f pt;
+        std::memcpy(&pt[0], point_data + offset_x, sizeof(float));
+        std::memcpy(&pt[1], point_data + offset_y, sizeof(float));
+        std::memcpy(&pt[2], point_data + offset_z, sizeof(float));
+        pt[3] = 1.0f;
+        if (!std::isfinite(pt[0]) || !std::isfinite(pt[1]) || !std::isfinite(pt[2])) {
+          continue;
+        }
+
+        Eigen::Vector4f transformed = deskewed ? deskewer->transform(read_time(*time, point_data, stamp)) * pt : transform * pt;
+        transformed[3] = intensity_field ? read_intensity(*intensity_field, point_data) : 0.0f;
+
+        if (downsample_resolution > 0.0) {
+          accumulator.add(transformed);
+        } else {
+          PointT p;
+          p.getVector3fMap() = transformed.head<3>();
+          p.intensity = transformed[3];
+          cloud->push_back(p);
+        }
+      }
+    }
+
+    if (downsample_resolution > 0.0) {
+      cloud->resize(accumulator.size());
+      for (size_t i = 0; i < accumulator.size(); i++) {
+        const Eigen::Vector4f centroid = accumulator.centroid(i);
+        auto& p = cloud->at(i);
+        p.getVector3fMap() = centroid.head<3>();
+        p.intensity = centroid[3];
+      }
+    }
+
+    cloud->width = cloud->size();
+    cloud->height = 1;
+    cloud->is_dense = true;
+
+    return cloud;
+  }
+
+private:
+  /**
+   * @brief true if the field lies within a point of point_step bytes
+   */
+  static bool field_fits(const sensor_msgs::PointField& field, size_t point_step) {
+    size_t size = sizeof(float);
+    switch (field.datatype) {
+      case sensor_msgs::PointField::INT8:
+      case sensor_msgs::PointField::UINT8:
+        size = 1;
+        break;
+      case sensor_msgs::PointField::INT16:
+      case sensor_msgs::PointField::UINT16:
+        size = 2;
+        break;
+      case sensor_msgs::PointField::FLOAT64:
+        size = 8;
+        break;
+      default:
+        break;
+    }
+    return static_cast<size_t>(field.offset) + size <= point_step;
+  }
+
+  /**
+   * @brief time of a point relative to the scan stamp [sec]
+   * @note  float fields are in seconds and integer fields in nanoseconds. large values are taken as absolute times.
+   */
+  static double read_time(const sensor_msgs::PointField& field, const std::uint8_t* point_data, double stamp) {
+    const std::uint8_t* data = point_data + field.offset;
+    double t = 0.0;
+    switch (field.datatype) {
+      case sensor_msgs::PointField::FLOAT32: {
+        float value;
+        std::memcpy(&value, data, sizeof(value));
+        t = value;
+      } break;
+      case sensor_msgs::PointField::FLOAT64: {
+        std::memcpy(&t, data, sizeof(t));
+      } break;
+      case sensor_msgs::PointField::UINT32: {
+        std::uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        t = value * 1e-9;
+      } break;
+      default:
+        return 0.0;
+    }
+    return t > 1e6 ? t - stamp : t;
+  }
+
+  static float read_intensity(const sensor_msgs::PointField& field, const std::uint8_t* point_data) {
+    const std::uint8_t* data = point_data + field.offset;
+    switch (field.datatype) {
+      case sensor_msgs::PointField::FLOAT32: {
+        float value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      case sensor_msgs::PointField::FLOAT64: {
+        double value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      case sensor_msgs::PointField::UINT8:
+        return *data;
+      case sensor_msgs::PointField::UINT16: {
+        std::uint16_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+      }
+      default:
+        return 0.0f;
+    }
+  }
+
+private:
+  double downsample_resolution;
+  VoxelAccumulator accumulator;
+  bool deskewed;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_FUSED_SCAN_PREPROCESSOR_HPP
@@ -0,0 +1,45 @@
+#ifndef HDL_LOCALIZATION_GLOBALMAP_IO_HPP
+#define HDL_LOCALIZATION_GLOBALMAP_IO_HPP
+
+#include <string>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief load a globalmap pcd file, apply the UTM offset (<pcd>.utm), and downsample it
+ * @note  a binary pcd file is read with mmap block by block, and each block is offset and downsampled in parallel as it is read,
+ *        so that a map larger than the memory can be loaded. other formats are loaded as a whole with pcl.
+ * @param globalmap_pcd          pcd file path
+ * @param convert_utm_to_local   if true and <pcd>.utm exists, the map is offset by the UTM reference coordinates
+ * @param downsample_resolution  voxel grid leaf size (disabled if <= 0)
+ * @return globalmap (nullptr if the file cannot be loaded)
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr load_globalmap_pcd(const std::string& globalmap_pcd, bool convert_utm_to_local, double downsample_resolution);
+
+/**
+ * @brief save a preprocessed globalmap as a binary cache file
+ * @note  the cache consists of a fixed header followed by packed [x, y, z, intensity] float32 records, so that it can be mmapped
+ * @param cache_path             cache file path
+ * @param globalmap              preprocessed (offset and downsampled) globalmap
+ * @param source_pcd             pcd file the map was created from (its size and mtime are recorded to detect stale caches)
+ * @param convert_utm_to_local   whether the UTM offset was applied to the map
+ * @param downsample_resolution  leaf size used to downsample the map
+ * @return true if the cache was written
+ */
+bool save_globalmap_cache(const std::string& cache_path, const pcl::PointCloud<pcl::PointXYZI>& globalmap, const std::string& source_pcd, bool convert_utm_to_local, double downsample_resolution);
+
+/**
+ * @brief load a globalmap from a binary cache file
+ * @param cache_path             cache file path
+ * @param source_pcd             if not empty, the cache is rejected when it was not created from the current version of this file
+ * @param convert_utm_to_local   the cache is rejected when it was created with a different setting (1 or 0, negative to accept any)
+ * @param downsample_resolution  the cache is rejected when it was created with a different leaf size (negative to accept any)
+ * @return globalmap (nullptr if the cache does not exist or is invalid)
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr load_globalmap_cache(const std::string& cache_path, const std::string& source_pcd, int convert_utm_to_local, double downsample_resolution);
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_GLOBALMAP_IO_HPP
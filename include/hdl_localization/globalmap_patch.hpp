@@ -0,0 +1,28 @@
+#ifndef HDL_LOCALIZATION_GLOBALMAP_PATCH_HPP
+#define HDL_LOCALIZATION_GLOBALMAP_PATCH_HPP
+
+#include <Eigen/Geometry>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief replace the points of a globalmap in a box with new points
+ * @param globalmap  globalmap
+ * @param region     box to be replaced
+ * @param points     new points (points outside the box are ignored)
+ * @return patched globalmap (the input map is not modified)
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr apply_globalmap_patch(const pcl::PointCloud<pcl::PointXYZI>& globalmap, const Eigen::AlignedBox3f& region, const pcl::PointCloud<pcl::PointXYZI>& points);
+
+/**
+ * @brief points of a cloud in a box
+ * @param cloud   input cloud
+ * @param region  box
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr crop_globalmap_patch(const pcl::PointCloud<pcl::PointXYZI>& cloud, const Eigen::AlignedBox3f& region);
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_GLOBALMAP_PATCH_HPP
@@ -0,0 +1,32 @@
+#ifndef HDL_LOCALIZATION_GLOBALMAP_TILE_CODEC_HPP
+#define HDL_LOCALIZATION_GLOBALMAP_TILE_CODEC_HPP
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <hdl_localization/GlobalmapTile.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief encode the points of a globalmap tile
+ * @note  the header and num_tiles are left for the caller. if the extent of the points cannot be represented with 16bit
+ *        quantized coordinates, the tile is encoded with float32 coordinates.
+ * @param points      tile points
+ * @param tile_x      tile index
+ * @param tile_y      tile index
+ * @param tile_size   tile edge length
+ * @param resolution  quantization step of the coordinates (float32 coordinates if <= 0)
+ * @return tile message
+ */
+GlobalmapTilePtr encode_globalmap_tile(const pcl::PointCloud<pcl::PointXYZI>& points, int tile_x, int tile_y, double tile_size, double resolution);
+
+/**
+ * @brief decode the points of a globalmap tile
+ * @param tile_msg  tile message
+ * @return tile points (nullptr if the message is broken)
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr decode_globalmap_tile(const GlobalmapTile& tile_msg);
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_GLOBALMAP_TILE_CODEC_HPP
@@ -0,0 +1,115 @@
+#ifndef HDL_LOCALIZATION_GLOBALMAP_TILES_HPP
+#define HDL_LOCALIZATION_GLOBALMAP_TILES_HPP
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief globalmap split into square tiles on the xy-plane
+ * @note  tiles are never modified once they are inserted, so a submap can be assembled on a worker thread
+ *        while the tile set itself is shared as a const object
+ */
+class GlobalmapTiles {
+public:
+  using PointT = pcl::PointXYZI;
+  using Ptr = std::shared_ptr<GlobalmapTiles>;
+  using ConstPtr = std::shared_ptr<const GlobalmapTiles>;
+
+  /**
+   * @brief constructor
+   * @param tile_size  tile edge length [m]
+   */
+  GlobalmapTiles(double tile_size);
+  ~GlobalmapTiles();
+
+  /**
+   * @brief distribute the points of a cloud to the tiles
+   * @param cloud  input cloud (in the map frame)
+   */
+  void insert(const pcl::PointCloud<PointT>& cloud);
+
+  /**
+   * @brief keys of the tiles which intersect with the circle of the given radius on the xy-plane
+   * @param center  circle center
+   * @param radius  circle radius
+   */
+  std::vector<std::uint64_t> keys_within(const Eigen::Vector3f& center, double radius) const;
+
+  /**
+   * @brief assemble a submap from the tiles around the given position
+   * @param center  submap center
+   * @param radius  submap radius
+   * @return submap cloud
+   */
+  pcl::PointCloud<PointT>::Ptr submap(const Eigen::Vector3f& center, double radius) const;
+
+  /**
+   * @brief copy of the tile set with the points in a box replaced by new points
+   * @note  only the tiles overlapping the box are rebuilt. the other tiles are shared with this tile set.
+   * @param region  box to be replaced
+   * @param points  new points (points outside the box are ignored)
+   * @return patched tile set
+   */
+  Ptr patched(const Eigen::AlignedBox3f& region, const pcl::PointCloud<PointT>& points) const;
+
+  /**
+   * @brief true if the tiles overlapping a box are part of the submap around the given position
+   * @param region  box
+   * @param center  submap center
+   * @param radius  submap radius
+   */
+  bool submap_overlaps(const Eigen::AlignedBox3f& region, const Eigen::Vector3f& center, double radius) const;
+
+  /**
+   * @brief assemble the whole map from all the tiles
+   */
+  pcl::PointCloud<PointT>::Ptr merged() const;
+
+  /**
+   * @brief copy of the tile set with a tile added (or replaced)
+   * @note  the tile must not be modified after this call. the other tiles are shared with this tile set.
+   * @param key   tile key
+   * @param tile  tile points
+   */
+  Ptr with_tile(std::uint64_t key, const pcl::PointCloud<PointT>::Ptr& tile) const;
+
+  /**
+   * @brief copy of the tile set with only the given tiles (the tiles are shared with this tile set)
+   * @param keys  keys of the tiles to be kept
+   */
+  Ptr subset(const std::vector<std::uint64_t>& keys) const;
+
+  /**
+   * @brief keys of all the tiles
+   */
+  std::vector<std::uint64_t> keys() const;
+
+  /**
+   * @brief points of a tile (nullptr if the tile does not exist)
+   */
+  pcl::PointCloud<PointT>::ConstPtr tile(std::uint64_t key) const;
+
+  double tile_size() const { return tile_size_; }
+  size_t num_tiles() const { return tiles.size(); }
+
+  static std::uint64_t key(int ix, int iy) { return (static_cast<std::uint64_t>(static_cast<std::uint32_t>(ix)) << 32) | static_cast<std::uint32_t>(iy); }
+  static int key_x(std::uint64_t key) { return static_cast<std::int32_t>(key >> 32); }
+  static int key_y(std::uint64_t key) { return static_cast<std::int32_t>(key & 0xFFFFFFFF); }
+
+private:
+  const double tile_size_;
+  std::unordered_map<std::uint64_t, pcl::PointCloud<PointT>::Ptr> tiles;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_GLOBALMAP_TILES_HPP
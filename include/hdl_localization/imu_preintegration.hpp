@@ -0,0 +1,156 @@
+#ifndef HDL_LOCALIZATION_IMU_PREINTEGRATION_HPP
+#define HDL_LOCALIZATION_IMU_PREINTEGRATION_HPP
+
+#include <ros/time.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+namespace hdl_localization {
+
+/**
+ * @brief IMU measurement
+ */
+struct ImuSample {
+  ros::Time stamp;
+  Eigen::Vector3f acc;
+  Eigen::Vector3f gyro;
+};
+
+/**
+ * @brief accumulates IMU samples into a single motion delta expressed in the body frame at the first sample
+ * @note  the samples are integrated with the same discretization as PoseSystem::f(state, control) so that applying the delta
+ *        is equivalent to applying the samples one by one. the delta is computed with a fixed bias, and the first-order bias Jacobians
+ *        are kept to correct it for other biases (e.g., each sigma point of the UKF).
+ */
+class ImuPreintegration {
+public:
+  /**
+   * @brief constructor
+   * @param acc_noise   accelerometer noise density [m/s^2/sqrt(Hz)]
+   * @param gyro_noise  gyroscope noise density [rad/s/sqrt(Hz)]
+   */
+  ImuPreintegration(double acc_noise = 0.05, double gyro_noise = 0.005) : acc_noise(acc_noise), gyro_noise(gyro_noise) {
+    reset(Eigen::Vector3f::Zero(), Eigen::Vector3f::Zero());
+  }
+
+  /**
+   * @brief clear the accumulated delta
+   * @param acc_bias   accelerometer bias used for the integration
+   * @param gyro_bias  gyroscope bias used for the integration
+   */
+  void reset(const Eigen::Vector3f& acc_bias, const Eigen::Vector3f& gyro_bias) {
+    this->acc_bias = acc_bias;
+    this->gyro_bias = gyro_bias;
+
+    num_samples = 0;
+    delta_t = 0.0f;
+    delta_t2 = 0.0f;
+    delta_R.setIdentity();
+    delta_v.setZero();
+    delta_p.setZero();
+
+    dR_dbg.setZero();
+    dv_dba.setZero();
+    dv_dbg.setZero();
+    dp_dba.setZero();
+    dp_dbg.setZero();
+
+    cov.setZero();
+  }
+
+  /**
+   * @brief integrate an IMU sample
+   * @param raw_acc   acceleration
+   * @param raw_gyro  angular velocity
+   * @param dt        time elapsed since the previous sample
+   */
+  void integrate(const Eigen::Vector3f& raw_acc, const Eigen::Vector3f& raw_gyro, float dt) {
+    const Eigen::Vector3f acc = raw_acc - acc_bias;
+    const Eigen::Vector3f gyro = raw_gyro - gyro_bias;
+
+    const Eigen::Quaternionf dq = Eigen::Quaternionf(1.0f, gyro[0] * dt / 2, gyro[1] * dt / 2, gyro[2] * dt / 2).normalized();
+    const Eigen::Matrix3f dR = dq.toRotationMatrix();
+    const Eigen::Matrix3f acc_skew = skew(acc);
+
+    // covariance of [rotation, velocity, position] (the right Jacobian of the small rotation increment is approximated by identity)
+    Eigen::Matrix<float, 9, 9> A = Eigen::Matrix<float, 9, 9>::Identity();
+    A.block<3, 3>(0, 0) = dR.transpose();
+    A.block<3, 3>(3, 0) = -delta_R * acc_skew * dt;
+    A.block<3, 3>(6, 3) = Eigen::Matrix3f::Identity() * dt;
+
+    Eigen::Matrix<float, 9, 9> Q = Eigen::Matrix<float, 9, 9>::Zero();
+    Q.block<3, 3>(0, 0) = Eigen::Matrix3f::Identity() * (gyro_noise * gyro_noise * dt);
+    Q.block<3, 3>(3, 3) = Eigen::Matrix3f::Identity() * (acc_noise * acc_noise * dt);
+    cov = A * cov * A.transpose() + Q;
+
+    // bias Jacobians
+    dp_dba += dv_dba * dt;
+    dp_dbg += dv_dbg * dt;
+    dv_dba -= delta_R * dt;
+    dv_dbg -= delta_R * acc_skew * dR_dbg * dt;
+    dR_dbg = dR.transpose() * dR_dbg - Eigen::Matrix3f::Identity() * dt;
+
+    // delta (position is updated with the previous velocity as in PoseSystem)
+    delta_p += delta_v * dt;
+    delta_t2 += delta_t * dt;
+    delta_v += delta_R * acc * dt;
+    delta_R = delta_R * dR;
+    delta_t += dt;
+    num_samples++;
+  }
+
+  /**
+   * @brief delta rotation corrected for a gyroscope bias
+   */
+  Eigen::Quaternionf corrected_delta_R(const Eigen::Vector3f& gyro_bias) const {
+    const Eigen::Vector3f omega = dR_dbg * (gyro_bias - this->gyro_bias);
+    return (Eigen::Quaternionf(delta_R) * Eigen::Quaternionf(1.0f, omega[0] / 2, omega[1] / 2, omega[2] / 2)).normalized();
+  }
+
+  /**
+   * @brief delta velocity corrected for biases
+   */
+  Eigen::Vector3f corrected_delta_v(const Eigen::Vector3f& acc_bias, const Eigen::Vector3f& gyro_bias) const {
+    return delta_v + dv_dba * (acc_bias - this->acc_bias) + dv_dbg * (gyro_bias - this->gyro_bias);
+  }
+
+  /**
+   * @brief delta position corrected for biases
+   */
+  Eigen::Vector3f corrected_delta_p(const Eigen::Vector3f& acc_bias, const Eigen::Vector3f& gyro_bias) const {
+    return delta_p + dp_dba * (acc_bias - this->acc_bias) + dp_dbg * (gyro_bias - this->gyro_bias);
+  }
+
+private:
+  static Eigen::Matrix3f skew(const Eigen::Vector3f& x) {
+    Eigen::Matrix3f skew;
+    skew << 0.0f, -x[2], x[1], x[2], 0.0f, -x[0], -x[1], x[0], 0.0f;
+    return skew;
+  }
+
+public:
+  const double acc_noise;
+  const double gyro_noise;
+
+  Eigen::Vector3f acc_bias;   // biases used for the integration
+  Eigen::Vector3f gyro_bias;
+
+  int num_samples;
+  float delta_t;              // sum of dt
+  float delta_t2;             // sum of (elapsed time * dt), the coefficient of the gravity on the position
+  Eigen::Matrix3f delta_R;
+  Eigen::Vector3f delta_v;    // velocity change without gravity (in the body frame at the first sample)
+  Eigen::Vector3f delta_p;    // position change without gravity and initial velocity (in the body frame at the first sample)
+
+  Eigen::Matrix3f dR_dbg;
+  Eigen::Matrix3f dv_dba;
+  Eigen::Matrix3f dv_dbg;
+  Eigen::Matrix3f dp_dba;
+  Eigen::Matrix3f dp_dbg;
+
+  Eigen::Matrix<float, 9, 9> cov;  // covariance of [rotation, velocity, position]
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_IMU_PREINTEGRATION_HPP
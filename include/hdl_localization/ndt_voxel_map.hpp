@@ -0,0 +1,93 @@
+#ifndef HDL_LOCALIZATION_NDT_VOXEL_MAP_HPP
+#define HDL_LOCALIZATION_NDT_VOXEL_MAP_HPP
+
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief NDT representation of a map (normal distribution of the points in each voxel)
+ * @note  the same voxel model as the NDT registration, used to evaluate an aligned scan with a hash lookup per point
+ *        instead of a nearest neighbor search. a shared map is never modified once it is built (update_region() is meant
+ *        for a private copy that is shared after the update).
+ */
+class NdtVoxelMap {
+public:
+  using PointT = pcl::PointXYZI;
+  using Ptr = std::shared_ptr<NdtVoxelMap>;
+  using ConstPtr = std::shared_ptr<const NdtVoxelMap>;
+
+  /**
+   * @brief constructor
+   * @param resolution            voxel size
+   * @param min_points_per_voxel  voxels with fewer points are discarded
+   */
+  NdtVoxelMap(double resolution, int min_points_per_voxel = 6);
+  ~NdtVoxelMap();
+
+  /**
+   * @brief compute the distributions of a cloud (existing voxels are cleared)
+   * @param cloud  input cloud
+   */
+  void build(const pcl::PointCloud<PointT>& cloud);
+
+  /**
+   * @brief recompute the voxels overlapping a box from an updated cloud
+   * @note  only the voxels in the box are recomputed (the cloud is still scanned once to pick up the points in the box)
+   * @param cloud   updated cloud (the points outside the overlapping voxels are skipped)
+   * @param region  box where the cloud has been updated
+   */
+  void update_region(const pcl::PointCloud<PointT>& cloud, const Eigen::AlignedBox3f& region);
+
+  /**
+   * @brief build the voxel map of a cloud, or get the one already built for the same cloud object in this process
+   * @note  the returned map keeps the cloud alive, so that the cloud object cannot be replaced by another one at the same address
+   * @param cloud       input cloud
+   * @param resolution  voxel size
+   */
+  static ConstPtr build_shared(const pcl::PointCloud<PointT>::ConstPtr& cloud, double resolution);
+
+  /**
+   * @brief squared Mahalanobis distance between a point and the distribution of the voxel containing it
+   * @param pt  point
+   * @return squared distance (negative if the point is not in a valid voxel)
+   */
+  float mahalanobis_sq(const Eigen::Vector3f& pt) const;
+
+  double resolution() const { return resolution_; }
+  size_t num_voxels() const { return voxels.size(); }
+
+private:
+  void insert_voxels(const pcl::PointCloud<PointT>& cloud, const Eigen::AlignedBox3i* range);
+  void remove_voxel(std::uint64_t key);
+
+  std::uint64_t voxel_key(const Eigen::Vector3f& pt) const;
+  static std::uint64_t coord_key(const Eigen::Vector3i& coord);
+  static Eigen::Vector3i voxel_coord(std::uint64_t key);
+
+private:
+  struct Voxel {
+    Eigen::Vector3f mean;
+    Eigen::Matrix3f inv_cov;
+  };
+
+  const double resolution_;
+  const float inv_resolution;
+  const int min_points_per_voxel;
+
+  std::unordered_map<std::uint64_t, size_t> indices;
+  std::vector<Voxel> voxels;
+  std::vector<std::uint64_t> keys;  // key of each voxel (to move a voxel when another one is removed)
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_NDT_VOXEL_MAP_HPP
@@ -0,0 +1,126 @@
+#ifndef HDL_LOCALIZATION_ODOM_BUFFER_HPP
+#define HDL_LOCALIZATION_ODOM_BUFFER_HPP
+
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+#include <ros/time.h>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+namespace hdl_localization {
+
+/**
+ * @brief time-indexed ring buffer of robot odometry poses
+ * @note  the poses are kept in a fixed-size ring (the oldest one is overwritten when it is full), and the pose at any time in the
+ *        buffered range is interpolated between the two surrounding samples (linear for the translation, slerp for the rotation).
+ *        a lookup is a binary search over the ring, so its cost is bounded by the capacity and never waits for new data.
+ */
+class OdomBuffer {
+public:
+  /**
+   * @brief constructor
+   * @param capacity  max number of buffered poses
+   */
+  OdomBuffer(size_t capacity) : head(0), size(0), stamps(std::max<size_t>(2, capacity)), poses(std::max<size_t>(2, capacity)) {}
+
+  /**
+   * @brief add a pose
+   * @note  a pose older than the latest one is dropped
+   * @param stamp  timestamp
+   * @param pose   odometry pose (odom_child_frame_id in the odom frame)
+   */
+  void add(const ros::Time& stamp, const Eigen::Isometry3d& pose) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (size && stamp <= stamps[index(size - 1)]) {
+      return;
+    }
+
+    if (size < stamps.size()) {
+      size++;
+    } else {
+      head = (head + 1) % stamps.size();
+    }
+    stamps[index(size - 1)] = stamp;
+    poses[index(size - 1)] = pose;
+  }
+
+  /**
+   * @brief stamp of the latest pose (zero if the buffer is empty)
+   */
+  ros::Time latest_stamp() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return size ? stamps[index(size - 1)] : ros::Time(0);
+  }
+
+  /**
+   * @brief motion of the robot between two times
+   * @param from   start time
+   * @param to     end time (clamped to the latest pose if it is newer)
+   * @param delta  [out] pose at "to" in the frame of the pose at "from"
+   * @return false if "from" is out of the buffered range
+   */
+  bool delta(const ros::Time& from, const ros::Time& to, Eigen::Isometry3d& delta) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!size) {
+      return false;
+    }
+
+    Eigen::Isometry3d pose_from, pose_to;
+    if (!interpolate(from, pose_from) || !interpolate(std::min(to, stamps[index(size - 1)]), pose_to)) {
+      return false;
+    }
+
+    delta = pose_from.inverse() * pose_to;
+    return true;
+  }
+
+private:
+  size_t index(size_t i) const { return (head + i) % stamps.size(); }
+
+  bool interpolate(const ros::Time& stamp, Eigen::Isometry3d& pose) const {
+    if (stamp < stamps[index(0)] || stamp > stamps[index(size - 1)]) {
+      return false;
+    }
+
+    // the first sample newer than or equal to the stamp
+    size_t lower = 0;
+    size_t upper = size - 1;
+    while (lower < upper) {
+      const size_t mid = (lower + upper) / 2;
+      if (stamps[index(mid)] < stamp) {
+        lower = mid + 1;
+      } else {
+        upper = mid;
+      }
+    }
+
+    const size_t i1 = index(lower);
+    if (lower == 0 || stamps[i1] == stamp) {
+      pose = poses[i1];
+      return true;
+    }
+
+    const size_t i0 = index(lower - 1);
+    const double t = (stamp - stamps[i0]).toSec() / (stamps[i1] - stamps[i0]).toSec();
+    const Eigen::Quaterniond q0(poses[i0].linear());
+    const Eigen::Quaterniond q1(poses[i1].linear());
+
+    pose.setIdentity();
+    pose.linear() = q0.slerp(t, q1).toRotationMatrix();
+    pose.translation() = (1.0 - t) * poses[i0].translation() + t * poses[i1].translation();
+    return true;
+  }
+
+private:
+  mutable std::mutex mutex;
+  size_t head;
+  size_t size;
+  std::vector<ros::Time> stamps;
+  std::vector<Eigen::Isometry3d, Eigen::aligned_allocator<Eigen::Isometry3d>> poses;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_ODOM_BUFFER_HPP
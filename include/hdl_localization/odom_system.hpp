@@ -20,9 +20,17 @@ public:
   typedef Eigen::Matrix<T, Eigen::Dynamic, 1> VectorXt;
   typedef Eigen::Quaternion<T> Quaterniont;
 
+  // fixed dimensions (state, input, and measurement)
+  static const int N = 7;
+  static const int M = 7;
+  static const int K = 7;
+  typedef Eigen::Matrix<T, N, 1> VectorNt;
+  typedef Eigen::Matrix<T, M, 1> VectorMt;
+  typedef Eigen::Matrix<T, K, 1> VectorKt;
+
 public:
   // system equation
-  VectorXt f(const VectorXt& state, const VectorXt& control) const {
+  VectorNt f(const VectorNt& state, const VectorMt& control) const {
     Matrix4t pt = Matrix4t::Identity();
     pt.block<3, 1>(0, 3) = Vector3t(state[0], state[1], state[2]);
     pt.block<3, 3>(0, 0) = Quaterniont(state[3], state[4], state[5], state[6]).normalized().toRotationMatrix();
@@ -34,7 +42,7 @@ public:
     Matrix4t pt_ = pt * delta;
     Quaterniont quat_(pt_.block<3, 3>(0, 0));
 
-    VectorXt next_state(7);
+    VectorNt next_state;
     next_state.head<3>() = pt_.block<3, 1>(0, 3);
     next_state.tail<4>() = Vector4t(quat_.w(), quat_.x(), quat_.y(), quat_.z());
 
@@ -42,7 +50,7 @@ public:
   }
 
   // observation equation
-  VectorXt h(const VectorXt& state) const {
+  VectorKt h(const VectorNt& state) const {
     return state;
   }
 };
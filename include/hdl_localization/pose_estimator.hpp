@@ -2,6 +2,7 @@
 #define POSE_ESTIMATOR_HPP
 
 #include <memory>
+#include <vector>
 #include <boost/optional.hpp>
 
 #include <ros/ros.h>
@@ -9,9 +10,11 @@
 #include <pcl/point_cloud.h>
 #include <pcl/registration/registration.h>
 
+#include <hdl_localization/imu_preintegration.hpp>
+
 namespace kkl {
   namespace alg {
-template<typename T, class System> class UnscentedKalmanFilterX;
+template<typename T, class System, int N, int M, int K> class UnscentedKalmanFilter;
   }
 }
 
@@ -51,6 +54,12 @@ public:
    */
   void predict(const ros::Time& stamp, const Eigen::Vector3f& acc, const Eigen::Vector3f& gyro);
 
+  /**
+   * @brief predict with IMU samples preintegrated into a single motion delta (one UKF prediction for all the samples)
+   * @param imu_samples  IMU samples sorted by timestamp
+   */
+  void predict(const std::vector<ImuSample>& imu_samples);
+
   /**
    * @brief update the state of the odomety-based pose estimation
    */
@@ -58,18 +67,64 @@ public:
 
   /**
    * @brief correct
+   * @note  the aligned cloud written by the registration is kept for aligned_cloud() without another transformation
    * @param cloud   input cloud
-   * @return cloud aligned to the globalmap
    */
-  pcl::PointCloud<PointT>::Ptr correct(const ros::Time& stamp, const pcl::PointCloud<PointT>::ConstPtr& cloud);
+  void correct(const ros::Time& stamp, const pcl::PointCloud<PointT>::ConstPtr& cloud);
+
+  /**
+   * @brief cloud aligned to the globalmap by the last correction
+   * @note  the output of the registration in the last correction (the same cloud is returned until the next correction)
+   * @return aligned cloud (nullptr before the first correction)
+   */
+  pcl::PointCloud<PointT>::Ptr aligned_cloud();
+
+  /**
+   * @brief move the estimate to a new pose (e.g., a relocalization result) without restarting the filter
+   * @note  the velocity is rotated with the pose, and the biases and the timing of the filter are kept
+   * @param pos   new position
+   * @param quat  new orientation
+   */
+  void reset_pose(const Eigen::Vector3f& pos, const Eigen::Quaternionf& quat);
+
+  /**
+   * @brief use the square-root form of the filters
+   * @note  the covariance is kept as a Cholesky factor and the measurement noise is additive, so that each correction uses
+   *        2N+1 sigma points (33 instead of 47) and no decomposition of the full covariance
+   * @param enable  if true, the square-root form is used
+   */
+  void set_square_root_filter(bool enable);
+
+  /**
+   * @brief replace the registration method (e.g., when the target submap is switched)
+   * @param registration  registration method with a ready input target
+   */
+  void set_registration(const pcl::Registration<PointT, PointT>::Ptr& registration);
+
+  /**
+   * @brief limit the registration effort of each correction
+   * @note  the registration is run in chunks of iterations_per_chunk, each starting from the result of the previous one,
+   *        and the result of the last chunk run is used when the budget is exhausted (the fitness of the intermediate
+   *        results is not evaluated, so it is not guaranteed to be the best of the chunks)
+   * @param iterations_per_chunk  iterations of each chunk (<= 0 to disable the budgeting and run the registration at once)
+   * @param max_iterations        max total iterations (<= 0: the max iterations of the registration)
+   * @param max_time              max registration time [sec], checked between chunks (<= 0: unlimited)
+   * @param min_delta_trans       the correction stops early when a chunk moves the estimate less than this [m] (clamped to >= 1e-6)
+   * @param min_delta_rot         the correction stops early when a chunk rotates the estimate less than this [rad] (clamped to >= 1e-6)
+   */
+  void set_correction_budget(int iterations_per_chunk, int max_iterations, double max_time, double min_delta_trans, double min_delta_rot);
 
   /* getters */
   ros::Time last_correction_time() const;
+  int last_correction_iterations() const;    // total registration iterations of the last correction
+  bool last_correction_truncated() const;    // true if the last correction was stopped by the budget
 
   Eigen::Vector3f pos() const;
   Eigen::Vector3f vel() const;
   Eigen::Quaternionf quat() const;
   Eigen::Matrix4f matrix() const;
+  Eigen::Vector3f acc_bias() const;
+  Eigen::Vector3f gyro_bias() const;
 
   Eigen::Vector3f odom_pos() const;
   Eigen::Quaternionf odom_quat() const;
@@ -79,15 +134,17 @@ public:
   const boost::optional<Eigen::Matrix4f>& imu_prediction_error() const;
   const boost::optional<Eigen::Matrix4f>& odom_prediction_error() const;
 
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
 private:
   ros::Time init_stamp;             // when the estimator was initialized
   ros::Time prev_stamp;             // when the estimator was updated last time
   ros::Time last_correction_stamp;  // when the estimator performed the correction step
   double cool_time_duration;        //
 
-  Eigen::MatrixXf process_noise;
-  std::unique_ptr<kkl::alg::UnscentedKalmanFilterX<float, PoseSystem>> ukf;
-  std::unique_ptr<kkl::alg::UnscentedKalmanFilterX<float, OdomSystem>> odom_ukf;
+  Eigen::Matrix<float, 16, 16> process_noise;
+  std::unique_ptr<kkl::alg::UnscentedKalmanFilter<float, PoseSystem, 16, 6, 7>> ukf;      // state=16, input=6, measurement=7
+  std::unique_ptr<kkl::alg::UnscentedKalmanFilter<float, OdomSystem, 7, 7, 7>> odom_ukf;  // state=7, input=7, measurement=7
+  ImuPreintegration imu_preintegration;
 
   Eigen::Matrix4f last_observation;
   boost::optional<Eigen::Matrix4f> wo_pred_error;
@@ -95,6 +152,21 @@ private:
   boost::optional<Eigen::Matrix4f> odom_pred_error;
 
   pcl::Registration<PointT, PointT>::Ptr registration;
+  pcl::PointCloud<PointT>::Ptr last_aligned;  // output of the registration in the last correction (reused when it is not held)
+
+  void align(pcl::PointCloud<PointT>& aligned, const Eigen::Matrix4f& init_guess);
+
+  // correction budget
+  int correction_chunk_iterations;
+  int correction_max_iterations;
+  double correction_max_time;
+  double correction_min_delta_trans;
+  double correction_min_delta_rot;
+
+  int last_iterations;
+  bool last_truncated;
+
+  bool square_root_filter;
   };
 
 }  // namespace hdl_localization
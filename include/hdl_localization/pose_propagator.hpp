@@ -0,0 +1,116 @@
+#ifndef HDL_LOCALIZATION_POSE_PROPAGATOR_HPP
+#define HDL_LOCALIZATION_POSE_PROPAGATOR_HPP
+
+#include <deque>
+#include <ros/time.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include <hdl_localization/pose_system.hpp>
+#include <hdl_localization/imu_preintegration.hpp>
+
+namespace hdl_localization {
+
+/**
+ * @brief propagates the latest corrected state with IMU samples to provide poses at IMU rate between scan matching corrections
+ * @note  the state is propagated with the system equation of the UKF (mean only). recent samples are kept so that the state
+ *        can be re-propagated up to the latest sample when a new (older) corrected state is given.
+ */
+class PosePropagator {
+public:
+  /**
+   * @brief constructor
+   * @param max_extrapolation  max duration the state is propagated beyond the last correction [sec]
+   */
+  PosePropagator(double max_extrapolation = 1.0) : max_extrapolation(max_extrapolation), initialized(false), gyro(Eigen::Vector3f::Zero()) {}
+
+  /**
+   * @brief set a corrected state and re-propagate it with the samples received after it
+   * @param stamp      timestamp of the state
+   * @param pos        position
+   * @param vel        velocity
+   * @param quat       orientation
+   * @param acc_bias   acceleration bias
+   * @param gyro_bias  angular velocity bias
+   */
+  void reset(const ros::Time& stamp, const Eigen::Vector3f& pos, const Eigen::Vector3f& vel, const Eigen::Quaternionf& quat, const Eigen::Vector3f& acc_bias, const Eigen::Vector3f& gyro_bias) {
+    initialized = true;
+    correction_stamp = stamp;
+    state_stamp = stamp;
+    state.middleRows<3>(0) = pos;
+    state.middleRows<3>(3) = vel;
+    state.middleRows<4>(6) = Eigen::Vector4f(quat.w(), quat.x(), quat.y(), quat.z());
+    state.middleRows<3>(10) = acc_bias;
+    state.middleRows<3>(13) = gyro_bias;
+
+    while (!history.empty() && history.front().stamp <= stamp) {
+      history.pop_front();
+    }
+    for (const auto& sample : history) {
+      integrate(sample);
+    }
+  }
+
+  /**
+   * @brief propagate the state with an IMU sample
+   * @return true if the state was propagated to the sample's timestamp and is within the extrapolation limit
+   */
+  bool add(const ImuSample& sample) {
+    if (!history.empty() && sample.stamp <= history.back().stamp) {
+      return false;
+    }
+
+    history.push_back(sample);
+    while (history.size() > 1 && (sample.stamp - history.front().stamp).toSec() > max_extrapolation) {
+      history.pop_front();
+    }
+
+    if (!initialized || sample.stamp <= state_stamp) {
+      return false;
+    }
+
+    integrate(sample);
+    return (state_stamp - correction_stamp).toSec() < max_extrapolation;
+  }
+
+  /* getters */
+  const ros::Time& stamp() const { return state_stamp; }
+
+  Eigen::Vector3f pos() const { return state.middleRows<3>(0); }
+  Eigen::Vector3f vel() const { return state.middleRows<3>(3); }
+  Eigen::Quaternionf quat() const { return Eigen::Quaternionf(state[6], state[7], state[8], state[9]).normalized(); }
+
+  /**
+   * @brief bias-compensated angular velocity of the last sample
+   */
+  const Eigen::Vector3f& angular_velocity() const { return gyro; }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+private:
+  void integrate(const ImuSample& sample) {
+    system.dt = (sample.stamp - state_stamp).toSec();
+    state_stamp = sample.stamp;
+
+    PoseSystem::VectorMt control;
+    control.head<3>() = sample.acc;
+    control.tail<3>() = sample.gyro;
+    state = system.f(state, control);
+    gyro = sample.gyro - state.middleRows<3>(13);
+  }
+
+private:
+  const double max_extrapolation;
+
+  PoseSystem system;
+  bool initialized;
+  ros::Time correction_stamp;
+  ros::Time state_stamp;
+  PoseSystem::VectorNt state;
+  Eigen::Vector3f gyro;
+
+  std::deque<ImuSample> history;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_POSE_PROPAGATOR_HPP
@@ -2,6 +2,7 @@
 #define POSE_SYSTEM_HPP
 
 #include <kkl/alg/unscented_kalman_filter.hpp>
+#include <hdl_localization/imu_preintegration.hpp>
 
 namespace hdl_localization {
 
@@ -16,14 +17,22 @@ public:
   typedef Eigen::Matrix<T, 4, 4> Matrix4t;
   typedef Eigen::Matrix<T, Eigen::Dynamic, 1> VectorXt;
   typedef Eigen::Quaternion<T> Quaterniont;
+
+  // fixed dimensions (state, input, and measurement)
+  static const int N = 16;
+  static const int M = 6;
+  static const int K = 7;
+  typedef Eigen::Matrix<T, N, 1> VectorNt;
+  typedef Eigen::Matrix<T, M, 1> VectorMt;
+  typedef Eigen::Matrix<T, K, 1> VectorKt;
 public:
   PoseSystem() {
     dt = 0.01;
   }
 
   // system equation (without input)
-  VectorXt f(const VectorXt& state) const {
-    VectorXt next_state(16);
+  VectorNt f(const VectorNt& state) const {
+    VectorNt next_state;
 
     Vector3t pt = state.middleRows(0, 3);
     Vector3t vt = state.middleRows(3, 3);
@@ -50,8 +59,8 @@ public:
   }
 
   // system equation
-  VectorXt f(const VectorXt& state, const VectorXt& control) const {
-    VectorXt next_state(16);
+  VectorNt f(const VectorNt& state, const VectorMt& control) const {
+    VectorNt next_state;
 
     Vector3t pt = state.middleRows(0, 3);
     Vector3t vt = state.middleRows(3, 3);
@@ -87,9 +96,43 @@ public:
     return next_state;
   }
 
+  // system equation (with preintegrated IMU samples)
+  VectorNt f(const VectorNt& state, const ImuPreintegration& preintegration) const {
+    VectorNt next_state;
+
+    Vector3t pt = state.middleRows(0, 3);
+    Vector3t vt = state.middleRows(3, 3);
+    Quaterniont qt(state[6], state[7], state[8], state[9]);
+    qt.normalize();
+
+    Vector3t acc_bias = state.middleRows(10, 3);
+    Vector3t gyro_bias = state.middleRows(13, 3);
+
+    // the delta is corrected for the bias of each state
+    Vector3t delta_p = preintegration.corrected_delta_p(acc_bias, gyro_bias);
+    Vector3t delta_v = preintegration.corrected_delta_v(acc_bias, gyro_bias);
+    Quaterniont delta_q = preintegration.corrected_delta_R(gyro_bias);
+
+    // position
+    Vector3t g(0.0f, 0.0f, 9.80665f);
+    next_state.middleRows(0, 3) = pt + vt * preintegration.delta_t - g * preintegration.delta_t2 + qt * delta_p;
+
+    // velocity
+    next_state.middleRows(3, 3) = vt - g * preintegration.delta_t + qt * delta_v;
+
+    // orientation
+    Quaterniont qt_ = (qt * delta_q).normalized();
+    next_state.middleRows(6, 4) << qt_.w(), qt_.x(), qt_.y(), qt_.z();
+
+    next_state.middleRows(10, 3) = state.middleRows(10, 3);  // constant bias on acceleration
+    next_state.middleRows(13, 3) = state.middleRows(13, 3);  // constant bias on angular velocity
+
+    return next_state;
+  }
+
   // observation equation
-  VectorXt h(const VectorXt& state) const {
-    VectorXt observation(7);
+  VectorKt h(const VectorNt& state) const {
+    VectorKt observation;
     observation.middleRows(0, 3) = state.middleRows(0, 3);
     observation.middleRows(3, 4) = state.middleRows(6, 4).normalized();
 
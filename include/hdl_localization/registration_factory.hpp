@@ -0,0 +1,62 @@
+#ifndef HDL_LOCALIZATION_REGISTRATION_FACTORY_HPP
+#define HDL_LOCALIZATION_REGISTRATION_FACTORY_HPP
+
+#include <string>
+#include <vector>
+#include <pcl/point_types.h>
+#include <pcl/registration/registration.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief registration settings (corresponding to the hdl_localization_nodelet params)
+ */
+struct RegistrationParams {
+  RegistrationParams()
+      : reg_method("NDT_OMP"),
+        ndt_neighbor_search_method("DIRECT7"),
+        ndt_neighbor_search_radius(2.0),
+        ndt_resolution(1.0),
+        ndt_pyramid_tracking_translation(0.5),
+        ndt_pyramid_tracking_rotation(0.1),
+        share_target(false) {}
+
+  std::string reg_method;                  // NDT_OMP, NDT_CUDA_P2D, or NDT_CUDA_D2D
+  std::string ndt_neighbor_search_method;  // DIRECT1, DIRECT7, KDTREE (NDT_OMP) or DIRECT_RADIUS (NDT_CUDA)
+  double ndt_neighbor_search_radius;       // for DIRECT_RADIUS
+  double ndt_resolution;
+
+  std::vector<double> ndt_pyramid_resolutions;  // resolutions of the coarse levels run before ndt_resolution (empty to disable the pyramid)
+  double ndt_pyramid_tracking_translation;      // coarse levels are skipped while the correction is below these [m, rad]
+  double ndt_pyramid_tracking_rotation;
+
+  bool share_target;             // share the target with the other instances in the process (see SharedRegistration)
+  std::string shared_target_id;  // identifier of the target map, shared while the points are the same (empty: the target cloud object identifies the map)
+
+  std::string logger_name;  // name of the named logger of the messages (e.g., the nodelet name, empty for the default logger)
+};
+
+/**
+ * @brief create a registration method
+ * @param params  registration settings
+ * @return registration method (a RegistrationPyramid if ndt_pyramid_resolutions is given, nullptr if the method is unknown)
+ * @note   with share_target, each level is a SharedRegistration
+ */
+pcl::Registration<pcl::PointXYZI, pcl::PointXYZI>::Ptr create_registration(const RegistrationParams& params);
+
+/**
+ * @brief number of iterations of the last alignment
+ * @param registration  registration method
+ */
+int registration_num_iterations(const pcl::Registration<pcl::PointXYZI, pcl::PointXYZI>& registration);
+
+/**
+ * @brief check if the last alignment was stopped by the max iterations (rather than converged)
+ * @param registration    registration method
+ * @param max_iterations  max iterations set for the last alignment
+ */
+bool registration_reached_max_iterations(const pcl::Registration<pcl::PointXYZI, pcl::PointXYZI>& registration, int max_iterations);
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_REGISTRATION_FACTORY_HPP
@@ -0,0 +1,87 @@
+#ifndef HDL_LOCALIZATION_REGISTRATION_PYRAMID_HPP
+#define HDL_LOCALIZATION_REGISTRATION_PYRAMID_HPP
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <pcl/point_types.h>
+#include <pcl/registration/registration.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief coarse-to-fine registration with a pyramid of registration methods (e.g., NDT with 4m / 2m / 1m voxels)
+ * @note  the coarse levels are run only while the estimate is not tracking, i.e., after the estimator is (re)initialized or when
+ *        the last alignment corrected the initial guess by more than the tracking thresholds. once the fine level alone keeps
+ *        the correction small, the cost of an alignment is the same as the fine level alone.
+ *        the fine level defines the result, the iteration count, and the search method of the pyramid.
+ */
+class RegistrationPyramid : public pcl::Registration<pcl::PointXYZI, pcl::PointXYZI> {
+public:
+  using PointT = pcl::PointXYZI;
+  using Ptr = boost::shared_ptr<RegistrationPyramid>;
+  using RegistrationPtr = pcl::Registration<PointT, PointT>::Ptr;
+
+  /**
+   * @brief constructor
+   * @param coarse_levels         registration methods run before the fine level (from coarse to fine)
+   * @param fine_level            registration method of the finest level
+   * @param tracking_translation  the estimate is tracking when the last alignment moved the guess less than this [m]
+   * @param tracking_rotation     the estimate is tracking when the last alignment rotated the guess less than this [rad]
+   */
+  RegistrationPyramid(const std::vector<RegistrationPtr>& coarse_levels, const RegistrationPtr& fine_level, double tracking_translation, double tracking_rotation);
+  ~RegistrationPyramid() override;
+
+  void setInputSource(const PointCloudSourceConstPtr& cloud) override;
+  void setInputTarget(const PointCloudTargetConstPtr& cloud) override;
+
+  /**
+   * @brief force (or skip) the coarse levels of the next alignment
+   * @param tracking  if false, the next alignment runs all the levels
+   */
+  void set_tracking(bool tracking) { this->tracking = tracking; }
+  bool is_tracking() const { return tracking; }
+
+  /**
+   * @brief run only the fine level in the next alignments (e.g., the chunks following the first one of a budgeted correction)
+   * @note  the tracking state is not updated while the fine level runs alone (see update_tracking())
+   * @param fine_only  if true, the coarse levels are skipped regardless of the tracking state
+   */
+  void set_fine_only(bool fine_only) { this->fine_only = fine_only; }
+
+  /**
+   * @brief update the tracking state with the whole correction (from the initial guess to the final result)
+   * @param guess      initial guess of the correction
+   * @param result     final result of the correction
+   * @param converged  if the final alignment converged
+   */
+  void update_tracking(const Matrix4& guess, const Matrix4& result, bool converged);
+
+  /**
+   * @brief number of levels run by the last alignment
+   */
+  int num_levels_used() const { return levels_used; }
+
+  /**
+   * @brief total iterations of the coarse levels in the last alignment (not included in the iterations of the pyramid)
+   */
+  int num_coarse_iterations() const { return coarse_iterations; }
+
+protected:
+  void computeTransformation(PointCloudSource& output, const Matrix4& guess) override;
+
+private:
+  std::vector<RegistrationPtr> coarse_levels;
+  RegistrationPtr fine_level;
+
+  const double tracking_translation;
+  const double tracking_rotation;
+
+  bool tracking;
+  bool fine_only;
+  int levels_used;
+  int coarse_iterations;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_REGISTRATION_PYRAMID_HPP
@@ -0,0 +1,134 @@
+#ifndef HDL_LOCALIZATION_SCAN_DESKEWER_HPP
+#define HDL_LOCALIZATION_SCAN_DESKEWER_HPP
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include <ros/time.h>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
+
+#include <hdl_localization/imu_preintegration.hpp>
+
+namespace hdl_localization {
+
+/**
+ * @brief motion of the base frame during a scan, used to undistort the points to the scan stamp
+ * @note  the scan duration is split into fixed time bins, and the motion at the center of each bin is combined with the sensor
+ *        transformation into one 4x4 matrix. each point is then transformed with the matrix of its bin, so that deskewing costs
+ *        the same matrix-vector product as the plain transformation.
+ *        the rotation is integrated from the gyro samples (or a constant angular velocity if there is no sample), and the
+ *        translation assumes a constant linear velocity during the scan.
+ */
+class ScanDeskewer {
+public:
+  /**
+   * @brief constructor
+   * @param num_bins  number of time bins
+   */
+  ScanDeskewer(int num_bins = 128) : num_bins(num_bins), t_begin(0.0), inv_bin_duration(0.0), angular_velocity(Eigen::Vector3f::Zero()), linear_velocity(Eigen::Vector3f::Zero()) {}
+
+  /**
+   * @brief set the motion of the base frame around the scan
+   * @param imu_samples       imu samples around the scan (gyro in the base frame, sorted by stamp)
+   * @param gyro_bias         gyro bias subtracted from the samples
+   * @param angular_velocity  angular velocity used when there is no imu sample (in the base frame)
+   * @param linear_velocity   linear velocity (in the base frame)
+   * @param stamp             reference time (the points are undistorted to the base frame at this time)
+   */
+  void set_motion(const std::vector<ImuSample>& imu_samples, const Eigen::Vector3f& gyro_bias, const Eigen::Vector3f& angular_velocity, const Eigen::Vector3f& linear_velocity, const ros::Time& stamp) {
+    sample_times.resize(imu_samples.size());
+    sample_gyros.resize(imu_samples.size());
+    for (size_t i = 0; i < imu_samples.size(); i++) {
+      sample_times[i] = (imu_samples[i].stamp - stamp).toSec();
+      sample_gyros[i] = imu_samples[i].gyro - gyro_bias;
+    }
+
+    this->angular_velocity = angular_velocity;
+    this->linear_velocity = linear_velocity;
+  }
+
+  /**
+   * @brief compute the transformation of each time bin
+   * @param t_begin      time of the first point relative to the reference time [sec]
+   * @param t_end        time of the last point relative to the reference time [sec]
+   * @param sensor2base  transformation from the sensor frame to the base frame
+   */
+  void prepare(double t_begin, double t_end, const Eigen::Matrix4f& sensor2base) {
+    const double bin_duration = std::max(1e-6, (t_end - t_begin) / num_bins);
+    this->t_begin = t_begin;
+    inv_bin_duration = 1.0 / bin_duration;
+
+    transforms.resize(num_bins);
+    for (int i = 0; i < num_bins; i++) {
+      const double t = t_begin + (i + 0.5) * bin_duration;
+
+      Eigen::Isometry3f motion = Eigen::Isometry3f::Identity();
+      motion.linear() = rotation(t).toRotationMatrix();
+      motion.translation() = linear_velocity * t;
+      transforms[i] = motion.matrix() * sensor2base;
+    }
+  }
+
+  /**
+   * @brief transformation from the sensor frame at the given time to the base frame at the reference time
+   * @param t  time relative to the reference time [sec]
+   */
+  const Eigen::Matrix4f& transform(double t) const {
+    const int bin = static_cast<int>((t - t_begin) * inv_bin_duration);
+    return transforms[std::max(0, std::min(num_bins - 1, bin))];
+  }
+
+private:
+  /**
+   * @brief rotation of the base frame at time t relative to the reference time (t = 0)
+   */
+  Eigen::Quaternionf rotation(double t) const {
+    if (sample_times.empty()) {
+      return rotation_delta(angular_velocity, t);
+    }
+
+    // integrate forward over [min(0, t), max(0, t)]. the gyro is piecewise constant: each sample holds until the next sample,
+    // and the first sample also holds before its stamp
+    const double end = std::max(0.0, t);
+    Eigen::Quaternionf q = Eigen::Quaternionf::Identity();
+    for (double cur = std::min(0.0, t); cur < end;) {
+      size_t active = std::upper_bound(sample_times.begin(), sample_times.end(), cur) - sample_times.begin();
+      active = active ? active - 1 : 0;
+
+      const double next = active + 1 < sample_times.size() ? std::min(end, sample_times[active + 1]) : end;
+      q = q * rotation_delta(sample_gyros[active], next - cur);
+      cur = next;
+    }
+
+    // for t < 0, q is the rotation from t to the reference time
+    return t < 0.0 ? q.conjugate().normalized() : q.normalized();
+  }
+
+  static Eigen::Quaternionf rotation_delta(const Eigen::Vector3f& gyro, double dt) {
+    const Eigen::Vector3f theta = gyro * dt;
+    const float angle = theta.norm();
+    if (angle < 1e-9f) {
+      return Eigen::Quaternionf::Identity();
+    }
+    return Eigen::Quaternionf(Eigen::AngleAxisf(angle, theta / angle));
+  }
+
+private:
+  const int num_bins;
+  double t_begin;
+  double inv_bin_duration;
+
+  std::vector<double> sample_times;  // relative to the reference time
+  std::vector<Eigen::Vector3f, Eigen::aligned_allocator<Eigen::Vector3f>> sample_gyros;
+  Eigen::Vector3f angular_velocity;
+  Eigen::Vector3f linear_velocity;
+
+  std::vector<Eigen::Matrix4f, Eigen::aligned_allocator<Eigen::Matrix4f>> transforms;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_SCAN_DESKEWER_HPP
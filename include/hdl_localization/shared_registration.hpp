@@ -0,0 +1,68 @@
+#ifndef HDL_LOCALIZATION_SHARED_REGISTRATION_HPP
+#define HDL_LOCALIZATION_SHARED_REGISTRATION_HPP
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <functional>
+#include <boost/shared_ptr.hpp>
+#include <pcl/point_types.h>
+#include <pcl/registration/registration.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief registration whose target (e.g., the NDT voxel grid of a map) is built once per process and shared by all the instances
+ *        with the same key and target
+ * @note  the targets are kept in a process-wide cache while any instance refers to them. the alignments of the instances sharing
+ *        a target are serialized on it, while the results (final transformation, convergence, iterations) are kept per instance.
+ *        this is meant for many localization nodelets running against the same map in one nodelet manager.
+ */
+class SharedRegistration : public pcl::Registration<pcl::PointXYZI, pcl::PointXYZI> {
+public:
+  using PointT = pcl::PointXYZI;
+  using Ptr = boost::shared_ptr<SharedRegistration>;
+  using RegistrationPtr = pcl::Registration<PointT, PointT>::Ptr;
+
+  /**
+   * @brief constructor
+   * @param create_registration  function to create the registration when the target is not in the cache
+   * @param key                  registration settings (instances with different keys never share a target)
+   * @param target_id            identifier of the target cloud shared by the clouds with the same points (if empty, the target is
+   *                             identified by the cloud object itself)
+   */
+  SharedRegistration(const std::function<RegistrationPtr()>& create_registration, const std::string& key, const std::string& target_id);
+  ~SharedRegistration() override;
+
+  /**
+   * @brief find the target in the cache, or build it with a new registration (blocks while another instance is building it)
+   */
+  void setInputTarget(const PointCloudTargetConstPtr& cloud) override;
+
+  /**
+   * @brief number of instances referring to the current target
+   */
+  long num_references() const { return target.use_count(); }
+
+protected:
+  void computeTransformation(PointCloudSource& output, const Matrix4& guess) override;
+
+private:
+  struct Target {
+    std::mutex mutex;  // guards the build and the alignments
+    RegistrationPtr registration;
+  };
+
+  static std::shared_ptr<Target> find_or_create(const std::string& key);
+
+private:
+  std::function<RegistrationPtr()> create_registration;
+  const std::string key;
+  const std::string target_id;
+
+  std::shared_ptr<Target> target;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_SHARED_REGISTRATION_HPP
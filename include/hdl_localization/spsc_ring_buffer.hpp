@@ -0,0 +1,86 @@
+#ifndef HDL_LOCALIZATION_SPSC_RING_BUFFER_HPP
+#define HDL_LOCALIZATION_SPSC_RING_BUFFER_HPP
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+namespace hdl_localization {
+
+/**
+ * @brief lock-free single-producer single-consumer ring buffer
+ * @note  push() must be called from one thread at a time, and front()/pop() from one (other) thread at a time.
+ *        when the buffer is full, the new element is dropped so that the consumer never sees a partially overwritten element.
+ */
+template<typename T>
+class SpscRingBuffer {
+public:
+  /**
+   * @brief constructor
+   * @param capacity  max number of elements (rounded up to a power of two)
+   */
+  SpscRingBuffer(size_t capacity) : head(0), tail(0), num_dropped_(0) {
+    size_t size = 1;
+    while (size < capacity) {
+      size <<= 1;
+    }
+    mask = size - 1;
+    buffer.resize(size);
+  }
+
+  /**
+   * @brief push an element (producer)
+   * @return false if the buffer is full and the element was dropped
+   */
+  bool push(const T& item) {
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) > mask) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    buffer[t & mask] = item;
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief the oldest element (consumer)
+   * @return pointer to the element (nullptr if the buffer is empty), valid until pop()
+   */
+  const T* front() const {
+    const size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &buffer[h & mask];
+  }
+
+  /**
+   * @brief remove the oldest element (consumer, the buffer must not be empty)
+   */
+  void pop() {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  size_t capacity() const { return mask + 1; }
+
+  size_t size() const { return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire); }
+
+  size_t num_dropped() const { return num_dropped_.load(std::memory_order_relaxed); }
+
+private:
+  size_t mask;
+  std::vector<T> buffer;
+
+  // the indices are written by different threads and are kept on separate cache lines
+  std::atomic<size_t> head;  // next element to be read (written by the consumer)
+  char head_padding[64];
+  std::atomic<size_t> tail;  // next element to be written (written by the producer)
+  char tail_padding[64];
+  std::atomic<size_t> num_dropped_;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_SPSC_RING_BUFFER_HPP
@@ -0,0 +1,135 @@
+#ifndef HDL_LOCALIZATION_STAGE_TIMER_HPP
+#define HDL_LOCALIZATION_STAGE_TIMER_HPP
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+namespace hdl_localization {
+
+/**
+ * @brief records the duration of consecutive processing stages of a scan with a monotonic clock
+ */
+class StageStopwatch {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  struct Stage {
+    const char* label;  // must be a string literal (or outlive the stopwatch)
+    double msec;
+  };
+
+  StageStopwatch() : start_time(Clock::now()), lap_time(start_time) {
+    stages.reserve(16);
+  }
+
+  /**
+   * @brief record the time elapsed since the previous lap (or the construction) as a stage
+   * @param label  stage label
+   */
+  void lap(const char* label) {
+    const auto now = Clock::now();
+    stages.push_back(Stage{label, std::chrono::duration<double, std::milli>(now - lap_time).count()});
+    lap_time = now;
+  }
+
+  /**
+   * @brief total time since the construction [msec]
+   */
+  double elapsed_msec() const { return std::chrono::duration<double, std::milli>(Clock::now() - start_time).count(); }
+
+  const std::vector<Stage>& get_stages() const { return stages; }
+
+private:
+  Clock::time_point start_time;
+  Clock::time_point lap_time;
+  std::vector<Stage> stages;
+};
+
+/**
+ * @brief rolling statistics of stage durations over the last scans
+ */
+class StageStatistics {
+public:
+  /**
+   * @brief constructor
+   * @param window_size  number of scans the percentiles are computed over
+   */
+  StageStatistics(size_t window_size = 100) : window_size(std::max<size_t>(1, window_size)) {}
+
+  /**
+   * @brief add a stage duration
+   * @param label  stage label
+   * @param msec   duration
+   */
+  void add(const char* label, double msec) {
+    size_t i = 0;
+    while (i < stages.size() && std::strcmp(stages[i].label.c_str(), label)) {
+      i++;
+    }
+
+    if (i == stages.size()) {
+      stages.push_back(Stage());
+      stages.back().label = label;
+      // an unbounded window (e.g., the whole bag in the benchmark) grows as needed
+      stages.back().window.reserve(std::min<size_t>(window_size, 4096));
+      stages.back().next = 0;
+    }
+
+    auto& stage = stages[i];
+    stage.latest = msec;
+    if (stage.window.size() < window_size) {
+      stage.window.push_back(msec);
+    } else {
+      stage.window[stage.next] = msec;
+      stage.next = (stage.next + 1) % window_size;
+    }
+  }
+
+  /**
+   * @brief add all the stages recorded by a stopwatch
+   */
+  void add(const StageStopwatch& stopwatch) {
+    for (const auto& stage : stopwatch.get_stages()) {
+      add(stage.label, stage.msec);
+    }
+  }
+
+  size_t size() const { return stages.size(); }
+
+  const std::string& label(size_t i) const { return stages[i].label; }
+
+  /**
+   * @brief the last duration of the i-th stage [msec]
+   */
+  double latest(size_t i) const { return stages[i].latest; }
+
+  /**
+   * @brief percentile of the durations of the i-th stage in the window [msec]
+   * @param i  stage index
+   * @param p  percentile in [0, 1]
+   */
+  double percentile(size_t i, double p) const {
+    std::vector<double> sorted = stages[i].window;
+    const size_t n = std::min(sorted.size() - 1, static_cast<size_t>(p * (sorted.size() - 1) + 0.5));
+    std::nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+    return sorted[n];
+  }
+
+private:
+  struct Stage {
+    std::string label;
+    double latest;
+    std::vector<double> window;  // ring buffer of the last durations
+    size_t next;                 // oldest element once the window is full
+  };
+
+  const size_t window_size;
+  std::vector<Stage> stages;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_STAGE_TIMER_HPP
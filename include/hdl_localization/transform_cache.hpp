@@ -0,0 +1,87 @@
+#ifndef HDL_LOCALIZATION_TRANSFORM_CACHE_HPP
+#define HDL_LOCALIZATION_TRANSFORM_CACHE_HPP
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include <ros/time.h>
+#include <Eigen/Geometry>
+#include <tf2_eigen/tf2_eigen.h>
+#include <tf2_ros/buffer.h>
+
+namespace hdl_localization {
+
+/**
+ * @brief tf lookups with a bounded wait
+ * @note  with static transforms, the first transformation found between two frames is kept and returned for any time without asking
+ *        the tf buffer again (meant for the sensor extrinsics). otherwise, the transformation at the given time is looked up and the
+ *        lookup waits for it at most wait_timeout (0: never blocks).
+ */
+class TransformCache {
+public:
+  /**
+   * @brief constructor
+   * @param buffer             tf buffer
+   * @param static_transforms  if true, the transformations are resolved once and cached
+   * @param wait_timeout       max time to wait for a transformation [sec]
+   */
+  TransformCache(const tf2_ros::Buffer& buffer, bool static_transforms, double wait_timeout) : buffer(buffer), static_transforms(static_transforms), wait_timeout(wait_timeout) {}
+
+  /**
+   * @brief look up the transformation from the source frame to the target frame
+   * @param target     target frame
+   * @param source     source frame
+   * @param stamp      time of the transformation (ros::Time(0) for the latest one)
+   * @param transform  [out] transformation
+   * @param error      [out] error message (optional)
+   * @return false if the transformation is not available within the timeout
+   */
+  bool lookup(const std::string& target, const std::string& source, const ros::Time& stamp, Eigen::Isometry3d& transform, std::string* error = nullptr) {
+    if (!static_transforms) {
+      if (!buffer.canTransform(target, source, stamp, ros::Duration(wait_timeout), error)) {
+        return false;
+      }
+      transform = tf2::transformToEigen(buffer.lookupTransform(target, source, stamp, ros::Duration(0)));
+      return true;
+    }
+
+    const auto key = std::make_pair(target, source);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto found = cache.find(key);
+      if (found != cache.end()) {
+        transform = found->second;
+        return true;
+      }
+    }
+
+    // a static transformation is valid at any time, so the latest one is taken if there is one already, and the given time is
+    // waited for only if there is none
+    ros::Time time(0);
+    if (!buffer.canTransform(target, source, time, ros::Duration(0))) {
+      time = stamp;
+      if (!buffer.canTransform(target, source, time, ros::Duration(wait_timeout), error)) {
+        return false;
+      }
+    }
+    transform = tf2::transformToEigen(buffer.lookupTransform(target, source, time, ros::Duration(0)));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    cache[key] = transform;
+    return true;
+  }
+
+private:
+  const tf2_ros::Buffer& buffer;
+  const bool static_transforms;
+  const double wait_timeout;
+
+  std::mutex mutex;
+  std::map<std::pair<std::string, std::string>, Eigen::Isometry3d, std::less<std::pair<std::string, std::string>>, Eigen::aligned_allocator<std::pair<const std::pair<std::string, std::string>, Eigen::Isometry3d>>> cache;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_TRANSFORM_CACHE_HPP
@@ -0,0 +1,107 @@
+#ifndef HDL_LOCALIZATION_VOXEL_ACCUMULATOR_HPP
+#define HDL_LOCALIZATION_VOXEL_ACCUMULATOR_HPP
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include <Eigen/Core>
+#include <Eigen/StdVector>
+
+namespace hdl_localization {
+
+/**
+ * @brief hashed voxel grid which accumulates [x, y, z, intensity] and yields the centroid of each voxel
+ * @note  the same result as pcl::VoxelGrid (centroid of the points in each voxel), but points can be added one by one
+ *        without building an intermediate cloud, and the buffers are reused across clear() calls
+ */
+class VoxelAccumulator {
+public:
+  /**
+   * @brief constructor
+   * @param resolution  voxel size
+   */
+  VoxelAccumulator(double resolution) { set_resolution(resolution); }
+
+  void set_resolution(double resolution) {
+    this->resolution = resolution;
+    inv_resolution = 1.0f / resolution;
+  }
+
+  double get_resolution() const { return resolution; }
+
+  /**
+   * @brief remove all accumulated points (keeps the allocated buffers)
+   */
+  void clear() {
+    indices.clear();
+    voxels.clear();
+  }
+
+  /**
+   * @brief add a point
+   * @param pt  [x, y, z, intensity]
+   */
+  void add(const Eigen::Vector4f& pt) {
+    const Eigen::Array3i coord = (pt.head<3>() * inv_resolution).array().floor().cast<int>();
+    const std::uint64_t key = voxel_key(coord);
+
+    auto found = indices.find(key);
+    if (found == indices.end()) {
+      found = indices.insert(std::make_pair(key, voxels.size())).first;
+      voxels.push_back(Voxel{Eigen::Vector4f::Zero(), 0});
+    }
+
+    voxels[found->second].sum += pt;
+    voxels[found->second].num++;
+  }
+
+  /**
+   * @brief merge another accumulator with the same resolution
+   */
+  void merge(const VoxelAccumulator& other) {
+    for (const auto& index : other.indices) {
+      const auto& voxel = other.voxels[index.second];
+      auto found = indices.find(index.first);
+      if (found == indices.end()) {
+        indices.insert(std::make_pair(index.first, voxels.size()));
+        voxels.push_back(voxel);
+      } else {
+        voxels[found->second].sum += voxel.sum;
+        voxels[found->second].num += voxel.num;
+      }
+    }
+  }
+
+  size_t size() const { return voxels.size(); }
+
+  /**
+   * @brief centroid [x, y, z, intensity] of the i-th voxel (in the order of insertion)
+   */
+  Eigen::Vector4f centroid(size_t i) const { return voxels[i].sum / static_cast<float>(voxels[i].num); }
+
+private:
+  // 21 bits for each axis (about +-100km at 0.1m resolution)
+  static std::uint64_t voxel_key(const Eigen::Array3i& coord) {
+    const std::uint64_t mask = (1 << 21) - 1;
+    return ((static_cast<std::uint64_t>(coord[0]) & mask) << 42) | ((static_cast<std::uint64_t>(coord[1]) & mask) << 21) | (static_cast<std::uint64_t>(coord[2]) & mask);
+  }
+
+private:
+  struct Voxel {
+    Eigen::Vector4f sum;
+    int num;
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  };
+
+  double resolution;
+  float inv_resolution;
+
+  std::unordered_map<std::uint64_t, size_t> indices;
+  std::vector<Voxel, Eigen::aligned_allocator<Voxel>> voxels;
+};
+
+}  // namespace hdl_localization
+
+#endif  // HDL_LOCALIZATION_VOXEL_ACCUMULATOR_HPP
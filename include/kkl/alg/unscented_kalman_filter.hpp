@@ -280,6 +280,380 @@ public:
   std::normal_distribution<T> normal_dist;
 };
 
+
+/**
+ * @brief Unscented Kalman Filter class with compile-time dimensions
+ * @note  the same algorithm as UnscentedKalmanFilterX, but all the vectors and matrices are fixed-size,
+ *        so that predict() and correct() do not allocate memory and can be vectorized.
+ *        optionally runs in the square-root form (see setSquareRoot())
+ * @param T        scaler type
+ * @param System   system class to be estimated
+ * @param N        state vector dimension
+ * @param M        input vector dimension
+ * @param K        measurement vector dimension
+ */
+template<typename T, class System, int N, int M, int K>
+class UnscentedKalmanFilter {
+public:
+  static const int S = 2 * N + 1;            // number of sigma points
+  static const int NK = N + K;               // extended state dimension
+  static const int SK = 2 * (N + K) + 1;     // number of extended sigma points
+
+  typedef Eigen::Matrix<T, N, 1> VectorNt;
+  typedef Eigen::Matrix<T, M, 1> VectorMt;
+  typedef Eigen::Matrix<T, K, 1> VectorKt;
+  typedef Eigen::Matrix<T, N, N> MatrixNt;
+  typedef Eigen::Matrix<T, K, K> MatrixKt;
+
+  typedef Eigen::Matrix<T, NK, 1> VectorNKt;
+  typedef Eigen::Matrix<T, NK, NK> MatrixNKt;
+
+  /**
+   * @brief constructor
+   * @param system               system to be estimated
+   * @param process_noise        process noise covariance (N x N)
+   * @param measurement_noise    measurement noise covariance (K x K)
+   * @param mean                 initial mean
+   * @param cov                  initial covariance
+   */
+  UnscentedKalmanFilter(const System& system, const MatrixNt& process_noise, const MatrixKt& measurement_noise, const VectorNt& mean, const MatrixNt& cov)
+    : mean(mean),
+    cov(cov),
+    system(system),
+    process_noise(process_noise),
+    measurement_noise(measurement_noise),
+    lambda(1),
+    square_root(false)
+  {
+    // initialize weights for unscented filter
+    weights[0] = lambda / (N + lambda);
+    for (int i = 1; i < S; i++) {
+      weights[i] = 1 / (2 * (N + lambda));
+    }
+
+    // weights for extended state space which includes error variances
+    ext_weights[0] = lambda / (N + K + lambda);
+    for (int i = 1; i < SK; i++) {
+      ext_weights[i] = 1 / (2 * (N + K + lambda));
+    }
+  }
+
+  /**
+   * @brief predict
+   */
+  void predict() {
+    stateSigmaPoints();
+    for (int i = 0; i < S; i++) {
+      sigma_points.col(i) = system.f(sigma_points.col(i));
+    }
+    unscentedTransform();
+  }
+
+  /**
+   * @brief predict
+   * @param control  input vector (or any other control type accepted by System::f)
+   */
+  template<typename Control>
+  void predict(const Control& control) {
+    stateSigmaPoints();
+    for (int i = 0; i < S; i++) {
+      sigma_points.col(i) = system.f(sigma_points.col(i), control);
+    }
+    unscentedTransform();
+  }
+
+  /**
+   * @brief correct
+   * @param measurement  measurement vector
+   */
+  void correct(const VectorKt& measurement) {
+    if (square_root) {
+      correctSquareRoot(measurement);
+      return;
+    }
+
+    // create extended state space which includes error variances
+    VectorNKt ext_mean_pred = VectorNKt::Zero();
+    MatrixNKt ext_cov_pred = MatrixNKt::Zero();
+    ext_mean_pred.template head<N>() = mean;
+    ext_cov_pred.template topLeftCorner<N, N>() = cov;
+    ext_cov_pred.template bottomRightCorner<K, K>() = measurement_noise;
+
+    computeSigmaPoints(ext_mean_pred, ext_cov_pred, ext_sigma_points);
+
+    // unscented transform
+    for (int i = 0; i < SK; i++) {
+      expected_measurements.col(i) = system.h(ext_sigma_points.col(i).template head<N>()) + ext_sigma_points.col(i).template tail<K>();
+    }
+
+    const VectorKt expected_measurement_mean = expected_measurements * ext_weights;
+    MatrixKt expected_measurement_cov = MatrixKt::Zero();
+    for (int i = 0; i < SK; i++) {
+      const VectorKt diff = expected_measurements.col(i) - expected_measurement_mean;
+      expected_measurement_cov += ext_weights[i] * diff * diff.transpose();
+    }
+
+    // calculated transformed covariance
+    Eigen::Matrix<T, NK, K> sigma = Eigen::Matrix<T, NK, K>::Zero();
+    for (int i = 0; i < SK; i++) {
+      const VectorNKt diffA = ext_sigma_points.col(i) - ext_mean_pred;
+      const VectorKt diffB = expected_measurements.col(i) - expected_measurement_mean;
+      sigma += ext_weights[i] * (diffA * diffB.transpose());
+    }
+
+    kalman_gain = sigma * expected_measurement_cov.inverse();
+    const auto& G = kalman_gain;
+
+    const VectorNKt ext_mean = ext_mean_pred + G * (measurement - expected_measurement_mean);
+    const MatrixNKt ext_cov = ext_cov_pred - G * expected_measurement_cov * G.transpose();
+
+    mean = ext_mean.template head<N>();
+    cov = ext_cov.template topLeftCorner<N, N>();
+  }
+
+  /*			getter			*/
+  const VectorNt& getMean() const { return mean; }
+  const MatrixNt& getCov() const { return cov; }
+
+  System& getSystem() { return system; }
+  const System& getSystem() const { return system; }
+  const MatrixNt& getProcessNoiseCov() const { return process_noise; }
+  const MatrixKt& getMeasurementNoiseCov() const { return measurement_noise; }
+
+  const Eigen::Matrix<T, NK, K>& getKalmanGain() const { return kalman_gain; }
+
+  /*			setter			*/
+  UnscentedKalmanFilter& setMean(const VectorNt& m) { mean = m;			return *this; }
+  UnscentedKalmanFilter& setCov(const MatrixNt& s) { cov = s; updateFactors(); return *this; }
+
+  UnscentedKalmanFilter& setProcessNoiseCov(const MatrixNt& p) { process_noise = p; updateProcessNoiseFactor(); return *this; }
+  UnscentedKalmanFilter& setMeasurementNoiseCov(const MatrixKt& m) { measurement_noise = m; updateFactors(); return *this; }
+
+  /**
+   * @brief enable the square-root form
+   * @note  the filter keeps the Cholesky factor of the covariance. predict() propagates the factor with a QR decomposition of the
+   *        weighted sigma point deviations and the factor of the process noise, and correct() takes the sigma points from the factor
+   *        and updates it with a QR decomposition and rank-1 downdates, so that the covariance is never decomposed after setCov().
+   *        the process noise is factorized when it is set (a square root of the diagonal for a diagonal matrix). the measurement noise is added to the predicted measurement covariance instead of being augmented
+   *        into the state, so that correct() uses the 2N+1 sigma points of predict().
+   *        cov is still updated after each step, but must be changed with setCov() in this form
+   * @param enable  if true, the square-root form is used
+   */
+  UnscentedKalmanFilter& setSquareRoot(bool enable) { square_root = enable; updateFactors(); return *this; }
+
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+public:
+  VectorNt mean;
+  MatrixNt cov;
+
+  System system;
+  MatrixNt process_noise;
+  MatrixKt measurement_noise;
+
+  T lambda;
+
+  // square-root form (lower-triangular factors of cov, process_noise, and measurement_noise)
+  bool square_root;
+  MatrixNt cov_sqrt;
+  MatrixNt process_noise_sqrt;
+  MatrixKt measurement_noise_sqrt;
+  Eigen::Matrix<T, S, 1> weights;
+  Eigen::Matrix<T, N, S> sigma_points;            // each column is a sigma point
+
+  Eigen::Matrix<T, SK, 1> ext_weights;
+  Eigen::Matrix<T, NK, SK> ext_sigma_points;
+  Eigen::Matrix<T, K, SK> expected_measurements;
+
+  Eigen::Matrix<T, NK, K> kalman_gain;
+
+private:
+  /**
+   * @brief mean and covariance of the propagated sigma points
+   */
+  void unscentedTransform() {
+    const VectorNt mean_pred = sigma_points * weights;
+
+    if (square_root) {
+      // cov_pred = A^T * A with A = [sqrt(w_i) * (x_i - mean_pred)^T; sqrt(process_noise)^T] (the weights are positive with lambda > 0),
+      // so that the factor of cov_pred is the R factor of the QR decomposition of A
+      Eigen::Matrix<T, S + N, N> compound;
+      for (int i = 0; i < S; i++) {
+        compound.row(i) = std::sqrt(weights[i]) * (sigma_points.col(i) - mean_pred).transpose();
+      }
+      compound.template bottomRows<N>() = process_noise_sqrt.transpose();
+
+      mean = mean_pred;
+      cov_sqrt = lowerFactor<S + N, N>(compound);
+      cov.noalias() = cov_sqrt * cov_sqrt.transpose();
+      return;
+    }
+
+    MatrixNt cov_pred = MatrixNt::Zero();
+    for (int i = 0; i < S; i++) {
+      const VectorNt diff = sigma_points.col(i) - mean_pred;
+      cov_pred += weights[i] * diff * diff.transpose();
+    }
+    cov_pred += process_noise;
+
+    mean = mean_pred;
+    cov = cov_pred;
+  }
+
+  /**
+   * @brief correct in the square-root form with additive measurement noise
+   * @param measurement  measurement vector
+   */
+  void correctSquareRoot(const VectorKt& measurement) {
+    stateSigmaPoints();
+
+    Eigen::Matrix<T, K, S> expected;
+    for (int i = 0; i < S; i++) {
+      expected.col(i) = system.h(sigma_points.col(i));
+    }
+    const VectorKt expected_measurement_mean = expected * weights;
+
+    // factor of the measurement covariance and the cross covariance
+    Eigen::Matrix<T, S + K, K> compound;
+    Eigen::Matrix<T, K, S> weighted_diffs;
+    for (int i = 0; i < S; i++) {
+      const VectorKt diff = expected.col(i) - expected_measurement_mean;
+      compound.row(i) = std::sqrt(weights[i]) * diff.transpose();
+      weighted_diffs.col(i) = weights[i] * diff;
+    }
+    compound.template bottomRows<K>() = measurement_noise_sqrt.transpose();
+
+    Eigen::Matrix<T, N, K> sigma;
+    sigma.noalias() = (sigma_points.colwise() - mean) * weighted_diffs.transpose();
+    const MatrixKt sz = lowerFactor<S + K, K>(compound);
+
+    // gain = sigma * (sz * sz^T)^-1 with two triangular solves
+    Eigen::Matrix<T, K, N> gain_t = sz.template triangularView<Eigen::Lower>().solve(sigma.transpose());
+    sz.transpose().template triangularView<Eigen::Upper>().solveInPlace(gain_t);
+    kalman_gain.template topRows<N>() = gain_t.transpose();
+    kalman_gain.template bottomRows<K>().setZero();
+    const Eigen::Matrix<T, N, K> G = gain_t.transpose();
+
+    mean = mean + G * (measurement - expected_measurement_mean);
+
+    // cov = cov - U * U^T with U = G * sz, applied as rank-1 downdates of the factor
+    const Eigen::Matrix<T, N, K> U = G * sz;
+    MatrixNt downdated = cov_sqrt;
+    bool success = true;
+    for (int k = 0; k < K && success; k++) {
+      success = choleskyDowndate(downdated, U.col(k));
+    }
+
+    if (success) {
+      cov_sqrt = downdated;
+      cov = cov_sqrt * cov_sqrt.transpose();
+    } else {
+      // the downdate lost the positive-definiteness due to rounding errors. the factor is recomputed from the covariance
+      cov = cov - U * U.transpose();
+      cov_sqrt = Eigen::LLT<MatrixNt>(cov).matrixL();
+    }
+  }
+
+  /**
+   * @brief sigma points of the current state
+   */
+  void stateSigmaPoints() {
+    if (square_root) {
+      const MatrixNt l = std::sqrt(N + lambda) * cov_sqrt;
+      sigma_points.col(0) = mean;
+      for (int i = 0; i < N; i++) {
+        sigma_points.col(1 + i * 2) = mean + l.col(i);
+        sigma_points.col(1 + i * 2 + 1) = mean - l.col(i);
+      }
+    } else {
+      computeSigmaPoints(mean, cov, sigma_points);
+    }
+  }
+
+  /**
+   * @brief update the factors of the square-root form after the covariance or the measurement noise is changed
+   */
+  void updateFactors() {
+    if (square_root) {
+      cov_sqrt = Eigen::LLT<MatrixNt>(cov).matrixL();
+      measurement_noise_sqrt = Eigen::LLT<MatrixKt>(measurement_noise).matrixL();
+    }
+    updateProcessNoiseFactor();
+  }
+
+  /**
+   * @brief update the factor of the process noise in the square-root form
+   */
+  void updateProcessNoiseFactor() {
+    if (!square_root) {
+      return;
+    }
+
+    if (process_noise.isDiagonal(T(0))) {
+      process_noise_sqrt = process_noise.diagonal().cwiseMax(T(0)).cwiseSqrt().asDiagonal();
+    } else {
+      process_noise_sqrt = Eigen::LLT<MatrixNt>(process_noise).matrixL();
+    }
+  }
+
+  /**
+   * @brief lower-triangular L with L * L^T = A^T * A (from the QR decomposition of A)
+   * @param compound  A
+   */
+  template<int R, int D>
+  static Eigen::Matrix<T, D, D> lowerFactor(const Eigen::Matrix<T, R, D>& compound) {
+    Eigen::HouseholderQR<Eigen::Matrix<T, R, D>> qr(compound);
+    Eigen::Matrix<T, D, D> l = qr.matrixQR().template topRows<D>().template triangularView<Eigen::Upper>().toDenseMatrix().transpose();
+
+    // the column signs do not change L * L^T. they are flipped to get a positive diagonal for the downdates
+    for (int i = 0; i < D; i++) {
+      if (l(i, i) < 0) {
+        l.col(i) = -l.col(i);
+      }
+    }
+    return l;
+  }
+
+  /**
+   * @brief rank-1 downdate of a lower-triangular factor (l * l^T -> l * l^T - x * x^T)
+   * @return false if the result is not positive-definite (l is then left in an undefined state)
+   */
+  static bool choleskyDowndate(MatrixNt& l, VectorNt x) {
+    for (int k = 0; k < N; k++) {
+      const T r2 = l(k, k) * l(k, k) - x[k] * x[k];
+      if (!(r2 > 0)) {
+        return false;
+      }
+
+      const T r = std::sqrt(r2);
+      const T c = r / l(k, k);
+      const T s = x[k] / l(k, k);
+      l(k, k) = r;
+      for (int i = k + 1; i < N; i++) {
+        l(i, k) = (l(i, k) - s * x[i]) / c;
+        x[i] = c * x[i] - s * l(i, k);
+      }
+    }
+    return true;
+  }
+
+  /**
+   * @brief compute sigma points
+   * @param mean          mean
+   * @param cov           covariance
+   * @param sigma_points  calculated sigma points (each column is a sigma point)
+   */
+  template<int D>
+  void computeSigmaPoints(const Eigen::Matrix<T, D, 1>& mean, const Eigen::Matrix<T, D, D>& cov, Eigen::Matrix<T, D, 2 * D + 1>& sigma_points) {
+    Eigen::LLT<Eigen::Matrix<T, D, D>> llt((D + lambda) * cov);
+    const Eigen::Matrix<T, D, D> l = llt.matrixL();
+
+    sigma_points.col(0) = mean;
+    for (int i = 0; i < D; i++) {
+      sigma_points.col(1 + i * 2) = mean + l.col(i);
+      sigma_points.col(1 + i * 2 + 1) = mean - l.col(i);
+    }
+  }
+};
   }
 }
 
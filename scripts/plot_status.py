@@ -43,21 +43,37 @@ class Plotter(object):
 
 				errors[label.data].append((t, t_error, r_error))
 
+		stage_times = {}
+		for status in self.status_buffer:
+			t = status.header.stamp.secs + status.header.stamp.nsecs / 1e9
+			for label, stage_time in zip(status.stage_labels, status.stage_times):
+				if label.data not in stage_times:
+					stage_times[label.data] = []
+				stage_times[label.data].append((t, stage_time))
+
 		pyplot.clf()
 		for label in errors:
 			errs = numpy.float64(errors[label])
-			pyplot.subplot('211')
+			pyplot.subplot('311')
 			pyplot.plot(errs[:, 0], errs[:, 1], label=label)
 
-			pyplot.subplot('212')
+			pyplot.subplot('312')
 			pyplot.plot(errs[:, 0], errs[:, 2], label=label)
 
-		pyplot.subplot('211')
+		pyplot.subplot('311')
 		pyplot.ylabel('trans error')
-		pyplot.subplot('212')
+		pyplot.subplot('312')
 		pyplot.ylabel('rot error')
 
 		pyplot.legend(loc='upper center', bbox_to_anchor=(0.5, -0.05), ncol=len(errors))
+
+		pyplot.subplot('313')
+		for label in stage_times:
+			times = numpy.float64(stage_times[label])
+			pyplot.plot(times[:, 0], times[:, 1], label=label)
+		pyplot.ylabel('time [msec]')
+		if len(stage_times):
+			pyplot.legend(loc='upper left', fontsize='small', ncol=len(stage_times))
 		pyplot.gcf().canvas.flush_events()
 		# pyplot.pause(0.0001)
 
@@ -0,0 +1,88 @@
+#include <hdl_localization/alignment_score.hpp>
+
+#include <cmath>
+#include <vector>
+
+namespace hdl_localization {
+
+/**
+ * @brief evaluate an aligned scan with the voxel distributions of the target (status_method NDT)
+ * @note  inlier: the point is in a target voxel and within the 99% confidence region of its distribution
+ * @param aligned               scan aligned to the target
+ * @param sensor_pos            sensor position
+ * @param max_valid_point_dist  points farther than this from the sensor are not evaluated
+ * @param voxel_map             voxel map of the target
+ */
+AlignmentScore evaluate_alignment_ndt(const pcl::PointCloud<pcl::PointXYZI>& aligned, const Eigen::Vector3f& sensor_pos, double max_valid_point_dist, const NdtVoxelMap& voxel_map) {
+  // 99% quantile of the chi-squared distribution with 3 dof
+  const float max_mahalanobis_sq = 11.345f;
+  const float max_valid_point_dist_sq = max_valid_point_dist * max_valid_point_dist;
+
+  const int num_points = aligned.size();
+  int num_inliers = 0;
+  int num_valid_points = 0;
+  double matching_error = 0.0;
+  double transformation_probability = 0.0;
+#pragma omp parallel for reduction(+ : num_inliers, num_valid_points, matching_error, transformation_probability) schedule(guided, 64)
+  for (int i = 0; i < num_points; i++) {
+    const Eigen::Vector3f pt = aligned.at(i).getVector3fMap();
+    if ((pt - sensor_pos).squaredNorm() > max_valid_point_dist_sq) {
+      continue;
+    }
+    num_valid_points++;
+
+    const float mahalanobis_sq = voxel_map.mahalanobis_sq(pt);
+    if (mahalanobis_sq < 0.0f) {
+      continue;
+    }
+
+    transformation_probability += std::exp(-0.5 * mahalanobis_sq);
+    if (mahalanobis_sq < max_mahalanobis_sq) {
+      matching_error += mahalanobis_sq;
+      num_inliers++;
+    }
+  }
+
+  return AlignmentScore{num_inliers, num_valid_points, matching_error, transformation_probability};
+}
+
+/**
+ * @brief evaluate an aligned scan with the nearest neighbors in the target (status_method KDTREE)
+ * @note  inlier: the nearest target point is within max_correspondence_dist
+ * @param aligned                  scan aligned to the target
+ * @param sensor_pos               sensor position
+ * @param max_valid_point_dist     points farther than this from the sensor are not evaluated
+ * @param search                   search tree of the target
+ * @param max_correspondence_dist  max distance to the nearest target point of an inlier
+ */
+AlignmentScore evaluate_alignment_kdtree(const pcl::PointCloud<pcl::PointXYZI>& aligned, const Eigen::Vector3f& sensor_pos, double max_valid_point_dist, const pcl::search::KdTree<pcl::PointXYZI>& search, double max_correspondence_dist) {
+  const float max_valid_point_dist_sq = max_valid_point_dist * max_valid_point_dist;
+  const double max_correspondence_dist_sq = max_correspondence_dist * max_correspondence_dist;
+
+  const int num_points = aligned.size();
+  int num_inliers = 0;
+  int num_valid_points = 0;
+  double matching_error = 0.0;
+#pragma omp parallel reduction(+ : num_inliers, num_valid_points, matching_error)
+  {
+    std::vector<int> k_indices(1);
+    std::vector<float> k_sq_dists(1);
+#pragma omp for schedule(guided, 64)
+    for (int i = 0; i < num_points; i++) {
+      const auto& pt = aligned.at(i);
+      if ((pt.getVector3fMap() - sensor_pos).squaredNorm() > max_valid_point_dist_sq) {
+        continue;
+      }
+      num_valid_points++;
+
+      if (search.nearestKSearch(pt, 1, k_indices, k_sq_dists) && k_sq_dists[0] < max_correspondence_dist_sq) {
+        matching_error += k_sq_dists[0];
+        num_inliers++;
+      }
+    }
+  }
+
+  return AlignmentScore{num_inliers, num_valid_points, matching_error, 0.0};
+}
+
+}  // namespace hdl_localization
@@ -0,0 +1,516 @@
+#include <hdl_localization/globalmap_io.hpp>
+
+#include <cmath>
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <ros/console.h>
+#include <pcl/io/pcd_io.h>
+#include <pcl/filters/voxel_grid.h>
+
+namespace hdl_localization {
+
+namespace {
+
+const char kCacheMagic[8] = {'H', 'D', 'L', 'M', 'A', 'P', '\0', '\0'};
+const std::uint32_t kCacheVersion = 2;
+
+struct GlobalmapCacheHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t point_stride;  // bytes per point record
+  std::uint64_t num_points;
+  double downsample_resolution;
+  std::uint64_t source_size;  // size of the source pcd file
+  std::int64_t source_mtime;  // modification time of the source pcd file
+  std::uint32_t convert_utm_to_local;
+  std::uint32_t reserved;
+};
+
+struct GlobalmapCachePoint {
+  float x;
+  float y;
+  float z;
+  float intensity;
+};
+
+bool file_stat(const std::string& path, std::uint64_t& size, std::int64_t& mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  size = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+}
+
+/**
+ * @brief layout of a pcd file with "DATA binary"
+ */
+struct BinaryPcdLayout {
+  struct Field {
+    int offset;  // byte offset in a point record (negative if the field does not exist)
+    char type;   // F, U, or I
+    int size;    // bytes
+  };
+
+  size_t data_offset;  // byte offset of the first point record
+  size_t point_step;   // bytes per point record
+  size_t num_points;
+  Field x, y, z, intensity;
+};
+
+/**
+ * @brief parse the header of a pcd file
+ * @return false if the file is not a binary pcd file with x, y, and z fields
+ */
+bool parse_binary_pcd_header(const char* data, size_t size, BinaryPcdLayout& layout) {
+  std::vector<std::string> fields;
+  std::vector<int> sizes;
+  std::vector<char> types;
+  std::vector<int> counts;
+  layout.num_points = 0;
+  layout.data_offset = 0;
+
+  size_t pos = 0;
+  while (pos < size) {
+    const char* end = static_cast<const char*>(std::memchr(data + pos, '\n', size - pos));
+    if (!end) {
+      return false;
+    }
+    std::istringstream line(std::string(data + pos, end));
+    pos = end - data + 1;
+
+    std::string key;
+    line >> key;
+    if (key == "FIELDS") {
+      for (std::string field; line >> field;) fields.push_back(field);
+    } else if (key == "SIZE") {
+      for (int value; line >> value;) sizes.push_back(value);
+    } else if (key == "TYPE") {
+      for (char value; line >> value;) types.push_back(value);
+    } else if (key == "COUNT") {
+      for (int value; line >> value;) counts.push_back(value);
+    } else if (key == "POINTS") {
+      line >> layout.num_points;
+    } else if (key == "DATA") {
+      std::string format;
+      line >> format;
+      if (format != "binary") {
+        return false;
+      }
+      layout.data_offset = pos;
+      break;
+    }
+  }
+
+  if (fields.empty() || sizes.size() != fields.size() || types.size() != fields.size()) {
+    return false;
+  }
+  counts.resize(fields.size(), 1);
+
+  layout.x = layout.y = layout.z = layout.intensity = BinaryPcdLayout::Field{-1, 'F', 4};
+  int offset = 0;
+  for (size_t i = 0; i < fields.size(); i++) {
+    const BinaryPcdLayout::Field field{offset, types[i], sizes[i]};
+    if (fields[i] == "x") layout.x = field;
+    if (fields[i] == "y") layout.y = field;
+    if (fields[i] == "z") layout.z = field;
+    if (fields[i] == "intensity") layout.intensity = field;
+    offset += sizes[i] * counts[i];
+  }
+  layout.point_step = offset;
+
+  return layout.x.offset >= 0 && layout.y.offset >= 0 && layout.z.offset >= 0 && layout.data_offset > 0;
+}
+
+// the records of a binary pcd file are packed, so the fields are not aligned in general
+template <typename T>
+T load_unaligned(const char* ptr) {
+  T value;
+  std::memcpy(&value, ptr, sizeof(T));
+  return value;
+}
+
+double read_pcd_field(const char* record, const BinaryPcdLayout::Field& field) {
+  const char* ptr = record + field.offset;
+  switch (field.type) {
+    case 'F':
+      if (field.size == 8) return load_unaligned<double>(ptr);
+      return load_unaligned<float>(ptr);
+    case 'U':
+      if (field.size == 1) return load_unaligned<std::uint8_t>(ptr);
+      if (field.size == 2) return load_unaligned<std::uint16_t>(ptr);
+      return load_unaligned<std::uint32_t>(ptr);
+    default:
+      if (field.size == 1) return load_unaligned<std::int8_t>(ptr);
+      if (field.size == 2) return load_unaligned<std::int16_t>(ptr);
+      return load_unaligned<std::int32_t>(ptr);
+  }
+}
+
+/**
+ * @brief centroid accumulator of a voxel
+ */
+struct VoxelAccumulator {
+  VoxelAccumulator() : num(0), sum(Eigen::Vector4d::Zero()) {}
+
+  void add(const Eigen::Vector4d& pt) {
+    num++;
+    sum += pt;
+  }
+  void add(const VoxelAccumulator& other) {
+    num += other.num;
+    sum += other.sum;
+  }
+
+  size_t num;
+  Eigen::Vector4d sum;  // x, y, z, intensity
+};
+
+struct VoxelCoord {
+  bool operator==(const VoxelCoord& other) const { return x == other.x && y == other.y && z == other.z; }
+  bool operator<(const VoxelCoord& other) const { return x != other.x ? x < other.x : (y != other.y ? y < other.y : z < other.z); }
+  std::int64_t x, y, z;
+};
+
+struct VoxelCoordHash {
+  size_t operator()(const VoxelCoord& coord) const { return (coord.x * 73856093) ^ (coord.y * 19349669) ^ (coord.z * 83492791); }
+};
+
+using VoxelAccumulatorMap = std::unordered_map<VoxelCoord, VoxelAccumulator, VoxelCoordHash>;
+
+/**
+ * @brief load a binary pcd file block by block with mmap, apply the offset, and downsample each block as it is read
+ * @note  the blocks are processed in parallel, and their pages are released once they are processed. the memory usage is
+ *        proportional to the size of the downsampled map rather than the size of the file.
+ *        the points are downsampled to the centroids of the voxels as pcl::VoxelGrid does, but the voxel coordinates never
+ *        overflow for large maps. the output does not depend on the number of threads (the same file gives the same cloud).
+ * @return globalmap (nullptr if the file is not a binary pcd file)
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr load_binary_pcd_streaming(const std::string& pcd_path, const Eigen::Vector3d& offset, double downsample_resolution) {
+  int fd = open(pcd_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return nullptr;
+  }
+  const char* data = static_cast<const char*>(mapped);
+  const size_t file_size = st.st_size;
+
+  BinaryPcdLayout layout;
+  if (!parse_binary_pcd_header(data, std::min<size_t>(file_size, 1 << 16), layout) || layout.data_offset + layout.num_points * layout.point_step > file_size) {
+    munmap(mapped, file_size);
+    return nullptr;
+  }
+  madvise(mapped, file_size, MADV_SEQUENTIAL);
+
+  const size_t block_points = 1 << 20;
+  const long num_blocks = (layout.num_points + block_points - 1) / block_points;
+  const long page_size = sysconf(_SC_PAGESIZE);
+
+  const auto read_point = [&](size_t i, Eigen::Vector4d& pt) {
+    const char* record = data + layout.data_offset + i * layout.point_step;
+    pt[0] = read_pcd_field(record, layout.x) - offset.x();
+    pt[1] = read_pcd_field(record, layout.y) - offset.y();
+    pt[2] = read_pcd_field(record, layout.z) - offset.z();
+    pt[3] = layout.intensity.offset >= 0 ? read_pcd_field(record, layout.intensity) : 0.0;
+    return std::isfinite(pt[0]) && std::isfinite(pt[1]) && std::isfinite(pt[2]);
+  };
+
+  // release the pages of a processed block (the pages at both ends may be shared with the neighboring blocks)
+  const auto release_block = [&](long block) {
+    const size_t begin = layout.data_offset + block * block_points * layout.point_step;
+    const size_t end = layout.data_offset + std::min<size_t>((block + 1) * block_points, layout.num_points) * layout.point_step;
+    const size_t page_begin = (begin + page_size - 1) / page_size * page_size;
+    const size_t page_end = end / page_size * page_size;
+    if (page_begin < page_end) {
+      madvise(const_cast<char*>(data) + page_begin, page_end - page_begin, MADV_DONTNEED);
+    }
+  };
+
+  pcl::PointCloud<pcl::PointXYZI>::Ptr globalmap(new pcl::PointCloud<pcl::PointXYZI>());
+  if (downsample_resolution <= 0.0) {
+    globalmap->resize(layout.num_points);
+    std::vector<char> valid(layout.num_points, 0);
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (long block = 0; block < num_blocks; block++) {
+      const size_t end = std::min<size_t>((block + 1) * block_points, layout.num_points);
+      for (size_t i = block * block_points; i < end; i++) {
+        Eigen::Vector4d pt;
+        valid[i] = read_point(i, pt);
+        globalmap->at(i).getVector3fMap() = pt.head<3>().cast<float>();
+        globalmap->at(i).intensity = pt[3];
+      }
+      release_block(block);
+    }
+
+    size_t num_valid = 0;
+    for (size_t i = 0; i < layout.num_points; i++) {
+      if (valid[i]) {
+        globalmap->at(num_valid++) = globalmap->at(i);
+      }
+    }
+    globalmap->resize(num_valid);
+  } else {
+    // the voxels are sharded so that the centroids are computed concurrently. the blocks are downsampled in parallel, and merged
+    // in the block order so that the sums (and the resulting centroids) do not depend on the thread scheduling
+    const int num_shards = 64;
+    std::vector<VoxelAccumulatorMap> shards(num_shards);
+    const double inv_resolution = 1.0 / downsample_resolution;
+
+#pragma omp parallel for ordered schedule(dynamic, 1)
+    for (long block = 0; block < num_blocks; block++) {
+      std::vector<VoxelAccumulatorMap> local(num_shards);
+      const size_t end = std::min<size_t>((block + 1) * block_points, layout.num_points);
+      for (size_t i = block * block_points; i < end; i++) {
+        Eigen::Vector4d pt;
+        if (!read_point(i, pt)) {
+          continue;
+        }
+
+        const VoxelCoord coord{static_cast<std::int64_t>(std::floor(pt[0] * inv_resolution)), static_cast<std::int64_t>(std::floor(pt[1] * inv_resolution)), static_cast<std::int64_t>(std::floor(pt[2] * inv_resolution))};
+        local[VoxelCoordHash()(coord) % num_shards][coord].add(pt);
+      }
+      release_block(block);
+
+#pragma omp ordered
+      for (int shard = 0; shard < num_shards; shard++) {
+        for (const auto& voxel : local[shard]) {
+          shards[shard][voxel.first].add(voxel.second);
+        }
+      }
+    }
+
+    // the points are written in the shard order and sorted by the voxel coordinates in each shard (the iteration order of
+    // the hash maps is not deterministic)
+    std::vector<size_t> shard_offsets(num_shards + 1, 0);
+    for (int shard = 0; shard < num_shards; shard++) {
+      shard_offsets[shard + 1] = shard_offsets[shard] + shards[shard].size();
+    }
+
+    globalmap->resize(shard_offsets.back());
+#pragma omp parallel for schedule(dynamic, 1)
+    for (int shard = 0; shard < num_shards; shard++) {
+      using Voxel = std::pair<VoxelCoord, VoxelAccumulator>;
+      std::vector<Voxel, Eigen::aligned_allocator<Voxel>> voxels(shards[shard].begin(), shards[shard].end());
+      VoxelAccumulatorMap().swap(shards[shard]);
+      std::sort(voxels.begin(), voxels.end(), [](const Voxel& lhs, const Voxel& rhs) { return lhs.first < rhs.first; });
+
+      for (size_t i = 0; i < voxels.size(); i++) {
+        const Eigen::Vector4d centroid = voxels[i].second.sum / voxels[i].second.num;
+        auto& pt = globalmap->at(shard_offsets[shard] + i);
+        pt.getVector3fMap() = centroid.head<3>().cast<float>();
+        pt.intensity = centroid[3];
+      }
+    }
+  }
+
+  munmap(mapped, file_size);
+
+  globalmap->width = globalmap->size();
+  globalmap->height = 1;
+  globalmap->is_dense = false;
+  return globalmap;
+}
+
+}  // namespace
+
+/**
+ * @brief load a globalmap pcd file, apply the UTM offset (<pcd>.utm), and downsample it
+ * @param globalmap_pcd          pcd file path
+ * @param convert_utm_to_local   if true and <pcd>.utm exists, the map is offset by the UTM reference coordinates
+ * @param downsample_resolution  voxel grid leaf size (disabled if <= 0)
+ * @return globalmap (nullptr if the file cannot be loaded)
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr load_globalmap_pcd(const std::string& globalmap_pcd, bool convert_utm_to_local, double downsample_resolution) {
+  using PointT = pcl::PointXYZI;
+
+  // binary pcd files are streamed without loading the whole file (the offset is applied in double precision)
+  Eigen::Vector3d utm_offset = Eigen::Vector3d::Zero();
+  std::ifstream utm_offset_file(globalmap_pcd + ".utm");
+  const bool has_utm_offset = utm_offset_file.is_open() && convert_utm_to_local && (utm_offset_file >> utm_offset[0] >> utm_offset[1] >> utm_offset[2]);
+
+  pcl::PointCloud<PointT>::Ptr streamed = load_binary_pcd_streaming(globalmap_pcd, utm_offset, downsample_resolution);
+  if (streamed) {
+    streamed->header.frame_id = "map";
+    if (has_utm_offset) {
+      ROS_INFO_STREAM("Global map offset by UTM reference coordinates (x = " << utm_offset[0] << ", y = " << utm_offset[1] << ") and altitude (z = " << utm_offset[2] << ")");
+    }
+    return streamed;
+  }
+
+  // ascii and compressed pcd files are loaded with pcl
+  pcl::PointCloud<PointT>::Ptr globalmap(new pcl::PointCloud<PointT>());
+  if (pcl::io::loadPCDFile(globalmap_pcd, *globalmap) != 0) {
+    ROS_ERROR_STREAM("failed to load " << globalmap_pcd);
+    return nullptr;
+  }
+  globalmap->header.frame_id = "map";
+
+  std::ifstream utm_file(globalmap_pcd + ".utm");
+  if (utm_file.is_open() && convert_utm_to_local) {
+    double utm_easting;
+    double utm_northing;
+    double altitude;
+    utm_file >> utm_easting >> utm_northing >> altitude;
+    for (auto& pt : globalmap->points) {
+      pt.getVector3fMap() -= Eigen::Vector3f(utm_easting, utm_northing, altitude);
+    }
+    ROS_INFO_STREAM("Global map offset by UTM reference coordinates (x = " << utm_easting << ", y = " << utm_northing << ") and altitude (z = " << altitude << ")");
+  }
+
+  if (downsample_resolution <= 0.0) {
+    return globalmap;
+  }
+
+  // downsample globalmap
+  boost::shared_ptr<pcl::VoxelGrid<PointT>> voxelgrid(new pcl::VoxelGrid<PointT>());
+  voxelgrid->setLeafSize(downsample_resolution, downsample_resolution, downsample_resolution);
+  voxelgrid->setInputCloud(globalmap);
+
+  pcl::PointCloud<PointT>::Ptr filtered(new pcl::PointCloud<PointT>());
+  voxelgrid->filter(*filtered);
+
+  return filtered;
+}
+
+/**
+ * @brief save a preprocessed globalmap as a binary cache file
+ * @param cache_path             cache file path
+ * @param globalmap              preprocessed (offset and downsampled) globalmap
+ * @param source_pcd             pcd file the map was created from
+ * @param convert_utm_to_local   whether the UTM offset was applied to the map
+ * @param downsample_resolution  leaf size used to downsample the map
+ * @return true if the cache was written
+ */
+bool save_globalmap_cache(const std::string& cache_path, const pcl::PointCloud<pcl::PointXYZI>& globalmap, const std::string& source_pcd, bool convert_utm_to_local, double downsample_resolution) {
+  GlobalmapCacheHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, kCacheMagic, sizeof(kCacheMagic));
+  header.version = kCacheVersion;
+  header.point_stride = sizeof(GlobalmapCachePoint);
+  header.num_points = globalmap.size();
+  header.downsample_resolution = downsample_resolution;
+  header.convert_utm_to_local = convert_utm_to_local ? 1 : 0;
+  if (!file_stat(source_pcd, header.source_size, header.source_mtime)) {
+    ROS_WARN_STREAM("failed to stat " << source_pcd << " (the cache will never be considered stale)");
+  }
+
+  // write to a temporary file first so that a reader never sees a partially written cache
+  const std::string tmp_path = cache_path + ".tmp";
+  std::ofstream ofs(tmp_path, std::ios::binary);
+  if (!ofs) {
+    ROS_ERROR_STREAM("failed to open " << tmp_path);
+    return false;
+  }
+
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  std::vector<GlobalmapCachePoint> records(globalmap.size());
+  for (size_t i = 0; i < globalmap.size(); i++) {
+    const auto& pt = globalmap.at(i);
+    records[i] = GlobalmapCachePoint{pt.x, pt.y, pt.z, pt.intensity};
+  }
+  ofs.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(GlobalmapCachePoint));
+  ofs.close();
+
+  if (!ofs || std::rename(tmp_path.c_str(), cache_path.c_str()) != 0) {
+    ROS_ERROR_STREAM("failed to write " << cache_path);
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * @brief load a globalmap from a binary cache file
+ * @param cache_path             cache file path
+ * @param source_pcd             if not empty, the cache is rejected when it was not created from the current version of this file
+ * @param convert_utm_to_local   the cache is rejected when it was created with a different setting (1 or 0, negative to accept any)
+ * @param downsample_resolution  the cache is rejected when it was created with a different leaf size (negative to accept any)
+ * @return globalmap (nullptr if the cache does not exist or is invalid)
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr load_globalmap_cache(const std::string& cache_path, const std::string& source_pcd, int convert_utm_to_local, double downsample_resolution) {
+  int fd = open(cache_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(GlobalmapCacheHeader))) {
+    close(fd);
+    return nullptr;
+  }
+
+  void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    ROS_WARN_STREAM("failed to mmap " << cache_path);
+    return nullptr;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  pcl::PointCloud<pcl::PointXYZI>::Ptr globalmap;
+  const auto* header = reinterpret_cast<const GlobalmapCacheHeader*>(data);
+
+  std::uint64_t source_size = 0;
+  std::int64_t source_mtime = 0;
+  if (std::memcmp(header->magic, kCacheMagic, sizeof(kCacheMagic)) != 0 || header->version != kCacheVersion || header->point_stride != sizeof(GlobalmapCachePoint)) {
+    ROS_WARN_STREAM("invalid globalmap cache " << cache_path);
+  } else if (sizeof(GlobalmapCacheHeader) + header->num_points * sizeof(GlobalmapCachePoint) > static_cast<std::uint64_t>(st.st_size)) {
+    ROS_WARN_STREAM("truncated globalmap cache " << cache_path);
+  } else if (downsample_resolution >= 0.0 && std::abs(header->downsample_resolution - downsample_resolution) > 1e-6) {
+    ROS_WARN_STREAM("globalmap cache " << cache_path << " was created with downsample_resolution=" << header->downsample_resolution);
+  } else if (convert_utm_to_local >= 0 && header->convert_utm_to_local != static_cast<std::uint32_t>(convert_utm_to_local != 0)) {
+    ROS_WARN_STREAM("globalmap cache " << cache_path << " was created with convert_utm_to_local=" << (header->convert_utm_to_local ? "true" : "false"));
+  } else if (!source_pcd.empty() && file_stat(source_pcd, source_size, source_mtime) && (source_size != header->source_size || source_mtime != header->source_mtime)) {
+    ROS_WARN_STREAM("globalmap cache " << cache_path << " is older than " << source_pcd);
+  } else {
+    const auto* records = reinterpret_cast<const GlobalmapCachePoint*>(reinterpret_cast<const char*>(data) + sizeof(GlobalmapCacheHeader));
+
+    globalmap.reset(new pcl::PointCloud<pcl::PointXYZI>());
+    globalmap->resize(header->num_points);
+    for (size_t i = 0; i < header->num_points; i++) {
+      auto& pt = globalmap->at(i);
+      pt.x = records[i].x;
+      pt.y = records[i].y;
+      pt.z = records[i].z;
+      pt.intensity = records[i].intensity;
+    }
+    globalmap->width = globalmap->size();
+    globalmap->height = 1;
+    globalmap->is_dense = false;
+    globalmap->header.frame_id = "map";
+  }
+
+  munmap(data, st.st_size);
+  return globalmap;
+}
+
+}  // namespace hdl_localization
@@ -0,0 +1,54 @@
+#include <hdl_localization/globalmap_patch.hpp>
+
+namespace hdl_localization {
+
+/**
+ * @brief replace the points of a globalmap in a box with new points
+ * @param globalmap  globalmap
+ * @param region     box to be replaced
+ * @param points     new points (points outside the box are ignored)
+ * @return patched globalmap (the input map is not modified)
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr apply_globalmap_patch(const pcl::PointCloud<pcl::PointXYZI>& globalmap, const Eigen::AlignedBox3f& region, const pcl::PointCloud<pcl::PointXYZI>& points) {
+  pcl::PointCloud<pcl::PointXYZI>::Ptr patched(new pcl::PointCloud<pcl::PointXYZI>());
+  patched->header = globalmap.header;
+  patched->reserve(globalmap.size() + points.size());
+
+  for (const auto& pt : globalmap) {
+    if (!region.contains(pt.getVector3fMap())) {
+      patched->push_back(pt);
+    }
+  }
+  for (const auto& pt : points) {
+    if (region.contains(pt.getVector3fMap())) {
+      patched->push_back(pt);
+    }
+  }
+
+  patched->width = patched->size();
+  patched->height = 1;
+  patched->is_dense = false;
+  return patched;
+}
+
+/**
+ * @brief points of a cloud in a box
+ * @param cloud   input cloud
+ * @param region  box
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr crop_globalmap_patch(const pcl::PointCloud<pcl::PointXYZI>& cloud, const Eigen::AlignedBox3f& region) {
+  pcl::PointCloud<pcl::PointXYZI>::Ptr cropped(new pcl::PointCloud<pcl::PointXYZI>());
+  cropped->header = cloud.header;
+  for (const auto& pt : cloud) {
+    if (region.contains(pt.getVector3fMap())) {
+      cropped->push_back(pt);
+    }
+  }
+
+  cropped->width = cropped->size();
+  cropped->height = 1;
+  cropped->is_dense = false;
+  return cropped;
+}
+
+}  // namespace hdl_localization
@@ -0,0 +1,95 @@
+#include <hdl_localization/globalmap_tile_codec.hpp>
+
+#include <cmath>
+#include <limits>
+
+namespace hdl_localization {
+
+/**
+ * @brief encode the points of a globalmap tile
+ * @param points      tile points
+ * @param tile_x      tile index
+ * @param tile_y      tile index
+ * @param tile_size   tile edge length
+ * @param resolution  quantization step of the coordinates (float32 coordinates if <= 0)
+ * @return tile message
+ */
+GlobalmapTilePtr encode_globalmap_tile(const pcl::PointCloud<pcl::PointXYZI>& points, int tile_x, int tile_y, double tile_size, double resolution) {
+  GlobalmapTilePtr tile_msg(new GlobalmapTile());
+  tile_msg->tile_x = tile_x;
+  tile_msg->tile_y = tile_y;
+  tile_msg->tile_size = tile_size;
+
+  Eigen::Array3f min_pt = Eigen::Array3f::Constant(std::numeric_limits<float>::max());
+  Eigen::Array3f max_pt = Eigen::Array3f::Constant(std::numeric_limits<float>::lowest());
+  for (const auto& pt : points) {
+    min_pt = min_pt.min(pt.getVector3fMap().array());
+    max_pt = max_pt.max(pt.getVector3fMap().array());
+  }
+
+  // a tall tile (e.g., high-rise buildings) may not fit in 16bit coordinates
+  const bool quantize = resolution > 0.0 && !points.empty() && ((max_pt - min_pt) / resolution).maxCoeff() < std::numeric_limits<std::uint16_t>::max();
+
+  tile_msg->intensity.resize(points.size());
+  if (quantize) {
+    tile_msg->resolution = resolution;
+    tile_msg->origin.x = min_pt.x();
+    tile_msg->origin.y = min_pt.y();
+    tile_msg->origin.z = min_pt.z();
+
+    const float inv_resolution = 1.0 / resolution;
+    tile_msg->quantized_xyz.resize(points.size() * 3);
+    for (size_t i = 0; i < points.size(); i++) {
+      const Eigen::Array3f q = ((points[i].getVector3fMap().array() - min_pt) * inv_resolution).round();
+      for (int k = 0; k < 3; k++) {
+        tile_msg->quantized_xyz[i * 3 + k] = static_cast<std::uint16_t>(q[k]);
+      }
+      tile_msg->intensity[i] = points[i].intensity;
+    }
+  } else {
+    tile_msg->resolution = 0.0;
+    tile_msg->xyz.resize(points.size() * 3);
+    for (size_t i = 0; i < points.size(); i++) {
+      for (int k = 0; k < 3; k++) {
+        tile_msg->xyz[i * 3 + k] = points[i].data[k];
+      }
+      tile_msg->intensity[i] = points[i].intensity;
+    }
+  }
+
+  return tile_msg;
+}
+
+/**
+ * @brief decode the points of a globalmap tile
+ * @param tile_msg  tile message
+ * @return tile points (nullptr if the message is broken)
+ */
+pcl::PointCloud<pcl::PointXYZI>::Ptr decode_globalmap_tile(const GlobalmapTile& tile_msg) {
+  const size_t num_points = tile_msg.intensity.size();
+  const bool quantized = tile_msg.resolution > 0.0;
+  if ((quantized ? tile_msg.quantized_xyz.size() : tile_msg.xyz.size()) != num_points * 3) {
+    return nullptr;
+  }
+
+  pcl::PointCloud<pcl::PointXYZI>::Ptr points(new pcl::PointCloud<pcl::PointXYZI>());
+  points->header.frame_id = tile_msg.header.frame_id;
+  points->resize(num_points);
+
+  const Eigen::Array3f origin(tile_msg.origin.x, tile_msg.origin.y, tile_msg.origin.z);
+  for (size_t i = 0; i < num_points; i++) {
+    auto& pt = points->at(i);
+    for (int k = 0; k < 3; k++) {
+      pt.data[k] = quantized ? origin[k] + tile_msg.quantized_xyz[i * 3 + k] * tile_msg.resolution : tile_msg.xyz[i * 3 + k];
+    }
+    pt.data[3] = 1.0f;
+    pt.intensity = tile_msg.intensity[i];
+  }
+
+  points->width = points->size();
+  points->height = 1;
+  points->is_dense = false;
+  return points;
+}
+
+}  // namespace hdl_localization
@@ -0,0 +1,249 @@
+#include <hdl_localization/globalmap_tiles.hpp>
+
+#include <cmath>
+#include <iterator>
+#include <algorithm>
+
+namespace hdl_localization {
+
+GlobalmapTiles::GlobalmapTiles(double tile_size) : tile_size_(tile_size) {}
+
+GlobalmapTiles::~GlobalmapTiles() {}
+
+/**
+ * @brief distribute the points of a cloud to the tiles
+ * @param cloud  input cloud (in the map frame)
+ */
+void GlobalmapTiles::insert(const pcl::PointCloud<PointT>& cloud) {
+  const double inv_tile_size = 1.0 / tile_size_;
+  for (const auto& pt : cloud) {
+    if (!std::isfinite(pt.x) || !std::isfinite(pt.y) || !std::isfinite(pt.z)) {
+      continue;
+    }
+
+    const int ix = static_cast<int>(std::floor(pt.x * inv_tile_size));
+    const int iy = static_cast<int>(std::floor(pt.y * inv_tile_size));
+
+    auto& tile = tiles[key(ix, iy)];
+    if (!tile) {
+      tile.reset(new pcl::PointCloud<PointT>());
+      tile->header = cloud.header;
+    }
+    tile->push_back(pt);
+  }
+}
+
+/**
+ * @brief keys of the tiles which intersect with the circle of the given radius on the xy-plane
+ * @param center  circle center
+ * @param radius  circle radius
+ */
+std::vector<std::uint64_t> GlobalmapTiles::keys_within(const Eigen::Vector3f& center, double radius) const {
+  const int min_x = static_cast<int>(std::floor((center.x() - radius) / tile_size_));
+  const int max_x = static_cast<int>(std::floor((center.x() + radius) / tile_size_));
+  const int min_y = static_cast<int>(std::floor((center.y() - radius) / tile_size_));
+  const int max_y = static_cast<int>(std::floor((center.y() + radius) / tile_size_));
+
+  std::vector<std::uint64_t> keys;
+  for (int ix = min_x; ix <= max_x; ix++) {
+    for (int iy = min_y; iy <= max_y; iy++) {
+      // distance between the circle center and the closest point in the tile
+      const double dx = std::max(0.0, std::max(ix * tile_size_ - center.x(), center.x() - (ix + 1) * tile_size_));
+      const double dy = std::max(0.0, std::max(iy * tile_size_ - center.y(), center.y() - (iy + 1) * tile_size_));
+      if (dx * dx + dy * dy > radius * radius) {
+        continue;
+      }
+
+      const std::uint64_t k = key(ix, iy);
+      if (tiles.count(k)) {
+        keys.push_back(k);
+      }
+    }
+  }
+
+  return keys;
+}
+
+/**
+ * @brief assemble a submap from the tiles around the given position
+ * @param center  submap center
+ * @param radius  submap radius
+ * @return submap cloud
+ */
+pcl::PointCloud<GlobalmapTiles::PointT>::Ptr GlobalmapTiles::submap(const Eigen::Vector3f& center, double radius) const {
+  const auto keys = keys_within(center, radius);
+
+  size_t num_points = 0;
+  for (const auto& k : keys) {
+    num_points += tiles.at(k)->size();
+  }
+
+  pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+  cloud->reserve(num_points);
+  for (const auto& k : keys) {
+    const auto& tile = tiles.at(k);
+    cloud->header = tile->header;
+    cloud->insert(cloud->end(), tile->begin(), tile->end());
+  }
+
+  cloud->width = cloud->size();
+  cloud->height = 1;
+  cloud->is_dense = false;
+
+  return cloud;
+}
+
+/**
+ * @brief assemble the whole map from all the tiles
+ */
+pcl::PointCloud<GlobalmapTiles::PointT>::Ptr GlobalmapTiles::merged() const {
+  size_t num_points = 0;
+  for (const auto& tile : tiles) {
+    num_points += tile.second->size();
+  }
+
+  pcl::PointCloud<PointT>::Ptr cloud(new pcl::PointCloud<PointT>());
+  cloud->reserve(num_points);
+  for (const auto& tile : tiles) {
+    cloud->header = tile.second->header;
+    cloud->insert(cloud->end(), tile.second->begin(), tile.second->end());
+  }
+
+  cloud->width = cloud->size();
+  cloud->height = 1;
+  cloud->is_dense = false;
+
+  return cloud;
+}
+
+/**
+ * @brief copy of the tile set with a tile added (or replaced)
+ * @note  the tile must not be modified after this call. the other tiles are shared with this tile set.
+ * @param key   tile key
+ * @param tile  tile points
+ */
+GlobalmapTiles::Ptr GlobalmapTiles::with_tile(std::uint64_t key, const pcl::PointCloud<PointT>::Ptr& tile) const {
+  Ptr added(new GlobalmapTiles(tile_size_));
+  added->tiles = tiles;
+  if (tile && !tile->empty()) {
+    added->tiles[key] = tile;
+  } else {
+    added->tiles.erase(key);
+  }
+  return added;
+}
+
+/**
+ * @brief copy of the tile set with only the given tiles (the tiles are shared with this tile set)
+ * @param keys  keys of the tiles to be kept
+ */
+GlobalmapTiles::Ptr GlobalmapTiles::subset(const std::vector<std::uint64_t>& keys) const {
+  Ptr subset(new GlobalmapTiles(tile_size_));
+  for (const auto& k : keys) {
+    auto found = tiles.find(k);
+    if (found != tiles.end()) {
+      subset->tiles.insert(*found);
+    }
+  }
+  return subset;
+}
+
+/**
+ * @brief keys of all the tiles
+ */
+std::vector<std::uint64_t> GlobalmapTiles::keys() const {
+  std::vector<std::uint64_t> keys;
+  keys.reserve(tiles.size());
+  for (const auto& tile : tiles) {
+    keys.push_back(tile.first);
+  }
+  return keys;
+}
+
+/**
+ * @brief points of a tile (nullptr if the tile does not exist)
+ */
+pcl::PointCloud<GlobalmapTiles::PointT>::ConstPtr GlobalmapTiles::tile(std::uint64_t key) const {
+  auto found = tiles.find(key);
+  return found == tiles.end() ? nullptr : found->second;
+}
+
+/**
+ * @brief copy of the tile set with the points in a box replaced by new points
+ * @note  only the tiles overlapping the box are rebuilt. the other tiles are shared with this tile set.
+ * @param region  box to be replaced
+ * @param points  new points (points outside the box are ignored)
+ * @return patched tile set
+ */
+GlobalmapTiles::Ptr GlobalmapTiles::patched(const Eigen::AlignedBox3f& region, const pcl::PointCloud<PointT>& points) const {
+  Ptr patched(new GlobalmapTiles(tile_size_));
+  patched->tiles = tiles;
+
+  const int min_x = static_cast<int>(std::floor(region.min().x() / tile_size_));
+  const int max_x = static_cast<int>(std::floor(region.max().x() / tile_size_));
+  const int min_y = static_cast<int>(std::floor(region.min().y() / tile_size_));
+  const int max_y = static_cast<int>(std::floor(region.max().y() / tile_size_));
+
+  // the overlapping tiles are replaced with new clouds, so that the tiles shared with this set are never modified
+  for (int ix = min_x; ix <= max_x; ix++) {
+    for (int iy = min_y; iy <= max_y; iy++) {
+      auto found = patched->tiles.find(key(ix, iy));
+      if (found == patched->tiles.end()) {
+        continue;
+      }
+
+      pcl::PointCloud<PointT>::Ptr tile(new pcl::PointCloud<PointT>());
+      tile->header = found->second->header;
+      tile->reserve(found->second->size());
+      for (const auto& pt : *found->second) {
+        if (!region.contains(pt.getVector3fMap())) {
+          tile->push_back(pt);
+        }
+      }
+      found->second = tile;
+    }
+  }
+
+  const double inv_tile_size = 1.0 / tile_size_;
+  for (const auto& pt : points) {
+    if (!region.contains(pt.getVector3fMap())) {
+      continue;
+    }
+
+    const int ix = static_cast<int>(std::floor(pt.x * inv_tile_size));
+    const int iy = static_cast<int>(std::floor(pt.y * inv_tile_size));
+
+    auto& tile = patched->tiles[key(ix, iy)];
+    if (!tile) {
+      tile.reset(new pcl::PointCloud<PointT>());
+      tile->header = points.header;
+    }
+    tile->push_back(pt);
+  }
+
+  for (auto itr = patched->tiles.begin(); itr != patched->tiles.end();) {
+    itr = itr->second->empty() ? patched->tiles.erase(itr) : std::next(itr);
+  }
+
+  return patched;
+}
+
+/**
+ * @brief true if the tiles overlapping a box are part of the submap around the given position
+ * @param region  box
+ * @param center  submap center
+ * @param radius  submap radius
+ */
+bool GlobalmapTiles::submap_overlaps(const Eigen::AlignedBox3f& region, const Eigen::Vector3f& center, double radius) const {
+  // the same test as keys_within() on the bounding rectangle of the overlapping tiles
+  const double min_x = std::floor(region.min().x() / tile_size_) * tile_size_;
+  const double max_x = (std::floor(region.max().x() / tile_size_) + 1) * tile_size_;
+  const double min_y = std::floor(region.min().y() / tile_size_) * tile_size_;
+  const double max_y = (std::floor(region.max().y() / tile_size_) + 1) * tile_size_;
+
+  const double dx = std::max(0.0, std::max(min_x - center.x(), center.x() - max_x));
+  const double dy = std::max(0.0, std::max(min_y - center.y(), center.y() - max_y));
+  return dx * dx + dy * dy <= radius * radius;
+}
+
+}  // namespace hdl_localization
@@ -0,0 +1,203 @@
+#include <hdl_localization/ndt_voxel_map.hpp>
+
+#include <map>
+#include <mutex>
+#include <cmath>
+#include <Eigen/Eigenvalues>
+
+namespace hdl_localization {
+
+NdtVoxelMap::NdtVoxelMap(double resolution, int min_points_per_voxel) : resolution_(resolution), inv_resolution(1.0 / resolution), min_points_per_voxel(min_points_per_voxel) {}
+
+NdtVoxelMap::~NdtVoxelMap() {}
+
+/**
+ * @brief compute the distributions of a cloud (existing voxels are cleared)
+ * @param cloud  input cloud
+ */
+void NdtVoxelMap::build(const pcl::PointCloud<PointT>& cloud) {
+  indices.clear();
+  voxels.clear();
+  keys.clear();
+  insert_voxels(cloud, nullptr);
+}
+
+/**
+ * @brief recompute the voxels overlapping a box from an updated cloud
+ * @note  only the voxels in the box are removed and recomputed (the others are not touched), so that the cost of the voxel updates
+ *        and the eigen decompositions is proportional to the size of the box. the cloud is still scanned once to pick up the points
+ *        in the box (a cheap range check per point)
+ * @param cloud   updated cloud (the points outside the overlapping voxels are skipped)
+ * @param region  box where the cloud has been updated
+ */
+void NdtVoxelMap::update_region(const pcl::PointCloud<PointT>& cloud, const Eigen::AlignedBox3f& region) {
+  const Eigen::AlignedBox3i range((region.min() * inv_resolution).array().floor().cast<int>().matrix(), (region.max() * inv_resolution).array().floor().cast<int>().matrix());
+
+  // the voxels in the range are enumerated by their coordinates unless the range has more cells than the map has voxels
+  const Eigen::Array3i extent = (range.max() - range.min()).array() + 1;
+  if (extent.cast<double>().prod() < static_cast<double>(indices.size())) {
+    for (int x = range.min().x(); x <= range.max().x(); x++) {
+      for (int y = range.min().y(); y <= range.max().y(); y++) {
+        for (int z = range.min().z(); z <= range.max().z(); z++) {
+          remove_voxel(coord_key(Eigen::Vector3i(x, y, z)));
+        }
+      }
+    }
+  } else {
+    for (size_t i = 0; i < keys.size();) {
+      if (range.contains(voxel_coord(keys[i]))) {
+        remove_voxel(keys[i]);  // the last voxel is moved to i
+      } else {
+        i++;
+      }
+    }
+  }
+
+  insert_voxels(cloud, &range);
+}
+
+/**
+ * @brief remove a voxel (if it exists) and keep the voxels packed by moving the last one into its slot
+ */
+void NdtVoxelMap::remove_voxel(std::uint64_t key) {
+  auto found = indices.find(key);
+  if (found == indices.end()) {
+    return;
+  }
+
+  const size_t index = found->second;
+  indices.erase(found);
+  if (index + 1 != voxels.size()) {
+    voxels[index] = voxels.back();
+    keys[index] = keys.back();
+    indices[keys[index]] = index;
+  }
+  voxels.pop_back();
+  keys.pop_back();
+}
+
+/**
+ * @brief build the voxel map of a cloud, or get the one already built for the same cloud object in this process
+ * @param cloud       input cloud
+ * @param resolution  voxel size
+ */
+NdtVoxelMap::ConstPtr NdtVoxelMap::build_shared(const pcl::PointCloud<PointT>::ConstPtr& cloud, double resolution) {
+  static std::mutex cache_mutex;
+  static std::map<std::pair<const void*, double>, std::weak_ptr<const NdtVoxelMap>> cache;
+
+  // the lock is held during the build so that concurrent requests for the same map wait for it instead of building it again
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  for (auto itr = cache.begin(); itr != cache.end();) {
+    itr = itr->second.expired() ? cache.erase(itr) : std::next(itr);
+  }
+
+  auto& entry = cache[std::make_pair(static_cast<const void*>(cloud.get()), resolution)];
+  ConstPtr voxel_map = entry.lock();
+  if (!voxel_map) {
+    NdtVoxelMap* built = new NdtVoxelMap(resolution);
+    built->build(*cloud);
+    voxel_map.reset(built, [cloud](const NdtVoxelMap* map) { delete map; });
+    entry = voxel_map;
+  }
+  return voxel_map;
+}
+
+/**
+ * @brief squared Mahalanobis distance between a point and the distribution of the voxel containing it
+ * @param pt  point
+ * @return squared distance (negative if the point is not in a valid voxel)
+ */
+float NdtVoxelMap::mahalanobis_sq(const Eigen::Vector3f& pt) const {
+  auto found = indices.find(voxel_key(pt));
+  if (found == indices.end()) {
+    return -1.0f;
+  }
+
+  const auto& voxel = voxels[found->second];
+  const Eigen::Vector3f diff = pt - voxel.mean;
+  return diff.dot(voxel.inv_cov * diff);
+}
+
+/**
+ * @brief compute the distributions of the points and add them to the map
+ * @param cloud  input cloud
+ * @param range  if not null, only the voxels in this range of voxel coordinates are computed
+ */
+void NdtVoxelMap::insert_voxels(const pcl::PointCloud<PointT>& cloud, const Eigen::AlignedBox3i* range) {
+  struct Accumulator {
+    int num;
+    Eigen::Vector3d sum;
+    Eigen::Matrix3d sum_sq;
+  };
+
+  std::unordered_map<std::uint64_t, Accumulator> accumulators;
+  for (const auto& pt : cloud) {
+    if (!std::isfinite(pt.x) || !std::isfinite(pt.y) || !std::isfinite(pt.z)) {
+      continue;
+    }
+
+    const std::uint64_t key = voxel_key(pt.getVector3fMap());
+    if (range && !range->contains(voxel_coord(key))) {
+      continue;
+    }
+
+    const Eigen::Vector3d p = pt.getVector3fMap().cast<double>();
+    auto found = accumulators.find(key);
+    if (found == accumulators.end()) {
+      found = accumulators.insert(std::make_pair(key, Accumulator{0, Eigen::Vector3d::Zero(), Eigen::Matrix3d::Zero()})).first;
+    }
+
+    found->second.num++;
+    found->second.sum += p;
+    found->second.sum_sq += p * p.transpose();
+  }
+
+  voxels.reserve(voxels.size() + accumulators.size());
+  keys.reserve(keys.size() + accumulators.size());
+  for (const auto& accumulator : accumulators) {
+    const auto& acc = accumulator.second;
+    if (acc.num < min_points_per_voxel) {
+      continue;
+    }
+
+    const Eigen::Vector3d mean = acc.sum / acc.num;
+    const Eigen::Matrix3d cov = (acc.sum_sq - acc.num * mean * mean.transpose()) / (acc.num - 1);
+
+    // inflate small eigenvalues as pcl::VoxelGridCovariance does to avoid singular distributions of flat surfaces
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eig(cov);
+    Eigen::Vector3d eigenvalues = eig.eigenvalues();
+    if (eigenvalues[2] <= 0.0) {
+      continue;
+    }
+    eigenvalues = eigenvalues.cwiseMax(0.01 * eigenvalues[2]);
+
+    Voxel voxel;
+    voxel.mean = mean.cast<float>();
+    voxel.inv_cov = (eig.eigenvectors() * eigenvalues.cwiseInverse().asDiagonal() * eig.eigenvectors().transpose()).cast<float>();
+
+    indices.insert(std::make_pair(accumulator.first, voxels.size()));
+    voxels.push_back(voxel);
+    keys.push_back(accumulator.first);
+  }
+}
+
+std::uint64_t NdtVoxelMap::voxel_key(const Eigen::Vector3f& pt) const {
+  return coord_key(Eigen::Vector3i((pt * inv_resolution).array().floor().cast<int>().matrix()));
+}
+
+// 21 bits for each axis
+std::uint64_t NdtVoxelMap::coord_key(const Eigen::Vector3i& coord) {
+  const std::uint64_t mask = (1 << 21) - 1;
+  return ((static_cast<std::uint64_t>(coord[0]) & mask) << 42) | ((static_cast<std::uint64_t>(coord[1]) & mask) << 21) | (static_cast<std::uint64_t>(coord[2]) & mask);
+}
+
+Eigen::Vector3i NdtVoxelMap::voxel_coord(std::uint64_t key) {
+  const std::uint64_t mask = (1 << 21) - 1;
+  const auto decode = [](std::uint64_t bits) {
+    const int coord = static_cast<int>(bits);
+    return coord >= (1 << 20) ? coord - (1 << 21) : coord;  // sign extension
+  };
+  return Eigen::Vector3i(decode((key >> 42) & mask), decode((key >> 21) & mask), decode(key & mask));
+}
+
+}  // namespace hdl_localization
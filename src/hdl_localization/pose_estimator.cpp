@@ -1,7 +1,11 @@
 #include <hdl_localization/pose_estimator.hpp>
 
+#include <chrono>
+#include <algorithm>
 #include <pcl/filters/voxel_grid.h>
 #include <hdl_localization/pose_system.hpp>
+#include <hdl_localization/registration_factory.hpp>
+#include <hdl_localization/registration_pyramid.hpp>
 #include <hdl_localization/odom_system.hpp>
 #include <kkl/alg/unscented_kalman_filter.hpp>
 
@@ -15,33 +19,35 @@ namespace hdl_localization {
  * @param cool_time_duration  during "cool time", prediction is not performed
  */
 PoseEstimator::PoseEstimator(pcl::Registration<PointT, PointT>::Ptr& registration, const Eigen::Vector3f& pos, const Eigen::Quaternionf& quat, double cool_time_duration)
-    : registration(registration), cool_time_duration(cool_time_duration) {
+    : registration(registration), cool_time_duration(cool_time_duration),
+      correction_chunk_iterations(0), correction_max_iterations(0), correction_max_time(0.0), correction_min_delta_trans(0.0), correction_min_delta_rot(0.0),
+      last_iterations(0), last_truncated(false), square_root_filter(false) {
   last_observation = Eigen::Matrix4f::Identity();
   last_observation.block<3, 3>(0, 0) = quat.toRotationMatrix();
   last_observation.block<3, 1>(0, 3) = pos;
 
-  process_noise = Eigen::MatrixXf::Identity(16, 16);
+  process_noise.setIdentity();
   process_noise.middleRows(0, 3) *= 1.0;
   process_noise.middleRows(3, 3) *= 1.0;
   process_noise.middleRows(6, 4) *= 0.5;
   process_noise.middleRows(10, 3) *= 1e-6;
   process_noise.middleRows(13, 3) *= 1e-6;
 
-  Eigen::MatrixXf measurement_noise = Eigen::MatrixXf::Identity(7, 7);
+  Eigen::Matrix<float, 7, 7> measurement_noise = Eigen::Matrix<float, 7, 7>::Identity();
   measurement_noise.middleRows(0, 3) *= 0.01;
   measurement_noise.middleRows(3, 4) *= 0.001;
 
-  Eigen::VectorXf mean(16);
+  Eigen::Matrix<float, 16, 1> mean;
   mean.middleRows(0, 3) = pos;
   mean.middleRows(3, 3).setZero();
   mean.middleRows(6, 4) = Eigen::Vector4f(quat.w(), quat.x(), quat.y(), quat.z()).normalized();
   mean.middleRows(10, 3).setZero();
   mean.middleRows(13, 3).setZero();
 
-  Eigen::MatrixXf cov = Eigen::MatrixXf::Identity(16, 16) * 0.01;
+  Eigen::Matrix<float, 16, 16> cov = Eigen::Matrix<float, 16, 16>::Identity() * 0.01;
 
   PoseSystem system;
-  ukf.reset(new kkl::alg::UnscentedKalmanFilterX<float, PoseSystem>(system, 16, 6, 7, process_noise, measurement_noise, mean, cov));
+  ukf.reset(new kkl::alg::UnscentedKalmanFilter<float, PoseSystem, 16, 6, 7>(system, process_noise, measurement_noise, mean, cov));
 }
 
 PoseEstimator::~PoseEstimator() {}
@@ -93,28 +99,79 @@ void PoseEstimator::predict(const ros::Time& stamp, const Eigen::Vector3f& acc,
   ukf->setProcessNoiseCov(process_noise * dt);
   ukf->system.dt = dt;
 
-  Eigen::VectorXf control(6);
+  Eigen::Matrix<float, 6, 1> control;
   control.head<3>() = acc;
   control.tail<3>() = gyro;
 
   ukf->predict(control);
 }
 
+/**
+ * @brief predict with IMU samples preintegrated into a single motion delta (one UKF prediction for all the samples)
+ * @param imu_samples  IMU samples sorted by timestamp
+ */
+void PoseEstimator::predict(const std::vector<ImuSample>& imu_samples) {
+  // integrate the samples with the current bias estimate
+  imu_preintegration.reset(ukf->mean.middleRows<3>(10), ukf->mean.middleRows<3>(13));
+  for (const auto& imu : imu_samples) {
+    const ros::Time& stamp = imu.stamp;
+    if (init_stamp.is_zero()) {
+      init_stamp = stamp;
+    }
+
+    if ((stamp - init_stamp).toSec() < cool_time_duration || prev_stamp.is_zero() || prev_stamp == stamp) {
+      prev_stamp = stamp;
+      continue;
+    }
+
+    double dt = (stamp - prev_stamp).toSec();
+    prev_stamp = stamp;
+
+    imu_preintegration.integrate(imu.acc, imu.gyro, dt);
+  }
+
+  if (imu_preintegration.num_samples == 0) {
+    return;
+  }
+
+  // the process noise accumulated over the samples plus the sensor noise propagated through the delta
+  const Eigen::Quaternionf q = quat();
+  const Eigen::Quaternionf q_next = (q * imu_preintegration.corrected_delta_R(imu_preintegration.gyro_bias)).normalized();
+  const Eigen::Matrix3f R = q.toRotationMatrix();
+
+  // d(qw, qx, qy, qz) / d(rotation) for q_next * exp(rotation)
+  Eigen::Matrix<float, 4, 3> dq_dtheta;
+  dq_dtheta << -q_next.x(), -q_next.y(), -q_next.z(),
+                q_next.w(), -q_next.z(),  q_next.y(),
+                q_next.z(),  q_next.w(), -q_next.x(),
+               -q_next.y(),  q_next.x(),  q_next.w();
+  dq_dtheta *= 0.5f;
+
+  Eigen::Matrix<float, 16, 9> G = Eigen::Matrix<float, 16, 9>::Zero();
+  G.block<3, 3>(0, 6) = R;
+  G.block<3, 3>(3, 3) = R;
+  G.block<4, 3>(6, 0) = dq_dtheta;
+
+  ukf->setProcessNoiseCov(process_noise * imu_preintegration.delta_t + G * imu_preintegration.cov * G.transpose());
+  ukf->predict(imu_preintegration);
+}
+
 /**
  * @brief update the state of the odomety-based pose estimation
  */
 void PoseEstimator::predict_odom(const Eigen::Matrix4f& odom_delta) {
   if(!odom_ukf) {
-    Eigen::MatrixXf odom_process_noise = Eigen::MatrixXf::Identity(7, 7);
-    Eigen::MatrixXf odom_measurement_noise = Eigen::MatrixXf::Identity(7, 7) * 1e-3;
+    Eigen::Matrix<float, 7, 7> odom_process_noise = Eigen::Matrix<float, 7, 7>::Identity();
+    Eigen::Matrix<float, 7, 7> odom_measurement_noise = Eigen::Matrix<float, 7, 7>::Identity() * 1e-3;
 
-    Eigen::VectorXf odom_mean(7);
+    Eigen::Matrix<float, 7, 1> odom_mean;
     odom_mean.block<3, 1>(0, 0) = Eigen::Vector3f(ukf->mean[0], ukf->mean[1], ukf->mean[2]);
     odom_mean.block<4, 1>(3, 0) = Eigen::Vector4f(ukf->mean[6], ukf->mean[7], ukf->mean[8], ukf->mean[9]);
-    Eigen::MatrixXf odom_cov = Eigen::MatrixXf::Identity(7, 7) * 1e-2;
+    Eigen::Matrix<float, 7, 7> odom_cov = Eigen::Matrix<float, 7, 7>::Identity() * 1e-2;
 
     OdomSystem odom_system;
-    odom_ukf.reset(new kkl::alg::UnscentedKalmanFilterX<float, OdomSystem>(odom_system, 7, 7, 7, odom_process_noise, odom_measurement_noise, odom_mean, odom_cov));
+    odom_ukf.reset(new kkl::alg::UnscentedKalmanFilter<float, OdomSystem, 7, 7, 7>(odom_system, odom_process_noise, odom_measurement_noise, odom_mean, odom_cov));
+    odom_ukf->setSquareRoot(square_root_filter);
   }
 
   // invert quaternion if the rotation axis is flipped
@@ -123,11 +180,11 @@ void PoseEstimator::predict_odom(const Eigen::Matrix4f& odom_delta) {
     quat.coeffs() *= -1.0f;
   }
 
-  Eigen::VectorXf control(7);
+  Eigen::Matrix<float, 7, 1> control;
   control.middleRows(0, 3) = odom_delta.block<3, 1>(0, 3);
   control.middleRows(3, 4) = Eigen::Vector4f(quat.w(), quat.x(), quat.y(), quat.z());
 
-  Eigen::MatrixXf process_noise = Eigen::MatrixXf::Identity(7, 7);
+  Eigen::Matrix<float, 7, 7> process_noise = Eigen::Matrix<float, 7, 7>::Identity();
   process_noise.topLeftCorner(3, 3) = Eigen::Matrix3f::Identity() * odom_delta.block<3, 1>(0, 3).norm() + Eigen::Matrix3f::Identity() * 1e-3;
   process_noise.bottomRightCorner(4, 4) = Eigen::Matrix4f::Identity() * (1 - std::abs(quat.w())) + Eigen::Matrix4f::Identity() * 1e-3;
 
@@ -137,10 +194,10 @@ void PoseEstimator::predict_odom(const Eigen::Matrix4f& odom_delta) {
 
 /**
  * @brief correct
+ * @note  the aligned cloud written by the registration is kept for aligned_cloud() without another transformation
  * @param cloud   input cloud
- * @return cloud aligned to the globalmap
  */
-pcl::PointCloud<PoseEstimator::PointT>::Ptr PoseEstimator::correct(const ros::Time& stamp, const pcl::PointCloud<PointT>::ConstPtr& cloud) {
+void PoseEstimator::correct(const ros::Time& stamp, const pcl::PointCloud<PointT>::ConstPtr& cloud) {
   if (init_stamp.is_zero()) {
     init_stamp = stamp;
   }
@@ -158,8 +215,8 @@ pcl::PointCloud<PoseEstimator::PointT>::Ptr PoseEstimator::correct(const ros::Ti
     imu_guess = matrix();
     odom_guess = odom_matrix();
 
-    Eigen::VectorXf imu_mean(7);
-    Eigen::MatrixXf imu_cov = Eigen::MatrixXf::Identity(7, 7);
+    Eigen::Matrix<float, 7, 1> imu_mean;
+    Eigen::Matrix<float, 7, 7> imu_cov = Eigen::Matrix<float, 7, 7>::Identity();
     imu_mean.block<3, 1>(0, 0) = ukf->mean.block<3, 1>(0, 0);
     imu_mean.block<4, 1>(3, 0) = ukf->mean.block<4, 1>(6, 0);
 
@@ -168,26 +225,27 @@ pcl::PointCloud<PoseEstimator::PointT>::Ptr PoseEstimator::correct(const ros::Ti
     imu_cov.block<4, 3>(3, 0) = ukf->cov.block<4, 3>(6, 0);
     imu_cov.block<4, 4>(3, 3) = ukf->cov.block<4, 4>(6, 6);
 
-    Eigen::VectorXf odom_mean = odom_ukf->mean;
-    Eigen::MatrixXf odom_cov = odom_ukf->cov;
+    Eigen::Matrix<float, 7, 1> odom_mean = odom_ukf->mean;
+    Eigen::Matrix<float, 7, 7> odom_cov = odom_ukf->cov;
 
     if (imu_mean.tail<4>().dot(odom_mean.tail<4>()) < 0.0) {
       odom_mean.tail<4>() *= -1.0;
     }
 
-    Eigen::MatrixXf inv_imu_cov = imu_cov.inverse();
-    Eigen::MatrixXf inv_odom_cov = odom_cov.inverse();
-
-    Eigen::MatrixXf fused_cov = (inv_imu_cov + inv_odom_cov).inverse();
-    Eigen::VectorXf fused_mean = fused_cov * inv_imu_cov * imu_mean + fused_cov * inv_odom_cov * odom_mean;
+    // (imu_cov^-1 + odom_cov^-1)^-1 * (imu_cov^-1 * imu_mean + odom_cov^-1 * odom_mean), rewritten as one solve with imu_cov + odom_cov
+    Eigen::Matrix<float, 7, 1> fused_mean = imu_mean + imu_cov * Eigen::LLT<Eigen::Matrix<float, 7, 7>>(imu_cov + odom_cov).solve(odom_mean - imu_mean);
 
     init_guess.block<3, 1>(0, 3) = Eigen::Vector3f(fused_mean[0], fused_mean[1], fused_mean[2]);
     init_guess.block<3, 3>(0, 0) = Eigen::Quaternionf(fused_mean[3], fused_mean[4], fused_mean[5], fused_mean[6]).normalized().toRotationMatrix();
   }
 
-  pcl::PointCloud<PointT>::Ptr aligned(new pcl::PointCloud<PointT>());
+  // pcl::Registration::align() always writes the transformed input to its output, so the output is kept as the aligned cloud
+  // instead of transforming the input again. the cloud is reused for the next correction unless a consumer still holds it
+  if (!last_aligned || last_aligned.use_count() > 1) {
+    last_aligned.reset(new pcl::PointCloud<PointT>());
+  }
   registration->setInputSource(cloud);
-  registration->align(*aligned, init_guess);
+  align(*last_aligned, init_guess);
 
   Eigen::Matrix4f trans = registration->getFinalTransformation();
   Eigen::Vector3f p = trans.block<3, 1>(0, 3);
@@ -197,7 +255,7 @@ pcl::PointCloud<PoseEstimator::PointT>::Ptr PoseEstimator::correct(const ros::Ti
     q.coeffs() *= -1.0f;
   }
 
-  Eigen::VectorXf observation(7);
+  Eigen::Matrix<float, 7, 1> observation;
   observation.middleRows(0, 3) = p;
   observation.middleRows(3, 4) = Eigen::Vector4f(q.w(), q.x(), q.y(), q.z());
   last_observation = trans;
@@ -215,8 +273,152 @@ pcl::PointCloud<PoseEstimator::PointT>::Ptr PoseEstimator::correct(const ros::Ti
     odom_ukf->correct(observation);
     odom_pred_error = odom_guess.inverse() * registration->getFinalTransformation();
   }
+}
+
+/**
+ * @brief cloud aligned to the globalmap by the last correction
+ * @return aligned cloud (nullptr before the first correction)
+ */
+pcl::PointCloud<PoseEstimator::PointT>::Ptr PoseEstimator::aligned_cloud() {
+  return last_aligned;
+}
+
+/**
+ * @brief move the estimate to a new pose (e.g., a relocalization result) without restarting the filter
+ * @param pos   new position
+ * @param quat  new orientation
+ */
+void PoseEstimator::reset_pose(const Eigen::Vector3f& pos, const Eigen::Quaternionf& quat) {
+  const Eigen::Quaternionf new_quat = quat.normalized();
+  const Eigen::Matrix3f delta_rot = new_quat.toRotationMatrix() * this->quat().toRotationMatrix().transpose();
+
+  Eigen::Matrix<float, 16, 1> mean = ukf->mean;
+  mean.middleRows(0, 3) = pos;
+  mean.middleRows(3, 3) = delta_rot * mean.middleRows<3>(3);
+  mean.middleRows(6, 4) = Eigen::Vector4f(new_quat.w(), new_quat.x(), new_quat.y(), new_quat.z());
+
+  // the pose uncertainty is reset to the initial one, and its correlation with the velocity and the biases is dropped
+  Eigen::Matrix<float, 16, 16> cov = ukf->cov;
+  cov.topRows(10).setZero();
+  cov.leftCols(10).setZero();
+  cov.block<10, 10>(0, 0) = Eigen::Matrix<float, 10, 10>::Identity() * 0.01;
+  cov.block<3, 3>(3, 3) = delta_rot * ukf->cov.block<3, 3>(3, 3) * delta_rot.transpose();
+
+  ukf->setMean(mean);
+  ukf->setCov(cov);
+
+  last_observation.setIdentity();
+  last_observation.block<3, 3>(0, 0) = new_quat.toRotationMatrix();
+  last_observation.block<3, 1>(0, 3) = pos;
+
+  // the odometry-based estimate is restarted from the new pose at the next odometry prediction
+  odom_ukf.reset();
+  wo_pred_error = boost::none;
+  imu_pred_error = boost::none;
+  odom_pred_error = boost::none;
+}
+
+/**
+ * @brief use the square-root form of the filters
+ * @param enable  if true, the square-root form is used
+ */
+void PoseEstimator::set_square_root_filter(bool enable) {
+  square_root_filter = enable;
+  ukf->setSquareRoot(enable);
+  if (odom_ukf) {
+    odom_ukf->setSquareRoot(enable);
+  }
+}
+
+/**
+ * @brief replace the registration method (e.g., when the target submap is switched)
+ * @param registration  registration method with a ready input target
+ */
+void PoseEstimator::set_registration(const pcl::Registration<PointT, PointT>::Ptr& registration) {
+  this->registration = registration;
+}
 
-  return aligned;
+/**
+ * @brief limit the registration effort of each correction
+ * @param iterations_per_chunk  iterations of each chunk (<= 0 to disable the budgeting and run the registration at once)
+ * @param max_iterations        max total iterations (<= 0: the max iterations of the registration)
+ * @param max_time              max registration time [sec], checked between chunks (<= 0: unlimited)
+ * @param min_delta_trans       the correction stops early when a chunk moves the estimate less than this [m] (clamped to >= 1e-6)
+ * @param min_delta_rot         the correction stops early when a chunk rotates the estimate less than this [rad] (clamped to >= 1e-6)
+ */
+void PoseEstimator::set_correction_budget(int iterations_per_chunk, int max_iterations, double max_time, double min_delta_trans, double min_delta_rot) {
+  correction_chunk_iterations = iterations_per_chunk;
+  correction_max_iterations = max_iterations;
+  correction_max_time = max_time;
+  correction_min_delta_trans = std::max(1e-6, min_delta_trans);
+  correction_min_delta_rot = std::max(1e-6, min_delta_rot);
+}
+
+/**
+ * @brief run the registration within the correction budget
+ * @note  each chunk starts from the result of the previous one, and the result of the last chunk is the estimate
+ * @param aligned     aligned input cloud
+ * @param init_guess  initial guess
+ */
+void PoseEstimator::align(pcl::PointCloud<PointT>& aligned, const Eigen::Matrix4f& init_guess) {
+  last_truncated = false;
+  auto pyramid = dynamic_cast<RegistrationPyramid*>(registration.get());
+  if (correction_chunk_iterations <= 0) {
+    registration->align(aligned, init_guess);
+    last_iterations = registration_num_iterations(*registration) + (pyramid ? pyramid->num_coarse_iterations() : 0);
+    return;
+  }
+
+  const int max_iterations = registration->getMaximumIterations();
+  const auto t1 = std::chrono::steady_clock::now();
+
+  // without max_iterations, the total is bounded by the max iterations of the registration so that an oscillating or
+  // diverging registration does not run forever
+  const int total_iterations = correction_max_iterations > 0 ? correction_max_iterations : std::max(1, max_iterations);
+
+  last_iterations = 0;
+  bool first_chunk = true;
+  Eigen::Matrix4f guess = init_guess;
+  while (true) {
+    const int chunk = std::max(1, std::min(correction_chunk_iterations, total_iterations - last_iterations));
+
+    registration->setMaximumIterations(chunk);
+    registration->align(aligned, guess);
+
+    const int iterations = registration_num_iterations(*registration);
+    last_iterations += std::max(1, iterations);
+
+    // the coarse pyramid levels run only in the first chunk, and count against the budget
+    if (pyramid && first_chunk) {
+      last_iterations += pyramid->num_coarse_iterations();
+      pyramid->set_fine_only(true);
+    }
+    first_chunk = false;
+
+    const Eigen::Matrix4f result = registration->getFinalTransformation();
+    const Eigen::Matrix4f delta = guess.inverse() * result;
+    guess = result;
+
+    // the registration converged within the chunk or the chunk barely moved the estimate
+    const double delta_rot = Eigen::AngleAxisf(Eigen::Matrix3f(delta.block<3, 3>(0, 0))).angle();
+    if (!registration_reached_max_iterations(*registration, chunk) || (delta.block<3, 1>(0, 3).norm() < correction_min_delta_trans && delta_rot < correction_min_delta_rot)) {
+      break;
+    }
+
+    const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+    if (last_iterations >= total_iterations || (correction_max_time > 0.0 && elapsed >= correction_max_time)) {
+      last_truncated = true;
+      break;
+    }
+  }
+
+  registration->setMaximumIterations(max_iterations);
+
+  // the next correction runs the coarse levels unless this whole correction was small
+  if (pyramid) {
+    pyramid->set_fine_only(false);
+    pyramid->update_tracking(init_guess, guess, registration->hasConverged());
+  }
 }
 
 /* getters */
@@ -224,6 +426,14 @@ ros::Time PoseEstimator::last_correction_time() const {
   return last_correction_stamp;
 }
 
+int PoseEstimator::last_correction_iterations() const {
+  return last_iterations;
+}
+
+bool PoseEstimator::last_correction_truncated() const {
+  return last_truncated;
+}
+
 Eigen::Vector3f PoseEstimator::pos() const {
   return Eigen::Vector3f(ukf->mean[0], ukf->mean[1], ukf->mean[2]);
 }
@@ -243,6 +453,14 @@ Eigen::Matrix4f PoseEstimator::matrix() const {
   return m;
 }
 
+Eigen::Vector3f PoseEstimator::acc_bias() const {
+  return Eigen::Vector3f(ukf->mean[10], ukf->mean[11], ukf->mean[12]);
+}
+
+Eigen::Vector3f PoseEstimator::gyro_bias() const {
+  return Eigen::Vector3f(ukf->mean[13], ukf->mean[14], ukf->mean[15]);
+}
+
 Eigen::Vector3f PoseEstimator::odom_pos() const {
   return Eigen::Vector3f(odom_ukf->mean[0], odom_ukf->mean[1], odom_ukf->mean[2]);
 }
@@ -0,0 +1,149 @@
+#include <hdl_localization/registration_factory.hpp>
+
+#include <sstream>
+#include <ros/ros.h>
+#include <pclomp/ndt_omp.h>
+#include <fast_gicp/ndt/ndt_cuda.hpp>
+#include <hdl_localization/registration_pyramid.hpp>
+#include <hdl_localization/shared_registration.hpp>
+
+// messages are logged with the name of the caller (e.g., the nodelet name) as NODELET_* does
+#define REGISTRATION_LOG_STREAM(level, args)                 \
+  do {                                                       \
+    if (params.logger_name.empty()) {                        \
+      ROS_##level##_STREAM(args);                            \
+    } else {                                                 \
+      ROS_##level##_STREAM_NAMED(params.logger_name, args);  \
+    }                                                        \
+  } while (0)
+
+namespace hdl_localization {
+
+/**
+ * @brief create a registration method
+ * @param params  registration settings
+ * @return registration method (a RegistrationPyramid if ndt_pyramid_resolutions is given, nullptr if the method is unknown)
+ * @note   with share_target, each level is a SharedRegistration
+ */
+pcl::Registration<pcl::PointXYZI, pcl::PointXYZI>::Ptr create_registration(const RegistrationParams& params) {
+  using PointT = pcl::PointXYZI;
+
+  if(params.share_target && params.ndt_pyramid_resolutions.empty()) {
+    if(params.reg_method != "NDT_OMP" && params.reg_method.find("NDT_CUDA") == std::string::npos) {
+      REGISTRATION_LOG_STREAM(ERROR, "unknown registration method:" << params.reg_method);
+      return nullptr;
+    }
+
+    // the registration that builds the target is created only if the target is not in the cache
+    RegistrationParams unshared_params = params;
+    unshared_params.share_target = false;
+
+    std::stringstream key;
+    key << params.reg_method << "/" << params.ndt_neighbor_search_method << "/" << params.ndt_neighbor_search_radius << "/" << params.ndt_resolution;
+    return SharedRegistration::Ptr(new SharedRegistration([=] { return create_registration(unshared_params); }, key.str(), params.shared_target_id));
+  }
+
+  if(!params.ndt_pyramid_resolutions.empty()) {
+    RegistrationParams level_params = params;
+    level_params.ndt_pyramid_resolutions.clear();
+
+    std::vector<pcl::Registration<PointT, PointT>::Ptr> coarse_levels;
+    for(double resolution : params.ndt_pyramid_resolutions) {
+      REGISTRATION_LOG_STREAM(INFO, "create pyramid level (resolution=" << resolution << ")");
+      level_params.ndt_resolution = resolution;
+      coarse_levels.push_back(create_registration(level_params));
+      if(!coarse_levels.back()) {
+        return nullptr;
+      }
+    }
+
+    level_params.ndt_resolution = params.ndt_resolution;
+    auto fine_level = create_registration(level_params);
+    if(!fine_level) {
+      return nullptr;
+    }
+    return RegistrationPyramid::Ptr(new RegistrationPyramid(coarse_levels, fine_level, params.ndt_pyramid_tracking_translation, params.ndt_pyramid_tracking_rotation));
+  }
+
+  if(params.reg_method == "NDT_OMP") {
+    REGISTRATION_LOG_STREAM(INFO, "NDT_OMP is selected");
+    pclomp::NormalDistributionsTransform<PointT, PointT>::Ptr ndt(new pclomp::NormalDistributionsTransform<PointT, PointT>());
+    ndt->setTransformationEpsilon(0.01);
+    ndt->setResolution(params.ndt_resolution);
+    if (params.ndt_neighbor_search_method == "DIRECT1") {
+      REGISTRATION_LOG_STREAM(INFO, "search_method DIRECT1 is selected");
+      ndt->setNeighborhoodSearchMethod(pclomp::DIRECT1);
+    } else if (params.ndt_neighbor_search_method == "DIRECT7") {
+      REGISTRATION_LOG_STREAM(INFO, "search_method DIRECT7 is selected");
+      ndt->setNeighborhoodSearchMethod(pclomp::DIRECT7);
+    } else {
+      if (params.ndt_neighbor_search_method == "KDTREE") {
+        REGISTRATION_LOG_STREAM(INFO, "search_method KDTREE is selected");
+      } else {
+        REGISTRATION_LOG_STREAM(WARN, "invalid search method was given");
+        REGISTRATION_LOG_STREAM(WARN, "default method is selected (KDTREE)");
+      }
+      ndt->setNeighborhoodSearchMethod(pclomp::KDTREE);
+    }
+    return ndt;
+  } else if(params.reg_method.find("NDT_CUDA") != std::string::npos) {
+    REGISTRATION_LOG_STREAM(INFO, "NDT_CUDA is selected");
+    boost::shared_ptr<fast_gicp::NDTCuda<PointT, PointT>> ndt(new fast_gicp::NDTCuda<PointT, PointT>);
+    ndt->setResolution(params.ndt_resolution);
+
+    if(params.reg_method.find("D2D") != std::string::npos) {
+      ndt->setDistanceMode(fast_gicp::NDTDistanceMode::D2D);
+    } else if (params.reg_method.find("P2D") != std::string::npos) {
+      ndt->setDistanceMode(fast_gicp::NDTDistanceMode::P2D);
+    }
+
+    if (params.ndt_neighbor_search_method == "DIRECT1") {
+      REGISTRATION_LOG_STREAM(INFO, "search_method DIRECT1 is selected");
+      ndt->setNeighborSearchMethod(fast_gicp::NeighborSearchMethod::DIRECT1);
+    } else if (params.ndt_neighbor_search_method == "DIRECT7") {
+      REGISTRATION_LOG_STREAM(INFO, "search_method DIRECT7 is selected");
+      ndt->setNeighborSearchMethod(fast_gicp::NeighborSearchMethod::DIRECT7);
+    } else if (params.ndt_neighbor_search_method == "DIRECT_RADIUS") {
+      REGISTRATION_LOG_STREAM(INFO, "search_method DIRECT_RADIUS is selected : " << params.ndt_neighbor_search_radius);
+      ndt->setNeighborSearchMethod(fast_gicp::NeighborSearchMethod::DIRECT_RADIUS, params.ndt_neighbor_search_radius);
+    } else {
+      REGISTRATION_LOG_STREAM(WARN, "invalid search method was given");
+    }
+    return ndt;
+  }
+
+  REGISTRATION_LOG_STREAM(ERROR, "unknown registration method:" << params.reg_method);
+  return nullptr;
+}
+
+/**
+ * @brief number of iterations of the last alignment
+ * @note  pcl::Registration keeps the count in the protected member nr_iterations_ (updated by pclomp and fast_gicp) without a getter.
+ *        a pointer to the member formed in a derived class can be applied to any registration object.
+ * @param registration  registration method
+ */
+int registration_num_iterations(const pcl::Registration<pcl::PointXYZI, pcl::PointXYZI>& registration) {
+  struct Accessor : public pcl::Registration<pcl::PointXYZI, pcl::PointXYZI> {
+    static int get(const pcl::Registration<pcl::PointXYZI, pcl::PointXYZI>& registration) {
+      return registration.*(&Accessor::nr_iterations_);
+    }
+  };
+  return Accessor::get(registration);
+}
+
+/**
+ * @brief check if the last alignment was stopped by the max iterations (rather than converged)
+ * @note  the libraries count the iterations differently. pclomp checks nr_iterations_ > max_iterations_ before incrementing it,
+ *        so it runs up to max_iterations + 2 iterations and converged_ is set in either case (nr_iterations_ <= max_iterations + 1
+ *        means that the transformation epsilon was reached). fast_gicp runs up to max_iterations iterations, leaves nr_iterations_
+ *        at the index of the last one, and sets converged_ only when the epsilon is reached.
+ *        an alignment aborted before the max iterations (e.g., a degenerate step) is not considered as stopped by the max iterations.
+ * @param registration    registration method
+ * @param max_iterations  max iterations set for the last alignment
+ */
+bool registration_reached_max_iterations(const pcl::Registration<pcl::PointXYZI, pcl::PointXYZI>& registration, int max_iterations) {
+  const int iterations = registration_num_iterations(registration);
+  return iterations >= max_iterations - 1 && (!registration.hasConverged() || iterations > max_iterations + 1);
+}
+
+}  // namespace hdl_localization
@@ -0,0 +1,98 @@
+#include <hdl_localization/registration_pyramid.hpp>
+
+#include <Eigen/Geometry>
+#include <pcl/search/kdtree.h>
+#include <hdl_localization/registration_factory.hpp>
+#include <hdl_localization/shared_registration.hpp>
+
+namespace hdl_localization {
+
+/**
+ * @brief constructor
+ * @param coarse_levels         registration methods run before the fine level (from coarse to fine)
+ * @param fine_level            registration method of the finest level
+ * @param tracking_translation  the estimate is tracking when the last alignment moved the guess less than this [m]
+ * @param tracking_rotation     the estimate is tracking when the last alignment rotated the guess less than this [rad]
+ */
+RegistrationPyramid::RegistrationPyramid(const std::vector<RegistrationPtr>& coarse_levels, const RegistrationPtr& fine_level, double tracking_translation, double tracking_rotation)
+    : coarse_levels(coarse_levels), fine_level(fine_level), tracking_translation(tracking_translation), tracking_rotation(tracking_rotation), tracking(false), fine_only(false), levels_used(0), coarse_iterations(0) {
+  reg_name_ = "RegistrationPyramid";
+  max_iterations_ = fine_level->getMaximumIterations();
+}
+
+RegistrationPyramid::~RegistrationPyramid() {}
+
+void RegistrationPyramid::setInputSource(const PointCloudSourceConstPtr& cloud) {
+  pcl::Registration<PointT, PointT>::setInputSource(cloud);
+  for (const auto& level : coarse_levels) {
+    level->setInputSource(cloud);
+  }
+  fine_level->setInputSource(cloud);
+}
+
+void RegistrationPyramid::setInputTarget(const PointCloudTargetConstPtr& cloud) {
+  pcl::Registration<PointT, PointT>::setInputTarget(cloud);
+
+  fine_level->setInputTarget(cloud);
+
+  // the levels share one search tree instead of building one over the whole target in the first alignment of each level
+  // (a shared fine level has already built its tree, which is shared with the other instances)
+  pcl::search::KdTree<PointT>::Ptr tree;
+  if (dynamic_cast<SharedRegistration*>(fine_level.get())) {
+    tree = fine_level->getSearchMethodTarget();
+  } else {
+    tree.reset(new pcl::search::KdTree<PointT>());
+    tree->setInputCloud(cloud);
+    fine_level->setSearchMethodTarget(tree, true);
+  }
+
+  for (const auto& level : coarse_levels) {
+    level->setInputTarget(cloud);
+    level->setSearchMethodTarget(tree, true);
+  }
+  setSearchMethodTarget(tree, true);
+}
+
+void RegistrationPyramid::computeTransformation(PointCloudSource& output, const Matrix4& guess) {
+  levels_used = 0;
+  coarse_iterations = 0;
+
+  Matrix4 estimate = guess;
+  if (!tracking && !fine_only) {
+    for (const auto& level : coarse_levels) {
+      level->align(output, estimate);
+      estimate = level->getFinalTransformation();
+      coarse_iterations += registration_num_iterations(*level);
+      levels_used++;
+    }
+  }
+
+  fine_level->setMaximumIterations(max_iterations_);
+  fine_level->align(output, estimate);
+  levels_used++;
+
+  final_transformation_ = fine_level->getFinalTransformation();
+  transformation_ = fine_level->getLastIncrementalTransformation();
+  converged_ = fine_level->hasConverged();
+  nr_iterations_ = registration_num_iterations(*fine_level);
+
+  if (!fine_only) {
+    update_tracking(guess, final_transformation_, converged_);
+  }
+}
+
+/**
+ * @brief update the tracking state with the whole correction (from the initial guess to the final result)
+ * @note  the coarse levels can be skipped while the prediction stays close to the result
+ * @param guess      initial guess of the correction
+ * @param result     final result of the correction
+ * @param converged  if the final alignment converged
+ */
+void RegistrationPyramid::update_tracking(const Matrix4& guess, const Matrix4& result, bool converged) {
+  const Matrix4 delta = guess.inverse() * result;
+  const double delta_trans = delta.block<3, 1>(0, 3).norm();
+  const double delta_rot = Eigen::AngleAxisf(Eigen::Matrix3f(delta.block<3, 3>(0, 0))).angle();
+  tracking = converged && delta_trans < tracking_translation && delta_rot < tracking_rotation;
+}
+
+}  // namespace hdl_localization
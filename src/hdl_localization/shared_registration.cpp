@@ -0,0 +1,115 @@
+#include <hdl_localization/shared_registration.hpp>
+
+#include <map>
+#include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <pcl/search/kdtree.h>
+#include <hdl_localization/registration_factory.hpp>
+
+namespace hdl_localization {
+
+namespace {
+
+/**
+ * @brief digest of the point coordinates (FNV-1a), so that an id refers to one version of the map only
+ */
+std::uint64_t cloud_digest(const pcl::PointCloud<pcl::PointXYZI>& cloud) {
+  std::uint64_t hash = 14695981039346656037ull;
+  for(const auto& pt : cloud.points) {
+    for(int i = 0; i < 3; i++) {
+      std::uint32_t bits;
+      std::memcpy(&bits, &pt.data[i], sizeof(bits));
+      hash = (hash ^ bits) * 1099511628211ull;
+    }
+  }
+  return hash ^ cloud.size();
+}
+
+}  // namespace
+
+/**
+ * @brief constructor
+ * @param create_registration  function to create the registration when the target is not in the cache
+ * @param key                  registration settings (instances with different keys never share a target)
+ * @param target_id            identifier of the target cloud shared by the clouds with the same points (if empty, the target is
+ *                             identified by the cloud object itself)
+ */
+SharedRegistration::SharedRegistration(const std::function<RegistrationPtr()>& create_registration, const std::string& key, const std::string& target_id)
+    : create_registration(create_registration), key(key), target_id(target_id) {
+  reg_name_ = "SharedRegistration";
+}
+
+SharedRegistration::~SharedRegistration() {}
+
+/**
+ * @brief find the target in the cache, or build it with a new registration (blocks while another instance is building it)
+ */
+void SharedRegistration::setInputTarget(const PointCloudTargetConstPtr& cloud) {
+  pcl::Registration<PointT, PointT>::setInputTarget(cloud);
+
+  std::stringstream sst;
+  sst << key << "/";
+  if (target_id.empty()) {
+    sst << cloud.get();
+  } else {
+    // the clouds with the same id are shared only while they have the same points (a reloaded, patched, or another submap is a new target)
+    sst << target_id << "/" << cloud->size() << "/" << std::hex << cloud_digest(*cloud);
+  }
+
+  std::shared_ptr<Target> found = find_or_create(sst.str());
+  {
+    std::lock_guard<std::mutex> lock(found->mutex);
+    if (!found->registration) {
+      RegistrationPtr registration = create_registration();
+      registration->setInputTarget(cloud);
+
+      // the search tree is built here so that it is never rebuilt while other instances use it
+      pcl::search::KdTree<PointT>::Ptr tree(new pcl::search::KdTree<PointT>());
+      tree->setInputCloud(cloud);
+      registration->setSearchMethodTarget(tree, true);
+
+      found->registration = registration;
+    }
+    setSearchMethodTarget(found->registration->getSearchMethodTarget(), true);
+  }
+
+  target = found;
+}
+
+void SharedRegistration::computeTransformation(PointCloudSource& output, const Matrix4& guess) {
+  std::lock_guard<std::mutex> lock(target->mutex);
+  const RegistrationPtr& registration = target->registration;
+
+  registration->setInputSource(input_);
+  registration->setMaximumIterations(max_iterations_);
+  registration->align(output, guess);
+
+  final_transformation_ = registration->getFinalTransformation();
+  transformation_ = registration->getLastIncrementalTransformation();
+  converged_ = registration->hasConverged();
+  nr_iterations_ = registration_num_iterations(*registration);
+}
+
+/**
+ * @brief find a target in the process-wide cache, or add an empty one
+ * @note  the cache only holds weak references, so a target is released when no instance refers to it
+ */
+std::shared_ptr<SharedRegistration::Target> SharedRegistration::find_or_create(const std::string& key) {
+  static std::mutex cache_mutex;
+  static std::map<std::string, std::weak_ptr<Target>> cache;
+
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  for (auto itr = cache.begin(); itr != cache.end();) {
+    itr = itr->second.expired() ? cache.erase(itr) : std::next(itr);
+  }
+
+  std::shared_ptr<Target> target = cache[key].lock();
+  if (!target) {
+    target = std::make_shared<Target>();
+    cache[key] = target;
+  }
+  return target;
+}
+
+}  // namespace hdl_localization